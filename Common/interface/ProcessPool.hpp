@@ -0,0 +1,38 @@
+#ifndef SIPMCALIB_COMMON_PROCESSPOOL_HPP
+#define SIPMCALIB_COMMON_PROCESSPOOL_HPP
+
+#include <functional>
+#include <string>
+
+/**
+ * @brief Running independent tasks in forked worker processes.
+ * @ingroup Common
+ *
+ * @details For tasks that cannot share a process, such as fits going through
+ * the global state of RooFit. Each task runs in a child process forked from the
+ * calling thread, so the child starts with a copy of the memory of the caller
+ * (loaded libraries, parsed settings and data) without paying any startup cost
+ * again, and the output of the task is passed back to the caller as a byte
+ * string.
+ */
+class ProcessPool
+{
+public:
+  ProcessPool( const unsigned njobs = 0 );
+
+  /**
+   * @brief Maximum number of concurrent processes.
+   */
+  inline unsigned
+  NJobs() const { return _njobs; }
+
+  void ParallelTasks( const size_t n,
+                      const std::function<std::string( size_t )>& task,
+                      const std::function<void( size_t, bool,
+                                                const std::string& )>& collect );
+
+private:
+  unsigned _njobs;
+};
+
+#endif
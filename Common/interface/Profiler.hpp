@@ -0,0 +1,68 @@
+#ifndef SIPMCALIB_COMMON_PROFILER_HPP
+#define SIPMCALIB_COMMON_PROFILER_HPP
+
+#include "UserUtils/Common/interface/ArgumentExtender.hpp"
+
+#include <atomic>
+#include <string>
+
+/**
+ * @brief Process wide timing and memory instrumentation of the processing
+ * stages.
+ * @ingroup Common
+ *
+ * @details Stages are instrumented by placing a SIPMCALIB_PROFILE( "name" )
+ * statement at the start of the scope to be measured. When the profiler is
+ * disabled (the default), a scope costs a single relaxed atomic load.
+ */
+class Profiler
+{
+public:
+  class Scope
+  {
+public:
+    inline explicit
+    Scope( const char* name ) :
+      _name  ( name ),
+      _active( Profiler::Enabled() )
+    {
+      if( _active ){ start(); }
+    }
+
+    inline
+    ~Scope(){ if( _active ){ stop(); } }
+
+    Scope( const Scope& )            = delete;
+    Scope& operator=( const Scope& ) = delete;
+
+private:
+    const char* _name;
+    const bool  _active;
+    double      _wall;
+    double      _cpu;
+    long        _rss;
+
+    void start();
+    void stop();
+  };
+
+  static usr::po::options_description Arguments();
+  static void                         Setup( const usr::ArgumentExtender& );
+  static int                          Setup( int argc, char* argv[] );
+
+  static void Enable( const std::string& report, const std::string& trace );
+  static void Write();
+
+  inline static bool
+  Enabled(){ return _enabled.load( std::memory_order_relaxed ); }
+
+private:
+  static std::atomic<bool> _enabled;
+};
+
+#define SIPMCALIB_PROFILE_CAT_( A, B ) A ## B
+#define SIPMCALIB_PROFILE_CAT( A, B ) SIPMCALIB_PROFILE_CAT_( A, B )
+#define SIPMCALIB_PROFILE( NAME ) \
+  Profiler::Scope SIPMCALIB_PROFILE_CAT( sipmcalib_profile_, __LINE__ )( NAME )
+
+#endif
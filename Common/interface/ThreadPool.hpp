@@ -0,0 +1,59 @@
+#ifndef SIPMCALIB_COMMON_THREADPOOL_HPP
+#define SIPMCALIB_COMMON_THREADPOOL_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Persistent pool of worker threads for data parallel computations.
+ * @ingroup Common
+ *
+ * @details The worker threads are spawned once at construction and stay idle
+ * between calls, so that repeated calls (such as one per likelihood evaluation
+ * during a fit) do not pay for thread creation. The calling thread always
+ * participates in the computation as thread index 0.
+ */
+class ThreadPool
+{
+public:
+  ThreadPool( const unsigned nthreads = 0 );
+  ~ThreadPool();
+
+  /**
+   * @brief Number of threads (including the calling thread) used by the pool.
+   */
+  inline unsigned
+  NThreads() const { return _nthreads; }
+
+  void Run( const std::function<void( unsigned )>& task );
+  void ParallelFor( const size_t n,
+                    const std::function<void( size_t, size_t, unsigned )>& );
+  void ParallelTasks( const size_t n,
+                      const std::function<void( size_t, unsigned )>& );
+
+  static unsigned HardwareThreads();
+
+private:
+  unsigned                 _nthreads;
+  std::vector<std::thread> _workers;
+
+  std::mutex              _mutex;
+  std::condition_variable _start_cond;
+  std::condition_variable _done_cond;
+
+  const std::function<void( unsigned )>* _task;
+  uint64_t                               _generation;
+  unsigned                               _pending;
+  bool                                   _stop;
+  std::exception_ptr                     _error;
+
+  void worker_loop( const unsigned index );
+  void run_task( const unsigned index );
+};
+
+#endif
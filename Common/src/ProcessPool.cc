@@ -0,0 +1,186 @@
+#include "SiPMCalib/Common/interface/ProcessPool.hpp"
+#include "SiPMCalib/Common/interface/ThreadPool.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/**
+ * @brief Creating the pool with a given number of concurrent processes.
+ *
+ * If the number of jobs is set to 0, then the number of hardware threads
+ * reported by the system is used. A pool with 1 job forks no processes, and
+ * all tasks are executed directly in the calling thread.
+ */
+ProcessPool::ProcessPool( const unsigned njobs ) :
+  _njobs( njobs == 0 ? ThreadPool::HardwareThreads() : njobs )
+{}
+
+
+/**
+ * @brief Writing the full buffer to a file descriptor, retrying on partial
+ * writes and interrupts.
+ */
+static bool
+WriteAll( const int fd, const std::string& buffer )
+{
+  size_t done = 0;
+
+  while( done < buffer.size() ){
+    const ssize_t n = write( fd, buffer.data()+done, buffer.size()-done );
+    if( n < 0 && errno == EINTR ){ continue; }
+    if( n <= 0 ){ return false; }
+    done += n;
+  }
+
+  return true;
+}
+
+
+/**
+ * @brief Processing n independent tasks with up to NJobs() worker processes.
+ *
+ * For each task index, a child process is forked from the calling thread to run
+ * the task, and the string returned by the task is sent back to the caller
+ * through a pipe. A new task is started as soon as any running task finishes,
+ * so tasks of uneven cost are balanced between the job slots. The collect
+ * function is called in the calling thread, in the order the tasks finish,
+ * with the task index, whether the task succeeded and the output of the task.
+ * A task fails if it throws an exception, or if the child process cannot be
+ * created or does not exit normally (crash, out of memory kill), in which
+ * case the output is empty and the other tasks are not affected.
+ *
+ * Nothing done by the task in the child process is visible to the caller
+ * other than its output, and only the calling thread exists in the child
+ * process, so the task must not rely on the worker threads of any pool created
+ * before the call. Standard output is flushed before each fork so that pending
+ * output is not duplicated.
+ */
+void
+ProcessPool::ParallelTasks( const size_t                                                   n,
+                            const std::function<std::string( size_t )>&                    task,
+                            const std::function<void( size_t, bool, const std::string& )>& collect )
+{
+  if( _njobs == 1 ){
+    for( size_t i = 0; i < n; ++i ){
+      std::string output;
+      bool        success = true;
+
+      try {
+        output = task( i );
+      } catch( ... ){
+        success = false;
+      }
+
+      collect( i, success, success ? output : std::string() );
+    }
+
+    return;
+  }
+
+  struct Job
+  {
+    size_t      index;
+    pid_t       pid;
+    int         fd;
+    std::string output;
+  };
+
+  std::vector<Job> running;
+  size_t           next = 0;
+
+  while( next < n || !running.empty() ){
+    if( next < n && running.size() < _njobs ){
+      const size_t index = next++;
+      int          fd[2];
+
+      std::cout.flush();
+      std::cerr.flush();
+      std::fflush( nullptr );
+
+      if( pipe( fd ) != 0 ){
+        collect( index, false, "" );
+        continue;
+      }
+
+      const pid_t pid = fork();
+
+      if( pid == 0 ){
+        close( fd[0] );
+
+        std::string output;
+        bool        success = true;
+
+        try {
+          output = task( index );
+        } catch( ... ){
+          success = false;
+        }
+
+        success = success && WriteAll( fd[1], output );
+        close( fd[1] );
+        std::cout.flush();
+        std::cerr.flush();
+        std::fflush( nullptr );
+        _exit( success ? 0 : 1 );
+      }
+
+      close( fd[1] );
+      if( pid < 0 ){
+        close( fd[0] );
+        collect( index, false, "" );
+      } else {
+        running.push_back( Job{ index, pid, fd[0], "" } );
+      }
+
+      continue;
+    }
+
+    // Waiting for output from any of the running jobs.
+    std::vector<pollfd> fds;
+
+    for( const auto& job : running ){
+      fds.push_back( pollfd{ job.fd, POLLIN, 0 } );
+    }
+
+    if( poll( fds.data(), fds.size(), -1 ) < 0 ){
+      if( errno == EINTR ){ continue; }
+      throw std::runtime_error( "Failed to poll the worker processes" );
+    }
+
+    for( size_t k = fds.size(); k-- > 0; ){
+      if( !fds[k].revents ){ continue; }
+
+      Job&          job = running[k];
+      char          buffer[65536];
+      const ssize_t nread = read( job.fd, buffer, sizeof( buffer ) );
+
+      if( nread > 0 ){
+        job.output.append( buffer, nread );
+        continue;
+      } else if( nread < 0 && errno == EINTR ){
+        continue;
+      }
+
+      // End of output, the child has closed the pipe or exited.
+      close( job.fd );
+
+      int status = 0;
+
+      while( waitpid( job.pid, &status, 0 ) < 0 && errno == EINTR ){}
+
+      const bool success = nread == 0
+                           && WIFEXITED( status )
+                           && WEXITSTATUS( status ) == 0;
+      Job done = std::move( job );
+      running.erase( running.begin()+k );
+      collect( done.index, success, success ? done.output : std::string() );
+    }
+  }
+}
@@ -0,0 +1,304 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <sys/resource.h>
+
+/**
+ * @class Profiler
+ * @ingroup Common
+ *
+ * @details For each named stage, the profiler accumulates the number of
+ * calls, the wall time, the CPU time of the process (so stages running on a
+ * ThreadPool report the CPU time of all threads) and the largest increase of
+ * the peak resident memory during a single call. Scopes can be nested and can
+ * run on any thread, though the CPU time of concurrently running stages will
+ * include each other. Each scope is also recorded as an event for the Chrome
+ * trace format (viewable in chrome://tracing or Perfetto), with nested scopes
+ * displayed as nested events per thread.
+ *
+ * The profiler is enabled by the `--profile` (JSON summary) or `--profiletrace`
+ * (trace events) options of the SiPM_* binaries, see Arguments(), and the
+ * outputs are written when the program exits.
+ */
+
+std::atomic<bool> Profiler::_enabled( false );
+
+namespace {
+
+struct Stage
+{
+  std::string   name;
+  unsigned long calls;
+  double        wall;
+  double        cpu;
+  long          rss;// Largest peak RSS increase of a single call [kB]
+};
+
+struct Event
+{
+  const char* name;
+  double      start;
+  double      duration;
+  unsigned    tid;
+};
+
+// Bounding the memory used by the trace of long running jobs.
+const size_t max_events = 1000000;
+
+struct State
+{
+  std::mutex                            mutex;
+  std::string                           report;
+  std::string                           trace;
+  std::chrono::steady_clock::time_point t0;
+  double                                cpu0;
+  std::vector<Stage>                    stages;// In order of the first call
+  std::map<std::string, size_t>         index;
+  std::vector<Event>                    events;
+  size_t                                dropped = 0;
+  std::map<std::thread::id, unsigned>   tids;
+};
+
+State&
+GetState()
+{
+  static State state;
+  return state;
+}
+
+
+double
+WallTime()
+{
+  return std::chrono::duration<double>(
+    std::chrono::steady_clock::now()-GetState().t0 ).count();
+}
+
+
+double
+CPUTime()
+{
+  timespec t;
+  clock_gettime( CLOCK_PROCESS_CPUTIME_ID, &t );
+  return t.tv_sec+1e-9 * t.tv_nsec;
+}
+
+
+long
+PeakRSS()
+{
+  rusage r;
+  getrusage( RUSAGE_SELF, &r );
+  return r.ru_maxrss;
+}
+
+
+std::string
+JSONString( const std::string& x )
+{
+  std::string ans = "\"";
+
+  for( const char c : x ){
+    if( (unsigned char)c < 0x20 ){// Control characters
+      char buf[8];
+      std::snprintf( buf, sizeof( buf ), "\\u%04x", (unsigned char)c );
+      ans += buf;
+    } else {
+      if( c == '"' || c == '\\' ){ ans += '\\'; }
+      ans += c;
+    }
+  }
+
+  return ans+"\"";
+}
+
+}
+
+
+void
+Profiler::Scope::start()
+{
+  _rss  = PeakRSS();
+  _cpu  = CPUTime();
+  _wall = WallTime();
+}
+
+
+void
+Profiler::Scope::stop()
+{
+  const double wall = WallTime()-_wall;
+  const double cpu  = CPUTime()-_cpu;
+  const long   rss  = PeakRSS()-_rss;
+
+  State&                      state = GetState();
+  std::lock_guard<std::mutex> lock( state.mutex );
+
+  auto it = state.index.find( _name );
+  if( it == state.index.end() ){
+    it = state.index.emplace( _name, state.stages.size() ).first;
+    state.stages.push_back( Stage{ _name, 0, 0, 0, 0 } );
+  }
+
+  Stage& stage = state.stages[it->second];
+  stage.calls += 1;
+  stage.wall  += wall;
+  stage.cpu   += cpu;
+  stage.rss    = std::max( stage.rss, rss );
+
+  if( state.trace.empty() ){ return; }
+  if( state.events.size() >= max_events ){
+    ++state.dropped;
+    return;
+  }
+
+  const auto tid = state.tids.emplace( std::this_thread::get_id(),
+                                       state.tids.size() ).first->second;
+  state.events.push_back( Event{ _name, _wall, wall, tid } );
+}
+
+
+usr::po::options_description
+Profiler::Arguments()
+{
+  usr::po::options_description desc( "Profiling options" );
+  desc.add_options()
+    ( "profile",
+    usr::po::value<std::string>(),
+    "Write the wall time, CPU time, memory and call count of each processing "
+    "stage to this JSON file on exit" )
+    ( "profiletrace",
+    usr::po::value<std::string>(),
+    "Write the processing stages as a Chrome trace (chrome://tracing) JSON "
+    "file on exit" )
+  ;
+  return desc;
+}
+
+
+/**
+ * @brief Enabling the profiler if requested by the Arguments() options.
+ */
+void
+Profiler::Setup( const usr::ArgumentExtender& args )
+{
+  if( args.CheckArg( "profile" ) || args.CheckArg( "profiletrace" ) ){
+    Enable( args.ArgOpt<std::string>( "profile", "" ),
+            args.ArgOpt<std::string>( "profiletrace", "" ) );
+  }
+}
+
+
+/**
+ * @brief Same as Setup() for programs parsing the command line directly: the
+ * `--profile <file>` and `--profiletrace <file>` arguments are removed from
+ * argv, and the new argc is returned.
+ */
+int
+Profiler::Setup( int argc, char* argv[] )
+{
+  std::string report, trace;
+  int         n = 1;
+
+  for( int i = 1; i < argc; ++i ){
+    const bool isreport = std::strcmp( argv[i], "--profile" ) == 0;
+    const bool istrace  = std::strcmp( argv[i], "--profiletrace" ) == 0;
+    if( ( isreport || istrace ) && i+1 < argc ){
+      ( isreport ? report : trace ) = argv[++i];
+    } else {
+      argv[n++] = argv[i];
+    }
+  }
+
+  if( !report.empty() || !trace.empty() ){
+    Enable( report, trace );
+  }
+  return n;
+}
+
+
+/**
+ * @brief Enabling the profiler, the summary report and the trace are written
+ * to the given files (skipped if empty) when Write() is called, which happens
+ * automatically on exit.
+ */
+void
+Profiler::Enable( const std::string& report, const std::string& trace )
+{
+  State& state = GetState();
+  {
+    std::lock_guard<std::mutex> lock( state.mutex );
+    state.report = report;
+    state.trace  = trace;
+    if( _enabled ){ return; }
+    state.t0   = std::chrono::steady_clock::now();
+    state.cpu0 = CPUTime();
+  }
+
+  _enabled = true;
+  std::atexit( Write );
+}
+
+
+/**
+ * @brief Writing the summary report and the trace of all scopes completed so
+ * far.
+ */
+void
+Profiler::Write()
+{
+  if( !_enabled ){ return; }
+
+  State&                      state = GetState();
+  std::lock_guard<std::mutex> lock( state.mutex );
+
+  if( !state.report.empty() ){
+    std::ofstream fout( state.report );
+    fout << "{\n"
+         << "  \"wall_time\": " << WallTime() << ",\n"
+         << "  \"cpu_time\": " << CPUTime()-state.cpu0 << ",\n"
+         << "  \"peak_rss_kb\": " << PeakRSS() << ",\n"
+         << "  \"stages\": [";
+
+    for( size_t i = 0; i < state.stages.size(); ++i ){
+      const Stage& s = state.stages[i];
+      fout << ( i ? "," : "" ) << "\n    {"
+           << "\"name\": " << JSONString( s.name )
+           << ", \"calls\": " << s.calls
+           << ", \"wall_time\": " << s.wall
+           << ", \"cpu_time\": " << s.cpu
+           << ", \"rss_increase_kb\": " << s.rss << "}";
+    }
+
+    fout << "\n  ]\n}\n";
+  }
+
+  if( !state.trace.empty() ){
+    std::ofstream fout( state.trace );
+    fout << "{\"displayTimeUnit\": \"ms\", \"droppedEvents\": "
+         << state.dropped << ", \"traceEvents\": [";
+
+    for( size_t i = 0; i < state.events.size(); ++i ){
+      const Event& e = state.events[i];
+      char         buf[64];
+      std::snprintf( buf, sizeof( buf ), "%.3f, \"dur\": %.3f",
+                     e.start * 1e6, e.duration * 1e6 );
+      fout << ( i ? "," : "" ) << "\n  {\"name\": " << JSONString( e.name )
+           << ", \"ph\": \"X\", \"pid\": 0, \"tid\": " << e.tid
+           << ", \"ts\": " << buf << "}";
+    }
+
+    fout << "\n]}\n";
+  }
+}
@@ -1,3 +1,4 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/Common/interface/StdFormat.hpp"
 
 #include "UserUtils/Common/interface/STLUtils/OStreamUtils.hpp"
@@ -15,6 +16,8 @@
  */
 StdFormat::StdFormat( const std::string& filename )
 {
+  SIPMCALIB_PROFILE( "StdFormat::Read" );
+
   // Getting everything row by row
   std::ifstream infile( filename );
   std::string   line;
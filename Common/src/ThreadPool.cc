@@ -0,0 +1,203 @@
+#include "SiPMCalib/Common/interface/ThreadPool.hpp"
+
+#include <algorithm>
+#include <deque>
+
+/**
+ * @brief Creating the thread pool with a given number of threads.
+ *
+ * If the number of threads is set to 0, then the number of hardware threads
+ * reported by the system is used. A pool with 1 thread spawns no workers, and
+ * all tasks are executed directly in the calling thread.
+ */
+ThreadPool::ThreadPool( const unsigned nthreads ) :
+  _nthreads  ( nthreads == 0 ? HardwareThreads() : nthreads ),
+  _task      ( nullptr ),
+  _generation( 0 ),
+  _pending   ( 0 ),
+  _stop      ( false )
+{
+  for( unsigned i = 1; i < _nthreads; ++i ){
+    _workers.emplace_back( &ThreadPool::worker_loop, this, i );
+  }
+}
+
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _stop = true;
+  }
+  _start_cond.notify_all();
+
+  for( auto& w : _workers ){
+    w.join();
+  }
+}
+
+
+/**
+ * @brief Number of hardware threads, guaranteed to be at least 1.
+ */
+unsigned
+ThreadPool::HardwareThreads()
+{
+  return std::max( std::thread::hardware_concurrency(), 1u );
+}
+
+
+/**
+ * @brief Running the task on all threads in the pool, blocking until all
+ * threads have finished.
+ *
+ * The task is called once per thread with the thread index (from 0 to
+ * NThreads()-1) as the argument. If any of the tasks throws an exception, the
+ * first exception is rethrown in the calling thread once all threads have
+ * finished. The task must not call Run() of the same pool.
+ */
+void
+ThreadPool::Run( const std::function<void( unsigned )>& task )
+{
+  if( _workers.empty() ){
+    task( 0 );
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock( _mutex );
+    _task    = &task;
+    _pending = _workers.size();
+    _error   = nullptr;
+    ++_generation;
+  }
+  _start_cond.notify_all();
+
+  run_task( 0 );
+
+  std::unique_lock<std::mutex> lock( _mutex );
+  _done_cond.wait( lock, [this]{ return _pending == 0; } );
+  _task = nullptr;
+
+  if( _error ){
+    std::rethrow_exception( _error );
+  }
+}
+
+
+/**
+ * @brief Splitting the index range [0,n) into NThreads() contiguous blocks and
+ * processing each block in a separate thread.
+ *
+ * The function is called with the begin and end index of the block and the
+ * thread index. The partitioning only depends on n and the number of threads,
+ * so the same block is always processed by the same thread index.
+ */
+void
+ThreadPool::ParallelFor( const size_t                                           n,
+                         const std::function<void( size_t, size_t, unsigned )>& f )
+{
+  const size_t nthreads = _nthreads;
+  Run( [n, nthreads, &f]( const unsigned index ){
+    const size_t begin = ( n * index ) / nthreads;
+    const size_t end   = ( n * ( index+1 ) ) / nthreads;
+    if( begin < end ){
+      f( begin, end, index );
+    }
+  } );
+}
+
+
+/**
+ * @brief Processing n independent tasks of uneven cost with work stealing.
+ *
+ * The task indices are dealt round robin into one queue per thread. Each thread
+ * processes its own queue in order, and once it is empty, takes the tasks from
+ * the back of the queues of the other threads, so that no thread stays idle
+ * while tasks are pending. The function is called with the task index and the
+ * index of the thread processing it. Unlike ParallelFor(), the assignment of
+ * tasks to threads depends on the timing, so the function should not depend on
+ * the thread index for anything other than picking per-thread resources.
+ */
+void
+ThreadPool::ParallelTasks( const size_t                                   n,
+                           const std::function<void( size_t, unsigned )>& f )
+{
+  struct Queue
+  {
+    std::mutex         mtx;
+    std::deque<size_t> tasks;
+  };
+
+  std::vector<Queue> queues( _nthreads );
+
+  for( size_t i = 0; i < n; ++i ){
+    queues[i % _nthreads].tasks.push_back( i );
+  }
+
+  Run( [&queues, &f]( const unsigned index ){
+    const size_t nqueue = queues.size();
+
+    while( true ){
+      bool   found = false;
+      size_t task  = 0;
+
+      for( size_t k = 0; k < nqueue && !found; ++k ){
+        Queue&                      q = queues[( index+k ) % nqueue];
+        std::lock_guard<std::mutex> lock( q.mtx );
+        if( q.tasks.empty() ){ continue; }
+        if( k == 0 ){// Own queue
+          task = q.tasks.front();
+          q.tasks.pop_front();
+        } else {// Stealing
+          task = q.tasks.back();
+          q.tasks.pop_back();
+        }
+        found = true;
+      }
+
+      if( !found ){ return; }
+      f( task, index );
+    }
+  } );
+}
+
+
+void
+ThreadPool::worker_loop( const unsigned index )
+{
+  uint64_t last_generation = 0;
+
+  while( true ){
+    {
+      std::unique_lock<std::mutex> lock( _mutex );
+      _start_cond.wait( lock, [this, last_generation]{
+        return _stop || _generation != last_generation;
+      } );
+      if( _stop ){ return; }
+      last_generation = _generation;
+    }
+
+    run_task( index );
+
+    {
+      std::lock_guard<std::mutex> lock( _mutex );
+      --_pending;
+    }
+    _done_cond.notify_one();
+  }
+}
+
+
+void
+ThreadPool::run_task( const unsigned index )
+{
+  try {
+    ( *_task )( index );
+  } catch( ... ){
+    std::lock_guard<std::mutex> lock( _mutex );
+    if( !_error ){
+      _error = std::current_exception();
+    }
+  }
+}
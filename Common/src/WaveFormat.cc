@@ -1,3 +1,4 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/Common/interface/WaveFormat.hpp"
 
 #ifdef CMSSW_GIT_HASH
@@ -16,9 +17,9 @@
 static inline int16_t
 hex_to_int( const char x )
 {
-  return x > 'a' ?
+  return x >= 'a' ?
          10+x-'a' :
-         x > 'A' ?
+         x >= 'A' ?
          10+x-'A' :
          x-'0';
 }
@@ -50,6 +51,8 @@ bit4_to_bit2( const int16_t x )
  */
 WaveFormat::WaveFormat( const std::string& file, const bool invert )
 {
+  SIPMCALIB_PROFILE( "WaveFormat::Read" );
+
   const unsigned factor = invert ?
                           -1 :
                           1;
@@ -255,6 +258,8 @@ WaveFormat::SumList( const unsigned intstart,
                      const unsigned pedstart,
                      const unsigned pedstop ) const
 {
+  SIPMCALIB_PROFILE( "WaveFormat::SumList" );
+
   std::vector<double> ans;
   ans.reserve( NWaveforms() );
 
@@ -0,0 +1,57 @@
+#include "SiPMCalib/Common/interface/WaveFormat.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+// Regression check of the hexadecimal sample decoding of WaveFormat files.
+// A file with one digit per sample is written with all 16 hex digits, once in
+// lower case and once in upper case, and every sample must decode to the
+// value of its digit.
+//
+// Usage: SiPM_WaveFormatDecode
+
+int
+main()
+{
+  const std::string lower = "0123456789abcdef";
+  const std::string upper = "0123456789ABCDEF";
+
+  char name[] = "/tmp/WaveFormatDecodeXXXXXX";
+  const int fd = mkstemp( name );
+  if( fd < 0 ){
+    std::cerr << "Cannot create temporary file" << std::endl;
+    return 1;
+  }
+  close( fd );
+
+  {
+    std::ofstream fout( name );
+    fout << "1 1 1\n" << lower << "\n" << upper << "\n";
+  }
+
+  const WaveFormat wave( name, false );
+  std::remove( name );
+
+  unsigned nfail = 0;
+
+  for( unsigned line = 0; line < 2; ++line ){
+    const std::string& digits = line == 0 ? lower : upper;
+    const auto         raw    = wave.WaveformRaw( line );
+
+    for( unsigned i = 0; i < digits.size(); ++i ){
+      if( i >= raw.size() || raw[i] != (int16_t)i ){
+        std::cout << "Digit '" << digits[i] << "' decoded as "
+                  << ( i < raw.size() ? raw[i] : -1 )
+                  << ", expected " << i << std::endl;
+        ++nfail;
+      }
+    }
+  }
+
+  std::cout << ( nfail == 0 ? "All hex digits decoded correctly" :
+                 "Hex digit decoding failed" ) << std::endl;
+  return nfail == 0 ? 0 : 1;
+}
@@ -1,4 +1,5 @@
 #include "SiPMCalib/Common/interface/MakeRooData.hpp"
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/Common/interface/WaveFormat.hpp"
 #include "SiPMCalib/SiPMCalc/interface/CrossTalkPdf.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMDarkPdf.hpp"
@@ -34,6 +35,8 @@ std::vector<usr::Measurement> CalcAP( const std::string&, const std::string& );
 int
 main( int argc, char*argv[] )
 {
+  argc = Profiler::Setup( argc, argv );
+
   const usr::Measurement crosstalk = CalcCrossTalk( argv[1], argv[2] );
   const usr::Measurement decaytime = CalcDecayTime( argv[1], argv[2] );
   const auto&            vap       = CalcAP(        argv[1], argv[2] );
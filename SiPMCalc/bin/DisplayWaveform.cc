@@ -1,3 +1,4 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/Common/interface/WaveFormat.hpp"
 
 #include "UserUtils/Common/interface/ArgumentExtender.hpp"
@@ -67,7 +68,9 @@ main( int argc, char*argv[] )
 
   usr::ArgumentExtender args;
   args.AddOptions( desc );
+  args.AddOptions( Profiler::Arguments() );
   args.ParseOptions( argc, argv );
+  Profiler::Setup( args );
 
   // Making the raw data format container
   WaveFormat wformat( args.Arg<std::string>( "data" ) );
@@ -1,5 +1,7 @@
 #include "SiPMCalib/Common/interface/MakeRooData.hpp"
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/Common/interface/WaveFormat.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMBinnedNLL.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMDarkPdf.hpp"
 
 #include "UserUtils/Common/interface/ArgumentExtender.hpp"
@@ -41,10 +43,15 @@ main( int argc, char*argv[] )
     ( "maxarea",
     usr::po::value<double>(),
     "Maximum area for perform fit on, leave blank for auto determination" )
+    ( "nthreads",
+    usr::po::value<unsigned>()->default_value( 1 ),
+    "Number of threads used for the likelihood evaluation (0 for all cores)" )
   ;
   usr::ArgumentExtender arg;
   arg.AddOptions( desc );
+  arg.AddOptions( Profiler::Arguments() );
   arg.ParseOptions( argc, argv );
+  Profiler::Setup( arg );
 
   arg.SetNameScheme( {{"output", ""}} );
 
@@ -53,6 +60,7 @@ main( int argc, char*argv[] )
   const double      adcbin = arg.Arg<int>( "adcbin" );
   const unsigned    start  = arg.ArgOpt<int>( "start", 0 );
   const unsigned    end    = arg.ArgOpt<int>( "end", 60 );
+  const unsigned    nthr   = arg.Arg<unsigned>( "nthreads" );
 
   WaveFormat wformat( input );
 
@@ -75,15 +83,16 @@ main( int argc, char*argv[] )
                                          ped.getVal()+1.5 * gain.getVal() );
   data.reset( MakeData( x, list, max ) );
 
-  pdf.fitTo( *data,
-             RooFit::Range( ped.getVal()-3 * s0.getVal(),
-                            ped.getVal()+1.2 * gain.getVal() ) );
-  pdf.fitTo( *data,
-             RooFit::Range( ped.getVal()-3 * s0.getVal(),
-                            ped.getVal()+1.2 * gain.getVal() ) );
-  pdf.fitTo( *data,
-             RooFit::Range( ped.getVal()-3 * s0.getVal(),
-                            ped.getVal()+1.2 * gain.getVal() ) );
+  for( unsigned i = 0; i < 3; ++i ){
+    const double fitmin = ped.getVal()-3 * s0.getVal();
+    const double fitmax = ped.getVal()+1.2 * gain.getVal();
+    if( nthr == 1 ){
+      pdf.fitTo( *data, RooFit::Range( fitmin, fitmax ) );
+    } else {
+      SiPMBinnedNLL nll( "nll", "nll", pdf, x, *data, fitmin, fitmax, nthr );
+      ConvergeNLLMinimizer( nll, 1 );
+    }
+  }
 
   usr::plt::Ratio1DCanvas c( x );
 
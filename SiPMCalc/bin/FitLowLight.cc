@@ -1,3 +1,5 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightBootstrap.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
 #include "UserUtils/Common/interface/ArgumentExtender.hpp"
 #include "UserUtils/Common/interface/STLUtils/OStreamUtils.hpp"
@@ -20,6 +22,11 @@ main( int argc, char*argv[] )
     ( "commonpostfix,p",
     usr::po::defvalue<std::string>( "" ),
     "Output prefix for the all files" )
+    ( "quick",
+    "Only fit the Gaussian mixture model (no afterpulse or dark current) with "
+    "the EM algorithm instead of the full fit, the savefit plot is not "
+    "available in this mode, and the afterpulse and dark current results are "
+    "omitted from the savetxt and savelatex outputs" )
   ;
 
   usr::po::options_description savedesc(
@@ -49,6 +56,10 @@ main( int argc, char*argv[] )
     ( "saveestpoisson",
     usr::po::value<std::string>(),
     "Saving the poisson estimation plot" )
+    ( "savebootstrap",
+    usr::po::value<std::string>(),
+    "Saving the bootstrap intervals as a .txt file, printed to screen if not "
+    "set" )
   ;
 
   usr::ArgumentExtender args;
@@ -58,8 +69,11 @@ main( int argc, char*argv[] )
   args.AddOptions( SiPMLowLightFit::FitArguments() );
   args.AddOptions( SiPMLowLightFit::OperationArguments() );
   args.AddOptions( SiPMLowLightFit::EstArguments() );
+  args.AddOptions( SiPMLowLightBootstrap::BootstrapArguments() );
   args.AddVerboseOpt();
+  args.AddOptions( Profiler::Arguments() );
   args.ParseOptions( argc, argv );
+  Profiler::Setup( args );
 
   args.AddDirScheme( usr::ArgumentExtender::ArgPathScheme( "outputdir", "" ) );
   args.AddNameScheme( usr::ArgumentExtender::ArgPathScheme( "commonpostfix",
@@ -98,19 +112,29 @@ main( int argc, char*argv[] )
 
   const bool runfit = args.CheckArg( "savefit" ) ||
                       args.CheckArg( "savelatex" ) ||
-                      args.CheckArg( "savetxt" );
+                      args.CheckArg( "savetxt" ) ||
+                      args.CheckArg( "bootstrap" );
   if( !runfit ){
     usr::log::PrintLog( usr::log::DEBUG, "Early exit!" );
     return 0;
   }
 
   // Running the fit
-  usr::log::PrintLog( usr::log::DEBUG, "Running the PDF fitting routine" );
-  mgr->RunFit();
+  const bool quick = args.CheckArg( "quick" );
+  if( quick ){
+    usr::log::PrintLog( usr::log::DEBUG, "Running the Gaussian mixture fit" );
+    mgr->RunMixtureFit();
+  } else {
+    usr::log::PrintLog( usr::log::DEBUG, "Running the PDF fitting routine" );
+    mgr->RunFit();
+  }
 
   // Saving the requested outputs
   usr::log::PrintLog( usr::log::DEBUG, "Saving the fit result" );
-  if( args.CheckArg( "savefit" ) ){
+  if( args.CheckArg( "savefit" ) && quick ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        "The spectrum fit plot is not available with --quick" );
+  } else if( args.CheckArg( "savefit" ) ){
     mgr->PlotSpectrumFit(
       args.MakePDFFile( args.Arg<std::string>( "savefit" ) ) );
   }
@@ -124,6 +148,25 @@ main( int argc, char*argv[] )
     mgr->PrintRaw( raw );
   }
 
+
+  // Bootstrap uncertainties, from the nominal fit results
+  if( args.CheckArg( "bootstrap" ) && quick ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        "The bootstrap is not available with --quick" );
+  } else if( args.CheckArg( "bootstrap" ) ){
+    usr::log::PrintLog( usr::log::DEBUG, "Running the bootstrap replicas" );
+    SiPMLowLightBootstrap boot( *mgr );
+    boot.UpdateSettings( args );
+    boot.Run();
+    if( args.CheckArg( "savebootstrap" ) ){
+      std::ofstream table( args.MakeTXTFile(
+                             args.Arg<std::string>( "savebootstrap" ) ) );
+      boot.PrintTable( table );
+    } else {
+      boot.PrintTable( std::cout );
+    }
+  }
+
   delete mgr;
   return 0;
 }
@@ -0,0 +1,71 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightBatch.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
+#include "UserUtils/Common/interface/ArgumentExtender.hpp"
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <fstream>
+
+int
+main( int argc, char*argv[] )
+{
+  usr::po::options_description desc(
+    "Batch low light fits of all files listed in a manifest" );
+  desc.add_options()
+    ( "configfile,c",
+    usr::po::value<std::string>(),
+    "Configuration file for overloading default settings of all fits in json "
+    "format" )
+    ( "outputdir,o",
+    usr::po::defvalue<std::string>( "results/" ),
+    "Output directory of the various objects" )
+    ( "commonpostfix,p",
+    usr::po::defvalue<std::string>( "" ),
+    "Output prefix for the all files" )
+    ( "savetxt",
+    usr::po::value<std::string>(),
+    "Saving the results table as a .txt file, printed to screen if not set" )
+  ;
+
+  usr::ArgumentExtender args;
+  args.AddOptions( desc );
+  args.AddOptions( SiPMLowLightBatch::BatchArguments() );
+  args.AddOptions( SiPMLowLightFit::DataArguments( false ) );
+  args.AddOptions( SiPMLowLightFit::FitArguments() );
+  args.AddOptions( SiPMLowLightFit::OperationArguments() );
+  args.AddOptions( SiPMLowLightFit::EstArguments() );
+  args.AddVerboseOpt();
+  args.AddOptions( Profiler::Arguments() );
+  args.ParseOptions( argc, argv );
+  Profiler::Setup( args );
+
+  args.AddDirScheme( usr::ArgumentExtender::ArgPathScheme( "outputdir", "" ) );
+  args.AddNameScheme( usr::ArgumentExtender::ArgPathScheme( "commonpostfix",
+                                                            "" ) );
+
+  usr::log::PrintLog( usr::log::DEBUG, "Parsing the manifest" );
+  SiPMLowLightBatch batch( args.Arg<std::string>( "manifest" ) );
+  if( args.CheckArg( "configfile" ) ){
+    batch.SetConfig( args.Arg<std::string>( "configfile" ) );
+  }
+  batch.UpdateSettings( args );
+
+  usr::log::PrintLog( usr::log::INFO,
+                      usr::fstr( "Running %u fits", batch.NTasks() ) );
+  batch.Run();
+
+  if( args.CheckArg( "savetxt" ) ){
+    std::ofstream table( args.MakeTXTFile( args.Arg<std::string>( "savetxt" ) ) );
+    batch.PrintTable( table );
+  } else {
+    batch.PrintTable( std::cout );
+  }
+
+  if( batch.NFailed() ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        usr::fstr( "%u of %u fits failed",
+                                   batch.NFailed(), batch.NTasks() ) );
+  }
+
+  return batch.NFailed() ? 1 : 0;
+}
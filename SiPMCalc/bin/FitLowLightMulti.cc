@@ -0,0 +1,111 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightMultiFit.hpp"
+#include "UserUtils/Common/interface/ArgumentExtender.hpp"
+#include "UserUtils/Common/interface/STLUtils/OStreamUtils.hpp"
+
+#include <fstream>
+
+int
+main( int argc, char*argv[] )
+{
+  usr::po::options_description desc(
+    "Simultaneous fit of low light spectra taken at multiple light intensities" );
+  desc.add_options()
+    ( "configfile,c",
+    usr::po::value<std::string>(),
+    "Configuration file for overloading default settings in json format. "
+    "Leave empty to load all-default fitting" )
+    ( "outputdir,o",
+    usr::po::defvalue<std::string>( "results/" ),
+    "Output directory of the various objects" )
+    ( "commonpostfix,p",
+    usr::po::defvalue<std::string>( "" ),
+    "Output prefix for the all files" )
+  ;
+
+  usr::po::options_description savedesc(
+    "Options for saving the results, leave blank to ignore save. The spectrum "
+    "fit plots are saved with the spectrum index appended to the file name. "
+    "If none of savefit, savelatex and savetxt are set, the fit will not be "
+    "run" );
+  savedesc.add_options()
+    ( "savefit",
+    usr::po::value<std::string>(),
+    "Saving the spectrum fit results" )
+    ( "savelatex",
+    usr::po::value<std::string>(),
+    "Saving the fit results of all spectra as a latex table" )
+    ( "savetxt",
+    usr::po::value<std::string>(),
+    "Saving the fit results of all spectra as a raw .txt file" )
+  ;
+
+  usr::ArgumentExtender args;
+  args.AddOptions( desc );
+  args.AddOptions( savedesc );
+  args.AddOptions( SiPMLowLightMultiFit::MultiArguments() );
+  args.AddOptions( SiPMLowLightFit::DataArguments( false ) );
+  args.AddOptions( SiPMLowLightFit::FitArguments() );
+  args.AddOptions( SiPMLowLightFit::OperationArguments() );
+  args.AddOptions( SiPMLowLightFit::EstArguments() );
+  args.AddVerboseOpt();
+  args.AddOptions( Profiler::Arguments() );
+  args.ParseOptions( argc, argv );
+  Profiler::Setup( args );
+
+  args.AddDirScheme( usr::ArgumentExtender::ArgPathScheme( "outputdir", "" ) );
+  args.AddNameScheme( usr::ArgumentExtender::ArgPathScheme( "commonpostfix",
+                                                            "" ) );
+
+  if( !args.CheckArg( "inputs" ) ){
+    usr::log::PrintLog( usr::log::FATAL, "No input files specified" );
+    return 1;
+  }
+
+  const auto inputs = args.ArgList<std::string>( "inputs" );
+
+  SiPMLowLightMultiFit*mgr = args.CheckArg( "configfile" ) ?
+                             new SiPMLowLightMultiFit( inputs,
+                                                       args.Arg<std::string>(
+                                                         "configfile" ) ) :
+                             new SiPMLowLightMultiFit( inputs );
+  mgr->UpdateSettings( args );
+
+  usr::log::PrintLog( usr::log::DEBUG, "Parsing the data files" );
+  mgr->MakeBinnedData();
+
+  usr::log::PrintLog( usr::log::DEBUG, "Running the PDF estimation" );
+  mgr->RunPDFEstimation();
+
+  const bool runfit = args.CheckArg( "savefit" ) ||
+                      args.CheckArg( "savelatex" ) ||
+                      args.CheckArg( "savetxt" );
+  if( !runfit ){
+    usr::log::PrintLog( usr::log::DEBUG, "Early exit!" );
+    return 0;
+  }
+
+  usr::log::PrintLog( usr::log::DEBUG, "Running the simultaneous fit" );
+  mgr->RunFit();
+
+  usr::log::PrintLog( usr::log::DEBUG, "Saving the fit result" );
+  if( args.CheckArg( "savefit" ) ){
+    for( unsigned i = 0; i < mgr->NSpectra(); ++i ){
+      mgr->Spectrum( i ).PlotSpectrumFit(
+        args.MakePDFFile( args.Arg<std::string>( "savefit" )
+                          +"_"+std::to_string( i ) ) );
+    }
+  }
+  if( args.CheckArg( "savelatex" ) ){
+    std::ofstream table( args.MakeTEXFile( args.Arg<std::string>(
+                                             "savelatex" ) ) );
+    mgr->PrintTable( table );
+  }
+  if( args.CheckArg( "savetxt" ) ){
+    std::ofstream raw( args.MakeTXTFile( args.Arg<std::string>( "savetxt" ) ) );
+    mgr->PrintRaw( raw );
+  }
+
+  delete mgr;
+  return 0;
+}
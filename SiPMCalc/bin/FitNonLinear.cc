@@ -65,6 +65,7 @@
  *
  */
 
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMNonLinearFit.hpp"
 #include "UserUtils/Common/interface/ArgumentExtender.hpp"
 
@@ -112,7 +113,9 @@ main( int argc, char*argv[] )
   args.AddOptions( SiPMNonLinearFit::FitArguments() );
   args.AddOptions( SiPMNonLinearFit::OutputArguments() );
   args.AddOptions( desc );
+  args.AddOptions( Profiler::Arguments() );
   args.ParseOptions( argc, argv );
+  Profiler::Setup( args );
 
   std::unique_ptr<SiPMNonLinearFit> fitter( new SiPMNonLinearFit() );
 
@@ -0,0 +1,145 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMToyMC.hpp"
+
+#include "UserUtils/Common/interface/ArgumentExtender.hpp"
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <map>
+
+int
+main( int argc, char*argv[] )
+{
+  usr::po::options_description desc(
+    "Options for generating toy SiPM readout spectra" );
+  desc.add_options()
+    ( "output", usr::po::reqvalue<std::string>(), "Output file" )
+    ( "model",
+    usr::po::defvalue<std::string>( "lowlight" ),
+    "Response model to sample: lowlight (SiPMPdf), dark (SiPMDarkPdf) or "
+    "crosstalk (CrossTalkPdf)" )
+    ( "format",
+    usr::po::defvalue<std::string>( "area" ),
+    "Output format: area (StdFormat file of areas, for the --waveform 0 input "
+    "of the fits), hist (text table of the bin edges and contents) or wave "
+    "(WaveFormat file)" )
+    ( "nevents", usr::po::defvalue<double>( 1e6 ), "Number of events" )
+    ( "seed", usr::po::defvalue<unsigned long>( 0 ), "Random seed" )
+    ( "nthreads",
+    usr::po::defvalue<unsigned>( 1 ),
+    "Number of threads used for the generation (0 for all cores)" )
+    ( "xmin", usr::po::value<double>(), "Histogram lower edge" )
+    ( "xmax", usr::po::value<double>(), "Histogram upper edge" )
+    ( "nbins", usr::po::defvalue<unsigned>( 1000 ), "Histogram bins" )
+    ( "samples",
+    usr::po::defvalue<unsigned>( SiPMToyMC::default_wave.nsamples ),
+    "Samples per waveform, the pulse starts after a fifth of the samples" )
+    ( "time",
+    usr::po::defvalue<double>( SiPMToyMC::default_wave.time ),
+    "Waveform sample interval [ns]" )
+    ( "adc",
+    usr::po::defvalue<double>( SiPMToyMC::default_wave.adc ),
+    "Waveform value of a single bit [mV]" )
+  ;
+
+  usr::po::options_description pardesc(
+    "Model parameters, leave blank for the default values" );
+  pardesc.add_options()
+    ( "ped", usr::po::value<double>(), "Pedestal (x0 of the crosstalk model)" )
+    ( "gain", usr::po::value<double>(), "Gain" )
+    ( "s0", usr::po::value<double>(), "Common noise" )
+    ( "s1", usr::po::value<double>(), "Pixel noise" )
+    ( "mean", usr::po::value<double>(), "Mean number of photons" )
+    ( "lambda", usr::po::value<double>(), "Crosstalk lambda" )
+    ( "alpha", usr::po::value<double>(), "Afterpulse probability" )
+    ( "beta", usr::po::value<double>(), "Afterpulse mean area" )
+    ( "dcfrac", usr::po::value<double>(), "Dark current fraction" )
+    ( "eps", usr::po::value<double>(), "Dark current epsilon" )
+    ( "prob", usr::po::value<double>(), "Crosstalk probability of the "
+      "crosstalk model" )
+  ;
+
+  usr::ArgumentExtender args;
+  args.AddOptions( desc );
+  args.AddOptions( pardesc );
+  args.AddOptions( Profiler::Arguments() );
+  args.ParseOptions( argc, argv );
+  Profiler::Setup( args );
+
+  const std::map<std::string, SiPMToyMC::Model> models = {
+    {"lowlight",  SiPMToyMC::kLowLight },
+    {"dark",      SiPMToyMC::kDark     },
+    {"crosstalk", SiPMToyMC::kCrossTalk}
+  };
+  const std::map<std::string, SiPMToyMC::Param> params = {
+    {"ped",    SiPMToyMC::kPed    },
+    {"gain",   SiPMToyMC::kGain   },
+    {"s0",     SiPMToyMC::kS0     },
+    {"s1",     SiPMToyMC::kS1     },
+    {"mean",   SiPMToyMC::kMean   },
+    {"lambda", SiPMToyMC::kLambda },
+    {"alpha",  SiPMToyMC::kAlpha  },
+    {"beta",   SiPMToyMC::kBeta   },
+    {"dcfrac", SiPMToyMC::kDCFrac },
+    {"eps",    SiPMToyMC::kEpsilon},
+    {"prob",   SiPMToyMC::kProb   }
+  };
+
+  const std::string model  = args.Arg<std::string>( "model" );
+  const std::string format = args.Arg<std::string>( "format" );
+  const std::string output = args.Arg<std::string>( "output" );
+  const uint64_t    n      = std::llround( args.Arg<double>( "nevents" ) );
+
+  if( !models.count( model ) ){
+    usr::log::PrintLog( usr::log::FATAL,
+                        usr::fstr( "Unknown model [%s]", model ) );
+  }
+
+  SiPMToyMC toy( models.at( model ),
+                 args.Arg<unsigned long>( "seed" ),
+                 args.Arg<unsigned>( "nthreads" ) );
+
+  for( const auto& p : params ){
+    if( args.CheckArg( p.first ) ){
+      toy.SetParam( p.second, args.Arg<double>( p.first ) );
+    }
+  }
+
+  const auto t0 = std::chrono::steady_clock::now();
+
+  if( format == "area" ){
+    toy.WriteArea( output, n );
+  } else if( format == "hist" ){
+    // Default range covering the pedestal and the bulk of the discharge peaks
+    const double ped  = toy.Value( SiPMToyMC::kPed );
+    const double gain = toy.Value( SiPMToyMC::kGain );
+    const double mean = toy.GetModel() == SiPMToyMC::kLowLight ?
+                        toy.Value( SiPMToyMC::kMean ) /
+                        ( 1-toy.Value( SiPMToyMC::kLambda ) ) :
+                        0;
+    const double xmin = args.ArgOpt<double>(
+      "xmin", ped-5 * toy.Value( SiPMToyMC::kS0 )-gain );
+    const double xmax = args.ArgOpt<double>(
+      "xmax", ped+gain * ( mean+6 * std::sqrt( mean )+5 ) );
+    toy.WriteHistogram( output, n, xmin, xmax, args.Arg<unsigned>( "nbins" ) );
+  } else if( format == "wave" ){
+    SiPMToyMC::WaveSettings s = SiPMToyMC::default_wave;
+    s.nsamples = args.Arg<unsigned>( "samples" );
+    s.start    = s.nsamples / 5;
+    s.time     = args.Arg<double>( "time" );
+    s.adc      = args.Arg<double>( "adc" );
+    toy.WriteWaveFormat( output, n, s );
+  } else {
+    usr::log::PrintLog( usr::log::FATAL,
+                        usr::fstr( "Unknown output format [%s]", format ) );
+  }
+
+  const double time = std::chrono::duration<double>(
+    std::chrono::steady_clock::now()-t0 ).count();
+  usr::log::PrintLog( usr::log::INFO,
+                      usr::fstr( "Generated %lu events in %.3lf s to [%s]",
+                                 (unsigned long)n, time, output ) );
+
+  return 0;
+}
@@ -1,3 +1,4 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/Common/interface/StdFormat.hpp"
 #include "SiPMCalib/SiPMCalc/interface/NonLinearModel.hpp"
 
@@ -32,7 +33,9 @@ main( int argc, char* argv[] )
   usr::ArgumentExtender args;
   args.AddVerboseOpt();
   args.AddOptions( desc );
+  args.AddOptions( Profiler::Arguments() );
   args.ParseOptions( argc, argv );
+  Profiler::Setup( args );
 
   const StdFormat           input( args.Arg<std::string>( "powerdata" ) );
   const std::vector<double> bias    = input.Bias();
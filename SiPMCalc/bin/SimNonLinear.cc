@@ -0,0 +1,185 @@
+/**
+ * @file SimNonLinear.cc
+ * @ingroup SiPMCalc
+ * @brief Generating a simulated zscan data file with the pixel level SiPM
+ * simulation, for validating the SiPM_FitNonLinear results against a known
+ * number of photons.
+ *
+ * @details The mean number of effective photons at each z position and LED
+ * bias follows the inverse square law (InvSq_Z) and the exponential bias model
+ * (BiasModel), normalized to the `refpoint` number of photons at the reference
+ * z and bias, matching the `--refpoint` option of SiPM_FitNonLinear. Each
+ * point is simulated with SiPMPixelSim, and the output is a StdFormat file
+ * with the mean readout and its uncertainty as the first two data columns
+ * (the inputs of SiPMNonLinearFit), followed by the true mean number of
+ * photons and the mean number of fired pixels.
+ *
+ * Example command call:
+ * ```bash
+ * SiPM_SimNonLinear \
+ *       --output zscan_sim.txt      \
+ *       --refpoint 5000 300 1000    \
+ *       --bias 1000 1100 1200 1300  \
+ *       --events 1000 --nthreads 0
+ * ```
+ */
+
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/InvSqCalc/interface/InvSqFunc.hpp"
+#include "SiPMCalib/SiPMCalc/interface/NonLinearModel.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMPixelSim.hpp"
+
+#include "UserUtils/Common/interface/ArgumentExtender.hpp"
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <chrono>
+#include <fstream>
+
+int
+main( int argc, char*argv[] )
+{
+  const SiPMPixelSim::Settings& def = SiPMPixelSim::default_settings;
+
+  usr::po::options_description desc(
+    "Options for generating the simulated zscan data" );
+  desc.add_options()
+    ( "output", usr::po::reqvalue<std::string>(), "Output zscan data file" )
+    ( "refpoint",
+    usr::po::multivalue<double>(),
+    "Reference point of the number of photons, expects 3 numbers: the mean "
+    "number of effective photons, the z coordinate [mm] and the LED bias [mV] "
+    "of the reference point. Defaults to 5000 300 1000" )
+    ( "bias",
+    usr::po::multivalue<double>(),
+    "LED bias values [mV] of the scan, defaults to 1000" )
+    ( "zrange",
+    usr::po::multivalue<double>(),
+    "z scan points: the first and last z coordinate [mm] and the number of "
+    "points. Defaults to 10 400 40" )
+    ( "invsq",
+    usr::po::multivalue<double>(),
+    "Inverse square law z offset and horizontal offset [mm]. Defaults to -5 "
+    "0.5" )
+    ( "biasexp",
+    usr::po::defvalue<double>( 0.002 ),
+    "Exponent of the LED bias luminosity model [1/mV]" )
+    ( "events", usr::po::defvalue<unsigned>( 1000 ), "Events per scan point" )
+    ( "seed", usr::po::defvalue<unsigned long>( 0 ), "Random seed" )
+    ( "nthreads",
+    usr::po::defvalue<unsigned>( 1 ),
+    "Number of threads used for the simulation (0 for all cores)" )
+  ;
+
+  usr::po::options_description simdesc( "SiPM and LED pulse settings" );
+  simdesc.add_options()
+    ( "npixels", usr::po::defvalue<unsigned>( def.npixels ), "Number of pixels" )
+    ( "gain", usr::po::defvalue<double>( def.gain ), "Readout per discharge" )
+    ( "ped", usr::po::defvalue<double>( def.ped ), "Readout pedestal" )
+    ( "noise", usr::po::defvalue<double>( def.noise ), "Readout noise" )
+    ( "ledrise", usr::po::defvalue<double>( def.ledrise ),
+    "LED pulse rise time [ns]" )
+    ( "leddecay", usr::po::defvalue<double>( def.leddecay ),
+    "LED pulse decay time [ns]" )
+    ( "recovery", usr::po::defvalue<double>( def.recovery ),
+    "Pixel recovery time [ns]" )
+    ( "crosstalk", usr::po::defvalue<double>( def.crosstalk ),
+    "Crosstalk probability" )
+    ( "afterpulse", usr::po::defvalue<double>( def.afterpulse ),
+    "Afterpulse probability" )
+    ( "aptime", usr::po::defvalue<double>( def.aptime ),
+    "Mean afterpulse delay [ns]" )
+    ( "window", usr::po::defvalue<double>( def.window ),
+    "Integration window [ns]" )
+  ;
+
+  usr::ArgumentExtender args;
+  args.AddOptions( desc );
+  args.AddOptions( simdesc );
+  args.AddOptions( Profiler::Arguments() );
+  args.ParseOptions( argc, argv );
+  Profiler::Setup( args );
+
+  // Multi-value options with their default values
+  auto list = [&args]( const std::string&         name,
+                       const std::vector<double>& fallback,
+                       const unsigned             min ){
+                std::vector<double> ans = args.CheckArg( name ) ?
+                                          args.ArgList<double>( name ) :
+                                          fallback;
+                if( ans.size() < min ){
+                  usr::log::PrintLog( usr::log::FATAL,
+                                      usr::fstr( "Option [%s] expects %u values",
+                                                 name, min ) );
+                }
+                return ans;
+              };
+
+  const auto     ref         = list( "refpoint", { 5000, 300, 1000 }, 3 );
+  const auto     bias        = list( "bias", { 1000 }, 1 );
+  const auto     zrange      = list( "zrange", { 10, 400, 40 }, 3 );
+  const auto     invsq       = list( "invsq", { -5, 0.5 }, 2 );
+  const double   biasexp[2]  = { args.Arg<double>( "biasexp" ), 0 };
+  const double   invsqpar[5] = { invsq[0], invsq[1], 1, 0, 1 };
+  const unsigned nz          = zrange[2];
+
+  SiPMPixelSim::Settings s;
+  s.npixels    = args.Arg<unsigned>( "npixels" );
+  s.gain       = args.Arg<double>( "gain" );
+  s.ped        = args.Arg<double>( "ped" );
+  s.noise      = args.Arg<double>( "noise" );
+  s.ledrise    = args.Arg<double>( "ledrise" );
+  s.leddecay   = args.Arg<double>( "leddecay" );
+  s.recovery   = args.Arg<double>( "recovery" );
+  s.crosstalk  = args.Arg<double>( "crosstalk" );
+  s.afterpulse = args.Arg<double>( "afterpulse" );
+  s.aptime     = args.Arg<double>( "aptime" );
+  s.window     = args.Arg<double>( "window" );
+
+  SiPMPixelSim sim( s,
+                    args.Arg<unsigned long>( "seed" ),
+                    args.Arg<unsigned>( "nthreads" ) );
+
+  // Relative luminosity of the inverse square law and the bias model
+  auto lumi = [&]( const double z, const double b ){
+                return InvSq_Z( &z, invsqpar ) * BiasModel( &b, biasexp );
+              };
+
+  const double        refscale = ref[0] / lumi( ref[1], ref[2] );
+  std::vector<double> zval;
+  std::vector<double> bval;
+  std::vector<double> photons;
+
+  for( const double b : bias ){
+    for( unsigned i = 0; i < nz; ++i ){
+      const double z = nz > 1 ?
+                       zrange[0]+( zrange[1]-zrange[0] ) * i / ( nz-1 ) :
+                       zrange[0];
+      zval.push_back( z );
+      bval.push_back( b );
+      photons.push_back( refscale * lumi( z, b ) );
+    }
+  }
+
+  const auto   t0     = std::chrono::steady_clock::now();
+  const auto   result = sim.Run( photons, args.Arg<unsigned>( "events" ) );
+  const double time   = std::chrono::duration<double>(
+    std::chrono::steady_clock::now()-t0 ).count();
+
+  std::ofstream fout( args.Arg<std::string>( "output" ) );
+
+  for( unsigned i = 0; i < result.size(); ++i ){
+    const auto& r = result[i];
+    fout << usr::fstr( "%u 0 100 100 %.1lf %.1lf 25 25 %.4lf %.4lf %.3lf %.3lf\n",
+                       i, zval[i], bval[i],
+                       r.readout, r.readout_unc, r.photons, r.fired );
+  }
+
+  usr::log::PrintLog( usr::log::INFO,
+                      usr::fstr( "Simulated %u points of %u events in %.3lf s "
+                                 "to [%s]",
+                                 (unsigned)result.size(),
+                                 args.Arg<unsigned>( "events" ),
+                                 time, args.Arg<std::string>( "output" ) ) );
+
+  return 0;
+}
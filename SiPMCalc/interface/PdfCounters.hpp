@@ -0,0 +1,91 @@
+#ifndef SIPMCALIB_SIPMCALC_PDFCOUNTERS_HPP
+#define SIPMCALIB_SIPMCALC_PDFCOUNTERS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief Process wide counters of the PDF evaluation work (evaluation calls,
+ * discharge peak terms summed, convolution table rebuilds and cache hits).
+ * @ingroup SiPMCalc
+ *
+ * @details The counters are only compiled in if the package is compiled with
+ * the SIPMCALIB_COUNTERS macro defined (the SIPMCALIB_COUNTERS CMake option).
+ * Otherwise the SIPMCALIB_COUNT statements in the hot paths expand to nothing,
+ * and the counters always read 0.
+ */
+namespace pdfcount
+{
+
+enum Counter
+{
+  kSiPMPdfEval,// SiPMPdf::evaluate calls
+  kSiPMPdfFFTEval,// ... of which served by the whole-spectrum FFT table
+  kSiPMPdfIntegral,// SiPMPdf::analyticalIntegral( code ) calls
+  kSiPMPdfIntegralHit,// ... of which served by the normalization cache
+  kSiPMPdfDirect,// Direct evaluations of the discharge peak sum
+  kSiPMPdfTerms,// Discharge peak terms summed in the direct evaluations
+  kSiPMDarkPdfEval,
+  kCrossTalkPdfEval,
+  kCrossTalkPdfTerms,
+  kMDistroLookup,// MDistro::Lookup calls
+  kMDistroLastHit,// ... served by the last table of the instance
+  kMDistroCacheHit,// ... served by the shared LRU cache
+  kMDistroCacheMiss,// ... requiring a new table
+  kMDistroFFTBuild,// MDistro::MakeFFTArray calls
+  kMDistroFFTSize,// Sum of the FFT sizes of MakeFFTArray
+  kMDistroFFTMaxSize,// Largest FFT size of MakeFFTArray
+  kMDistroSpectrumBuild,// M function spectra calculated (not cached)
+  kMDistroQuadBuild,// Quadrature tables calculated
+  kNCounter
+};
+
+typedef std::array<uint64_t, kNCounter> Snapshot;
+
+constexpr bool
+Enabled()
+{
+#ifdef SIPMCALIB_COUNTERS
+  return true;
+#else
+  return false;
+#endif
+}
+
+extern std::atomic<uint64_t> counters[kNCounter];
+
+inline void
+Add( const Counter c, const uint64_t n )
+{
+  counters[c].fetch_add( n, std::memory_order_relaxed );
+}
+
+
+inline void
+Max( const Counter c, const uint64_t n )
+{
+  uint64_t prev = counters[c].load( std::memory_order_relaxed );
+
+  while( prev < n
+         && !counters[c].compare_exchange_weak( prev, n,
+                                                std::memory_order_relaxed ) ){
+  }
+}
+
+
+Snapshot    Take();
+std::string Summary( const Snapshot& begin, const Snapshot& end );
+
+}
+
+#ifdef SIPMCALIB_COUNTERS
+#define SIPMCALIB_COUNT( C, N ) pdfcount::Add( pdfcount::C, N )
+#define SIPMCALIB_COUNT_MAX( C, N ) pdfcount::Max( pdfcount::C, N )
+#else
+#define SIPMCALIB_COUNT( C, N ) do {} while( 0 )
+#define SIPMCALIB_COUNT_MAX( C, N ) do {} while( 0 )
+#endif
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef SIPMCALIB_SIPMCALC_REALFFT_HPP
+#define SIPMCALIB_SIPMCALC_REALFFT_HPP
+
+#include <complex>
+#include <cstddef>
+#include <memory>
+
+class RealFFT
+{
+public:
+  explicit RealFFT( const size_t n );
+  ~RealFFT();
+
+  // Forward transform of n real values into the n/2+1 non-negative
+  // frequency terms: out[m] = sum_j in[j] exp( -2 pi i j m / n )
+  void Forward( const double* in, std::complex<double>* out ) const;
+
+  // Normalized inverse of Forward. The imaginary parts of out[0] (and of
+  // out[n/2] for even n) are ignored. The input array may be overwritten.
+  void Inverse( std::complex<double>* in, double* out ) const;
+
+  inline size_t
+  Size() const { return _n; }
+  inline size_t
+  NFreq() const { return _n / 2+1; }
+
+  static size_t      GoodSize( const size_t n );
+  static const char* BackendName();
+
+  struct Plan;
+
+private:
+  size_t                      _n;
+  std::shared_ptr<const Plan> _plan;
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef SIPMCALIB_SIPMCALC_SIPMBINNEDNLL_HPP
+#define SIPMCALIB_SIPMCALC_SIPMBINNEDNLL_HPP
+
+#include "SiPMCalib/Common/interface/ThreadPool.hpp"
+
+#include "RooAbsPdf.h"
+#include "RooAbsReal.h"
+#include "RooDataHist.h"
+#include "RooListProxy.h"
+#include "RooRealVar.h"
+#include "RooSetProxy.h"
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+class SiPMBinnedNLL : public RooAbsReal
+{
+public:
+  SiPMBinnedNLL( const char*,
+                 const char*,
+                 RooAbsPdf&         pdf,
+                 RooRealVar&        x,
+                 const RooDataHist& data,
+                 const unsigned     nthreads = 1 );
+  SiPMBinnedNLL( const char*,
+                 const char*,
+                 RooAbsPdf&         pdf,
+                 RooRealVar&        x,
+                 const RooDataHist& data,
+                 const double       xmin,
+                 const double       xmax,
+                 const unsigned     nthreads = 1 );
+  SiPMBinnedNLL( const SiPMBinnedNLL&, const char*name = 0 );
+  virtual ~SiPMBinnedNLL();
+
+  virtual TObject* clone( const char*name ) const;
+
+  inline unsigned
+  NThreads() const { return _pool->NThreads(); }
+  inline unsigned
+  NBins() const { return _xval.size(); }
+
+  // Minuit error level for a negative log likelihood
+  double
+  defaultErrorLevel() const override { return 0.5; }
+
+protected:
+  RooSetProxy params;
+
+  double evaluate() const;
+
+private:
+  // Construction arguments, kept for object cloning
+  RooAbsPdf*         _pdf;
+  RooRealVar*        _x;
+  const RooDataHist* _data;
+  double             _xmin;
+  double             _xmax;
+  std::string        _range;
+
+  // Flattened data in the fit range
+  std::vector<double> _xval;
+  std::vector<double> _weight;
+
+  /**
+   * @brief Per-thread evaluation context.
+   *
+   * Each thread owns a full clone of the PDF expression tree, so that the
+   * observable (and the RooFit value caches of any intermediate nodes) are
+   * never shared between threads.
+   */
+  struct ThreadContext
+  {
+    std::unique_ptr<RooAbsPdf>                      pdf;
+    RooRealVar*                                     x;
+    std::vector<std::pair<RooRealVar*, RooRealVar*> > sync;
+  };
+
+  // Normalization integral over the fit range, evaluated with a dedicated PDF
+  // clone, so the fit range is defined on the cloned observable rather than on
+  // the observable of the caller.
+  mutable ThreadContext       _normcontext;
+  std::unique_ptr<RooAbsReal> _norm;
+
+  std::unique_ptr<ThreadPool>  _pool;
+  mutable std::vector<ThreadContext> _context;
+  mutable std::vector<double>        _binnll;// Scratch for per-bin results
+
+  void init( const unsigned nthreads );
+  void init_context( ThreadContext& ) const;
+};
+
+class SiPMSimultaneousNLL : public RooAbsReal
+{
+public:
+  SiPMSimultaneousNLL( const char*,
+                       const char*,
+                       const RooArgList& nlls,
+                       const unsigned    nthreads = 1 );
+  SiPMSimultaneousNLL( const SiPMSimultaneousNLL&, const char*name = 0 );
+  virtual ~SiPMSimultaneousNLL();
+
+  virtual TObject* clone( const char*name ) const;
+
+  inline unsigned
+  NThreads() const { return _pool->NThreads(); }
+  inline unsigned
+  NComponents() const { return _nlls.getSize(); }
+
+  double
+  defaultErrorLevel() const override { return 0.5; }
+
+protected:
+  RooListProxy _nlls;
+
+  double evaluate() const;
+
+private:
+  std::unique_ptr<ThreadPool> _pool;
+  mutable std::vector<double> _compnll;// Scratch for per-component results
+};
+
+extern int ConvergeNLLMinimizer( RooAbsReal& nll, const unsigned maxiter = 3 );
+
+#endif
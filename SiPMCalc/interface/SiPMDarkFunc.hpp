@@ -1,15 +1,107 @@
 #ifndef SIPMCALIB_SIPMCALC_SIPMDARKFUNC_HPP
 #define SIPMCALIB_SIPMCALC_SIPMDARKFUNC_HPP
 
-#include "Math/Interpolator.h"
+#include "SiPMCalib/SiPMCalc/interface/UniformSpline.hpp"
+
+#include <complex>
 #include <cstdint>
+#include <list>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 class MDistro
 {
 public:
+  // Evaluation method of the smeared M function: FFT convolution on a grid, or
+  // direct Gauss-Legendre quadrature of the convolution integral.
+  enum Mode
+  {
+    kFFT,
+    kQuadrature
+  };
+
+  // Convolution results for a single parameter point, never modified after
+  // creation.
+  struct Table
+  {
+    double        loEdge;
+    double        hiEdge;
+    double        epsilon;
+    double        width;
+    uint64_t      hash;
+    Mode          mode;
+    UniformSpline spline;
+    UniformSpline spline_acc;
+
+    // Quadrature nodes (sorted) and weights, with the cumulative sum of the
+    // weights of all preceding nodes. Only used by the kQuadrature mode.
+    std::vector<double> node;
+    std::vector<double> weight;
+    std::vector<double> accweight;
+
+    double Evaluate( const double x ) const;
+    double EvaluateAccum( const double x ) const;
+  };
+
+  // Real FFT of the n samples of the M function. This only depends on the
+  // edges and epsilon, not on the smearing width.
+  struct Spectrum
+  {
+    double                             xmin;
+    double                             step;
+    unsigned                           n;
+    std::vector<std::complex<double> > data;
+  };
+
+  // Bounded LRU cache of convolution results and M function spectra, can be
+  // shared between MDistro instances.
+  class Cache
+  {
+  public:
+    explicit Cache( const unsigned capacity = default_capacity );
+
+    std::shared_ptr<const Table> Find( const uint64_t hash );
+    void                         Insert( const uint64_t                      hash,
+                                         const std::shared_ptr<const Table>& table );
+    std::shared_ptr<const Spectrum> FindSpectrum( const uint64_t hash );
+    void                            InsertSpectrum(
+      const uint64_t                         hash,
+      const std::shared_ptr<const Spectrum>& spec );
+
+    void     SetCapacity( const unsigned );
+    unsigned Capacity() const;
+    unsigned Size() const;
+    uint64_t Hits() const;
+    uint64_t Misses() const;
+    void     Clear();
+
+    static unsigned default_capacity;
+
+  private:
+    struct Entry
+    {
+      uint64_t                     hash;
+      std::shared_ptr<const Table> table;
+    };
+
+    struct SpectrumEntry
+    {
+      uint64_t                        hash;
+      std::shared_ptr<const Spectrum> spec;
+    };
+
+    mutable std::mutex       mtx;
+    std::list<Entry>         entries;// Most recently used first
+    std::list<SpectrumEntry> spectra;
+    unsigned                 capacity;
+    uint64_t                 hits;
+    uint64_t                 misses;
+  };
+
   MDistro();
+  explicit MDistro( const std::shared_ptr<Cache>& cache,
+                    const Mode                    mode = kFFT );
   MDistro( const double loEdge,
            const double hiEdge,
            const double epsilon,
@@ -20,6 +112,12 @@ public:
   double Evaluate( const double x ) const;
   void   SetParam( const double, const double, const double, const double );
 
+  std::shared_ptr<const Table> Lookup( const double loEdge,
+                                       const double hiEdge,
+                                       const double epsilon,
+                                       const double width ) const;
+  std::shared_ptr<const Table> GetTable() const;
+
   // Getting fitting parameters
   double xMin() const;
   double xMax() const;
@@ -27,28 +125,37 @@ public:
 
   double MFuncEval( const double x ) const;
 
+  inline const std::shared_ptr<Cache>&
+  GetCache() const { return cache; }
+  inline void
+  SetCache( const std::shared_ptr<Cache>& x ){ cache = x; }
+
+  // Not to be changed while the instance is being evaluated.
+  inline Mode
+  GetMode() const { return mode; }
+  inline void
+  SetMode( const Mode x ){ mode = x; }
+
+  // Quadrature settings: number of Gauss-Legendre nodes per panel (2 to 16)
+  // and panel length in units of the smearing width.
+  static unsigned quad_order;
+  static double   quad_panel;
+
   double loEdge;
   double hiEdge;
   double epsilon;
   double width;
 
 private:
-  unsigned                 nbins;
-  ROOT::Math::Interpolator spline;
-  ROOT::Math::Interpolator spline_acc;
-
-  std::vector<double> xArray;
-  std::vector<double> convArray;
-  std::vector<double> accArray;
-
-  // Delaring here, as we are going to reserve for faster allocation
-  std::vector<double> convTempArray;
-  std::vector<double> mfuncArray;
-  std::vector<double> gaussArray;
-  uint64_t            paramHash;
-
-  void ParamHash();
-  void MakeFFTArray();
+  // Table of the most recent lookup, only accessed through std::atomic_load
+  // and std::atomic_store.
+  mutable std::shared_ptr<const Table> table;
+  std::shared_ptr<Cache>               cache;
+  Mode                                 mode;
+
+  void                            MakeFFTArray( Table& ) const;
+  void                            MakeQuadrature( Table& ) const;
+  std::shared_ptr<const Spectrum> MakeSpectrum( const Table& ) const;
 };
 
 #endif
@@ -34,7 +34,7 @@ protected:
   RooRealProxy dcfrac;
   RooRealProxy epsilon;
 
-  mutable MDistro mdistro;// Since evaluation is a const function
+  MDistro mdistro;
 
   double evaluate() const;
 };
@@ -0,0 +1,73 @@
+#ifndef SIPMCALIB_SIPMCALC_SIPMGAUSSMIXFIT_HPP
+#define SIPMCALIB_SIPMCALC_SIPMGAUSSMIXFIT_HPP
+
+#include "SiPMCalib/Common/interface/ThreadPool.hpp"
+
+#include <array>
+#include <vector>
+
+class SiPMGaussMixFit
+{
+public:
+  enum Param
+  {
+    kPed,
+    kGain,
+    kS0,
+    kS1,
+    kMean,
+    kLambda,
+    kNParam
+  };
+
+  SiPMGaussMixFit( const std::vector<double>& counts,
+                   const double               xmin,
+                   const double               binwidth,
+                   const unsigned             nthreads = 1 );
+
+  void SetParam( const Param, const double val, const bool fixed = false );
+  bool Run();
+
+  inline double
+  Value( const Param i ) const { return _par[i]; }
+  inline double
+  Error( const Param i ) const { return _err[i]; }
+  inline unsigned
+  NIter() const { return _niter; }
+  inline double
+  LogLikelihood() const { return _logl; }
+
+  // Maximum number of EM iterations, and the relative change of the log
+  // likelihood between iterations for convergence.
+  unsigned maxiter;
+  double   tolerance;
+
+private:
+  // Photo-electron peaks of a parameter point.
+  struct Peaks
+  {
+    std::vector<double> mu;
+    std::vector<double> var;
+    std::vector<double> norm;// Weight times the bin width over sqrt(2 pi var)
+  };
+
+  std::vector<double> _counts;
+  double              _xmin;
+  double              _bw;
+  ThreadPool          _pool;
+
+  std::array<double, kNParam> _par;
+  std::array<double, kNParam> _err;
+  std::array<bool, kNParam>   _fixed;
+  unsigned                    _niter;
+  double                      _logl;
+
+  Peaks  make_peaks( const std::array<double, kNParam>& ) const;
+  double run_estep( const Peaks&, std::vector<double>* stats );
+  void   mstep_position( const std::vector<double>& stats, const Peaks& );
+  void   mstep_width( const std::vector<double>& stats, const Peaks& );
+  void   mstep_weight( const std::vector<double>& stats );
+  void   compute_errors();
+};
+
+#endif
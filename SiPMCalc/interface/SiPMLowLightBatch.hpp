@@ -0,0 +1,55 @@
+#ifndef SIPMCALIB_SIPMCALC_SIPMLOWLIGHTBATCH_HPP
+#define SIPMCALIB_SIPMCALC_SIPMLOWLIGHTBATCH_HPP
+
+#include "UserUtils/Common/interface/ArgumentExtender.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Running independent low light fits of many input files concurrently
+ * from a single batch process.
+ */
+class SiPMLowLightBatch
+{
+public:
+  SiPMLowLightBatch( const std::string& manifest );
+
+  static usr::po::options_description BatchArguments();
+
+  void SetConfig( const std::string& config );
+  void UpdateSettings( const usr::ArgumentExtender& );
+
+  void Run();
+  void PrintTable( std::ostream& sout = std::cout ) const;
+
+  inline unsigned
+  NTasks() const { return _tasks.size(); }
+  unsigned NFailed() const;
+
+  // Names of the fit parameters in the output table
+  static const std::vector<std::string> parameter_names;
+
+private:
+  struct Task
+  {
+    std::string                             input;
+    std::unique_ptr<usr::ArgumentExtender>  args;// Per-file overrides
+    bool                                    success;
+    std::string                             error;
+    double                                  time;
+    std::vector<std::pair<double, double> > result;// Value and error
+  };
+
+  std::vector<Task>                      _tasks;
+  std::unique_ptr<usr::ArgumentExtender> _config;
+  const usr::ArgumentExtender*           _common;
+  unsigned                               _njobs;
+
+  std::string run_task( const Task& ) const;
+  static void read_result( Task&, const bool, const std::string& );
+};
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef SIPMCALIB_SIPMCALC_SIPMLOWLIGHTBOOTSTRAP_HPP
+#define SIPMCALIB_SIPMCALC_SIPMLOWLIGHTBOOTSTRAP_HPP
+
+#include "UserUtils/Common/interface/ArgumentExtender.hpp"
+
+#include <iostream>
+#include <string>
+#include <vector>
+
+class SiPMLowLightFit;
+
+/**
+ * @brief Bootstrap uncertainties of the parameters and derived observables of
+ * a low light fit.
+ */
+class SiPMLowLightBootstrap
+{
+public:
+  SiPMLowLightBootstrap( const SiPMLowLightFit& nominal );
+
+  static usr::po::options_description BootstrapArguments();
+
+  void UpdateSettings( const usr::ArgumentExtender& );
+
+  void Run();
+  void PrintTable( std::ostream& sout = std::cout ) const;
+
+  inline unsigned
+  NReplicas() const { return _replicas.size(); }
+  unsigned NFailed() const;
+
+  double Percentile( const unsigned obs, const double q ) const;
+
+  // Names of the observables, fit parameters followed by derived quantities.
+  static const std::vector<std::string> observable_names;
+
+private:
+  const SiPMLowLightFit& _nominal;
+  std::vector<double>    _nominal_obs;
+
+  // Observables of each replica, empty if the replica fit failed.
+  std::vector<std::vector<double> > _replicas;
+
+  unsigned _nreplica;
+  unsigned _njobs;
+  unsigned _seed;
+  double   _cl;
+
+  static std::vector<double> observables( const SiPMLowLightFit& );
+  std::string                run_replica( const size_t index ) const;
+};
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef SIPMCALIB_SIPMCALC_SIPMLOWLIGHTFIT_HPP
 #define SIPMCALIB_SIPMCALC_SIPMLOWLIGHTFIT_HPP
 
+#include "SiPMCalib/SiPMCalc/interface/SiPMParamStore.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMPdf.hpp"
 #include "UserUtils/Common/interface/ArgumentExtender.hpp"
 #include "UserUtils/MathUtils/interface/Measurement/Measurement.hpp"
@@ -26,7 +27,7 @@ public:
   SiPMLowLightFit( const std::string& config );
 
   // Update settings
-  static usr::po::options_description DataArguments();
+  static usr::po::options_description DataArguments( const bool reqinput = true );
   static usr::po::options_description FitArguments();
   static usr::po::options_description OperationArguments();
   static usr::po::options_description OutputArguments();
@@ -41,8 +42,12 @@ public:
   void MakeBinnedData();
   void RunPDFEstimation();
   void RunFit();
+  bool RunMixtureFit();
   /** @} */
 
+  // Whether all floating parameters have finite values and uncertainties.
+  bool Converged() const;
+
   /**
    * @{
    * @brief Plotting results for the SiPM analysis
@@ -126,19 +131,28 @@ public:
   /** @} */
 
 private:
+  // The simultaneous fit of multiple spectra shares the detector parameters
+  // between the instances.
+  friend class SiPMLowLightMultiFit;
+
+  // Bootstrap replicas are created from the nominal instance.
+  friend class SiPMLowLightBootstrap;
+  SiPMLowLightFit( const SiPMLowLightFit& nominal,
+                   const std::vector<double>& arealist );
+
   // Since RooFit object declaration after additional parsing to get the
-  // requested range, RooFit objects must use pointer interfaces. Using
-  // unique_ptr to handle memory management
-  std::unique_ptr<RooRealVar> _ped;
-  std::unique_ptr<RooRealVar> _gain;
-  std::unique_ptr<RooRealVar> _s0;
-  std::unique_ptr<RooRealVar> _s1;
+  // requested range, RooFit objects must use pointer interfaces. The detector
+  // parameters use shared_ptr so that they can be shared between instances.
+  std::shared_ptr<RooRealVar> _ped;
+  std::shared_ptr<RooRealVar> _gain;
+  std::shared_ptr<RooRealVar> _s0;
+  std::shared_ptr<RooRealVar> _s1;
   std::unique_ptr<RooRealVar> _mean;
-  std::unique_ptr<RooRealVar> _lambda;
-  std::unique_ptr<RooRealVar> _alpha;
-  std::unique_ptr<RooRealVar> _beta;
-  std::unique_ptr<RooRealVar> _dcfrac;
-  std::unique_ptr<RooRealVar> _eps;
+  std::shared_ptr<RooRealVar> _lambda;
+  std::shared_ptr<RooRealVar> _alpha;
+  std::shared_ptr<RooRealVar> _beta;
+  std::shared_ptr<RooRealVar> _dcfrac;
+  std::shared_ptr<RooRealVar> _eps;
   std::unique_ptr<SiPMPdf>    _pdf;
 
   // The data format to be used by the used by the fit
@@ -149,10 +163,13 @@ private:
 
   // Default setting options
   void set_all_defaults();
+  void make_pdf();
+  void share_parameters( const SiPMLowLightFit& );
 
   // data parsing settings
   void make_array_from_waveform();
   void make_array_from_sum();
+  void fill_data();
 
   /**
    * @{
@@ -173,7 +190,14 @@ private:
   bool                               ignore_s1_est;
   bool                               ignore_mean_est;
   bool                               ignore_lambda_est;
+  bool                               ignore_alpha_est;
+  bool                               ignore_beta_est;
+  bool                               ignore_dcfrac_est;
+  bool                               ignore_eps_est;
   double                             _est_minpeak;
+  std::string                        _est_method;
+  bool                               _est_success;
+  bool                               _est_em;
   int                                _est_gausswindow;
   int                                _est_maxgausswidth;
 
@@ -187,6 +211,20 @@ private:
   void run_gain_est();
   void run_width_est();
   void run_height_est();
+  std::vector<double> binned_counts() const;
+  void run_tspectrum_est();
+  bool run_moment_est();
+  /** @} */
+
+  /**
+   * @{
+   * @brief Warm start from the results of previous fits of similar operating
+   * conditions.
+   */
+  std::shared_ptr<SiPMParamStore> _store;
+  SiPMParamStore::Key             _storekey;
+  bool run_warm_start();
+  void save_to_store();
   /** @} */
 
   // Options for reading data formats.
@@ -201,6 +239,11 @@ private:
   double      _pedrms;
   double      _maxarea;
 
+  // Fit running options
+  unsigned _nthreads;
+  bool     _isolated;// Bootstrap replica, see the replica constructor
+  bool     _mixtureonly;// Last fit was the Gaussian mixture fit
+
   // operation parameters
   double      _intwindow;
   double      _sipmtime;
@@ -0,0 +1,54 @@
+#ifndef SIPMCALIB_SIPMCALC_SIPMLOWLIGHTMULTIFIT_HPP
+#define SIPMCALIB_SIPMCALC_SIPMLOWLIGHTMULTIFIT_HPP
+
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
+#include "UserUtils/Common/interface/ArgumentExtender.hpp"
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Simultaneous fit of several low light spectra of the same SiPM,
+ * sharing the detector parameters.
+ */
+class SiPMLowLightMultiFit
+{
+public:
+  SiPMLowLightMultiFit( const std::vector<std::string>& inputs );
+  SiPMLowLightMultiFit( const std::vector<std::string>& inputs,
+                        const std::string&              config );
+
+  static usr::po::options_description MultiArguments();
+
+  void UpdateSettings( const usr::ArgumentExtender& );
+
+  /**
+   * @{
+   * @brief main control flow functions.
+   */
+  void MakeBinnedData();
+  void RunPDFEstimation();
+  void RunFit();
+  /** @} */
+
+  void PrintRaw( std::ostream& sout   = std::cout ) const;
+  void PrintTable( std::ostream& sout = std::cout ) const;
+
+  inline unsigned
+  NSpectra() const { return _fits.size(); }
+  inline SiPMLowLightFit&
+  Spectrum( const unsigned i ){ return *_fits.at( i ); }
+  inline const SiPMLowLightFit&
+  Spectrum( const unsigned i ) const { return *_fits.at( i ); }
+
+private:
+  std::vector<std::string>                       _inputs;
+  std::vector<std::unique_ptr<SiPMLowLightFit> > _fits;
+  unsigned                                       _nthreads;
+
+  void share_parameters();
+};
+
+#endif
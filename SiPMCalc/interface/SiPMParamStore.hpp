@@ -0,0 +1,60 @@
+#ifndef SIPMCALIB_SIPMCALC_SIPMPARAMSTORE_HPP
+#define SIPMCALIB_SIPMCALC_SIPMPARAMSTORE_HPP
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class SiPMParamStore
+{
+public:
+  // Operating condition of a fit result. A NaN bias or temperature is treated
+  // as unknown.
+  struct Key
+  {
+    std::string detid;
+    double      bias;
+    double      temp;
+  };
+
+  // Fit parameter values, in the order of parameter_names.
+  struct Entry
+  {
+    Key                 key;
+    std::vector<double> values;
+  };
+
+  static std::shared_ptr<SiPMParamStore> Open( const std::string& file );
+
+  bool     Find( const Key&, Entry& ) const;
+  void     Insert( const Entry& );
+  void     Save();
+  unsigned Size() const;
+
+  inline const std::string&
+  File() const { return _file; }
+
+  static double Distance( const Key&, const Key& );
+
+  static const std::vector<std::string> parameter_names;
+
+  // Distance settings: bias and temperature differences are in units of the
+  // scales, a different detector id adds the penalty, and entries further than
+  // max_distance are not used.
+  static double bias_scale;
+  static double temp_scale;
+  static double detid_penalty;
+  static double max_distance;
+
+private:
+  explicit SiPMParamStore( const std::string& file );
+
+  std::string        _file;
+  mutable std::mutex _mutex;
+  std::vector<Entry> _entries;// Oldest first
+
+  static std::vector<Entry> read_file( const std::string& );
+};
+
+#endif
@@ -2,11 +2,18 @@
 #define SIPMCALIB_SIPMCALC_SIPMPDF_HPP
 
 #include "SiPMCalib/SiPMCalc/interface/SiPMDarkFunc.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMSpectrumFFT.hpp"
 
 #include "RooAbsPdf.h"
 #include "RooRealProxy.h"
 #include "RooTrace.h"
 
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
 #include <vector>
 
 class SiPMPdf : public RooAbsPdf
@@ -68,10 +75,32 @@ public:
   const override;
 
   double analyticalIntegral( double x ) const;
+  void   EdgeCDF( const std::vector<double>& edges,
+                  std::vector<double>&       cdf ) const;
   double erf_ap_eff( const double x, const int k, const int i ) const;
   double erf_k( const double x, const int k ) const;
 
-  inline MDistro& darkdistro(){ return mdistro; }
+  MDistro& darkdistro();
+
+  // Choice of evaluation backend. kAuto uses the FFT whole-spectrum evaluation
+  // if the observable has at least fft_minbins bins.
+  enum EvalMode
+  {
+    kDirect,
+    kFFT,
+    kAuto
+  };
+  inline void
+  SetEvalMode( const EvalMode x ){ _evalmode = x; }
+  inline EvalMode
+  GetEvalMode() const { return _evalmode; }
+  static unsigned fft_minbins;
+
+  // Evaluation method of the dark current shape, see MDistro.
+  inline void
+  SetDarkMode( const MDistro::Mode x ){ mdistro.SetMode( x ); }
+  inline MDistro::Mode
+  GetDarkMode() const { return mdistro.GetMode(); }
 
   // Bunch of statistical functions used for the analysis
   // Moving to a static method for individual testing
@@ -92,11 +121,42 @@ protected:
   RooRealProxy dcfraction;
   RooRealProxy epsilon;
 
-  mutable MDistro mdistro;
+  // The parameter dependent tables are held in immutable objects (see the
+  // MDistro and SiPMSpectrumFFT classes), so that the const evaluation methods
+  // can be called concurrently.
+  MDistro         mdistro;// Convolution cache is shared between clones
+  SiPMSpectrumFFT fftspec;
+  EvalMode        _evalmode;
 
   double evaluate() const;
 
+  double dark_mix( const double gauss0 ) const;
+  double dark_mix_cdf( const double x, const double cdf0 ) const;
+  std::shared_ptr<const MDistro::Table> dark_table() const;
+
 private:
+  // Scratch arrays for the batched evaluation over the discharge peaks, one
+  // per thread.
+  struct Workspace;
+
+  // Normalization integrals per range name, with the parameter hash
+  mutable std::map<std::string, std::pair<uint64_t, double> > _intcache;
+  mutable std::mutex                                           _intmutex;
+
+  Workspace& fill_peaks() const;
+  void       fill_poisson( Workspace&, const unsigned n ) const;
+
+  std::shared_ptr<const SiPMSpectrumFFT::Table> fft_table() const;
+
+  // Model variants with the afterpulse (AP) and dark current (DC) terms
+  // compiled out, selected from the current parameter values.
+  double evaluate_direct() const;
+  double integral_direct( const double x ) const;
+  template<bool AP, bool DC>
+  double evaluate_variant() const;
+  template<bool AP, bool DC>
+  double integral_variant( const double x ) const;
+
 //  ClassDef(SiPMPdf,1);
 };
 
@@ -0,0 +1,68 @@
+#ifndef SIPMCALIB_SIPMCALC_SIPMPIXELSIM_HPP
+#define SIPMCALIB_SIPMCALC_SIPMPIXELSIM_HPP
+
+#include "SiPMCalib/Common/interface/ThreadPool.hpp"
+
+#include <cstdint>
+#include <vector>
+
+class SiPMPixelSim
+{
+public:
+  // Device and light source settings, times are in ns.
+  struct Settings
+  {
+    unsigned npixels;// Pixels on a square grid, row by row
+    double   gain;// Readout of a fully charged discharge
+    double   ped;// Readout pedestal
+    double   noise;// Gaussian readout noise
+    double   ledrise;// LED pulse rise and decay time constants
+    double   leddecay;
+    double   recovery;// Pixel recharge time constant
+    double   crosstalk;// Crosstalk probability per full discharge
+    double   afterpulse;// Afterpulse probability per full discharge
+    double   aptime;// Mean afterpulse delay
+    double   window;// Integration window from the start of the LED pulse
+  };
+
+  // Readout summary of the events of a single light intensity.
+  struct Result
+  {
+    double photons;
+    double readout;// Mean readout
+    double readout_unc;// Uncertainty of the mean readout
+    double fired;// Mean number of distinct pixels fired
+  };
+
+  SiPMPixelSim( const Settings& settings,
+                const uint64_t  seed     = 0,
+                const unsigned  nthreads = 1 );
+
+  inline const Settings&
+  GetSettings() const { return _settings; }
+
+  double              Event( const double photons, const uint64_t index,
+                             unsigned* fired = nullptr ) const;
+  std::vector<Result> Run( const std::vector<double>& photons,
+                           const unsigned             nevents );
+
+  static const Settings default_settings;
+
+  // Number of events per parallel task.
+  static unsigned batch_size;
+
+private:
+  struct Workspace;
+
+  Settings   _settings;
+  uint64_t   _seed;
+  ThreadPool _pool;
+  unsigned   _width;// Pixel grid width
+
+  // Inverse cumulative distribution of the LED pulse on a uniform grid.
+  std::vector<double> _pulse_inv;
+
+  void make_pulse_table();
+};
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SIPMCALIB_SIPMCALC_SIPMSPECTRUMFFT_HPP
+#define SIPMCALIB_SIPMCALC_SIPMSPECTRUMFFT_HPP
+
+#include "SiPMCalib/SiPMCalc/interface/UniformSpline.hpp"
+
+#include <array>
+#include <complex>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+class SiPMSpectrumFFT
+{
+public:
+  // Spectrum for a single parameter point, never modified after creation.
+  struct Table
+  {
+    double   xmin;
+    double   xmax;
+    double   ped;
+    double   gain;
+    double   s0;
+    double   s1;
+    double   mean;
+    double   lambda;
+    double   alpha;
+    double   beta;
+    double   dcfrac;
+    uint64_t hash;
+
+    UniformSpline spline;
+    UniformSpline spline_acc;
+
+    std::vector<double>                  poisson;
+    std::vector<std::array<double, 4> > binom;// Afterpulse probabilities i<=3
+
+    double Evaluate( const double x ) const;
+    double EvaluateAccum( const double x ) const;
+
+    inline bool
+    InRange( const double x ) const
+    { return spline.Size() && spline.XMin() <= x && x <= spline.XMax(); }
+    inline unsigned
+    NGrid() const { return spline.Size(); }
+  };
+
+  SiPMSpectrumFFT();
+  ~SiPMSpectrumFFT();
+
+  std::shared_ptr<const Table> Lookup( const double xmin,
+                                       const double xmax,
+                                       const double ped,
+                                       const double gain,
+                                       const double s0,
+                                       const double s1,
+                                       const double mean,
+                                       const double lambda,
+                                       const double alpha,
+                                       const double beta,
+                                       const double dcfrac ) const;
+
+  void SetParam( const double xmin,
+                 const double xmax,
+                 const double ped,
+                 const double gain,
+                 const double s0,
+                 const double s1,
+                 const double mean,
+                 const double lambda,
+                 const double alpha,
+                 const double beta,
+                 const double dcfrac );
+
+  double   Evaluate( const double x ) const;
+  double   EvaluateAccum( const double x ) const;
+  bool     InRange( const double x ) const;
+  unsigned NGrid() const;
+
+  // Grid resolution in units of the pedestal width.
+  static unsigned samples_per_width;
+
+private:
+  // Table of the most recent lookup, only accessed through std::atomic_load
+  // and std::atomic_store.
+  mutable std::shared_ptr<const Table> table;
+};
+
+#endif
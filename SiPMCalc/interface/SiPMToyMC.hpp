@@ -0,0 +1,109 @@
+#ifndef SIPMCALIB_SIPMCALC_SIPMTOYMC_HPP
+#define SIPMCALIB_SIPMCALC_SIPMTOYMC_HPP
+
+#include "SiPMCalib/Common/interface/ThreadPool.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class SiPMToyMC
+{
+public:
+  // Response model to sample from: the SiPMPdf, SiPMDarkPdf or CrossTalkPdf.
+  enum Model
+  {
+    kLowLight,
+    kDark,
+    kCrossTalk
+  };
+
+  // Parameters of the models, in the naming of the SiPMPdf class. The
+  // CrossTalkPdf uses kPed as the x0 parameter and kProb as the crosstalk
+  // probability.
+  enum Param
+  {
+    kPed,
+    kGain,
+    kS0,
+    kS1,
+    kMean,
+    kLambda,
+    kAlpha,
+    kBeta,
+    kDCFrac,
+    kEpsilon,
+    kProb,
+    kNParam
+  };
+
+  // Conversion of the areas to waveforms: pulse starting at sample `start`,
+  // with the rise and decay time constants [ns], stored as 16-bit samples
+  // (4 hex digits) of `adc` mV below the baseline.
+  struct WaveSettings
+  {
+    unsigned nsamples;
+    unsigned start;
+    double   time;// [ns]
+    double   adc;// [mV]
+    double   rise;
+    double   decay;
+    unsigned baseline;
+  };
+
+  SiPMToyMC( const Model    model,
+             const uint64_t seed     = 0,
+             const unsigned nthreads = 1 );
+
+  void SetParam( const Param, const double val );
+
+  inline double
+  Value( const Param i ) const { return _par[i]; }
+  inline Model
+  GetModel() const { return _model; }
+  inline uint64_t
+  Seed() const { return _seed; }
+
+  void                Generate( const uint64_t first,
+                                const uint64_t n,
+                                double*        out );
+  std::vector<double> Generate( const uint64_t n );
+  std::vector<double> Histogram( const uint64_t n,
+                                 const double   xmin,
+                                 const double   xmax,
+                                 const unsigned nbins );
+
+  void WriteArea( const std::string& file,
+                  const uint64_t     n,
+                  const unsigned     ncol = 16 );
+  void WriteHistogram( const std::string& file,
+                       const uint64_t     n,
+                       const double       xmin,
+                       const double       xmax,
+                       const unsigned     nbins );
+  void WriteWaveFormat( const std::string&  file,
+                        const uint64_t      n,
+                        const WaveSettings& settings = default_wave );
+
+  static const WaveSettings default_wave;
+
+  // Number of events per parallel task. The events only depend on the seed
+  // and the event index, not on the batching.
+  static unsigned block_size;
+
+private:
+  struct Tables;
+  struct Workspace;
+
+  Model                       _model;
+  uint64_t                    _seed;
+  ThreadPool                  _pool;
+  std::array<double, kNParam> _par;
+
+  Tables make_tables() const;
+  void   generate_block( const Tables&, const uint64_t first,
+                         const unsigned n, double* out ) const;
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef SIPMCALIB_SIPMCALC_UNIFORMSPLINE_HPP
+#define SIPMCALIB_SIPMCALC_UNIFORMSPLINE_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+class UniformSpline
+{
+public:
+  UniformSpline();
+
+  void SetData( const double xmin, const double step,
+                const std::vector<double>& y );
+
+  /**
+   * @brief Evaluating the spline at x. The interval is computed directly from
+   * the grid spacing, values outside the grid are extrapolated with the cubic
+   * of the first/last interval. The interval index is clamped with negated
+   * comparisons, so a NaN input maps to the first interval and evaluates to
+   * NaN.
+   */
+  inline double
+  Eval( const double x ) const
+  {
+    const double t  = ( x-_xmin ) * _invstep;
+    const double fl = std::floor( t );
+    const double f  = !( fl >= 0 )    ? 0 :
+                      !( fl <= _imax ) ? _imax :
+                      fl;
+    const size_t i  = (size_t)f;
+    const double u  = t-f;
+    return ( ( _d[i] * u+_c[i] ) * u+_b[i] ) * u+_a[i];
+  }
+
+  void Eval( const double* x, double* out, const size_t n ) const;
+
+  inline double
+  XMin() const { return _xmin; }
+  inline double
+  XMax() const { return _xmin+_step * ( Size()-1 ); }
+  inline double
+  Step() const { return _step; }
+  inline size_t
+  Size() const { return _a.empty() ? 0 : _a.size()+1; }
+
+private:
+  double _xmin;
+  double _step;
+  double _invstep;
+  double _imax;// Index of the last interval
+
+  // Polynomial coefficients of each interval in the local coordinate u in
+  // [0,1): a+b*u+c*u^2+d*u^3
+  std::vector<double> _a;
+  std::vector<double> _b;
+  std::vector<double> _c;
+  std::vector<double> _d;
+};
+
+#endif
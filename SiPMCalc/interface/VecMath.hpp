@@ -0,0 +1,193 @@
+#ifndef SIPMCALIB_SIPMCALC_VECMATH_HPP
+#define SIPMCALIB_SIPMCALC_VECMATH_HPP
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+
+/**
+ * @brief Special function kernels (exp, log, erf, Gaussian PDF/CDF) used by the
+ * SiPM PDF evaluation.
+ * @ingroup SiPMCalc
+ *
+ * @details All functions are available as inlined scalar functions, and as
+ * array functions that are dispatched at run time to AVX-512, AVX2+FMA or scalar
+ * implementations depending on the host CPU. The same algorithms are used for
+ * all backends, and the results only differ at the level of FMA contraction.
+ *
+ * Two precision modes are provided. The maximum relative errors, measured
+ * against long double references over the full double range (excluding
+ * subnormal outputs), are:
+ *
+ * | Function   | kAccurate | kFast  |
+ * |------------|-----------|--------|
+ * | Exp        | 2e-16     | 7e-9   |
+ * | Log        | 4e-16     | 2e-9   |
+ * | Erf        | 3e-16     | 1.4e-9 |
+ * | Erfc       | 6e-16     | 8e-9   |
+ * | NormalPdf  | 9e-14     | 7e-9   |
+ * | NormalCdf  | 9e-14     | 8e-9   |
+ *
+ * The NormalPdf/NormalCdf errors are dominated by the rounding of the
+ * standardized argument (x-mu)/sigma far in the tails (|z| ~ 17 for the
+ * quoted numbers), which is also present in the TMath implementations. The
+ * kAccurate mode is what the likelihood fits use (see the
+ * test/VecMathValidate.cc program for the comparison with TMath). Environment variable
+ * SIPMCALIB_VECMATH_ISA=scalar|avx2|avx512 can be used to restrict the backend
+ * for validation.
+ */
+namespace vecmath
+{
+
+enum Precision
+{
+  kAccurate = 0,
+  kFast     = 1
+};
+
+namespace scalar
+{
+
+struct Ops
+{
+  typedef double V;
+  typedef bool   M;
+  static constexpr size_t width = 1;
+
+  static inline V
+  set1( const double x ){ return x; }
+  static inline V
+  load( const double* p ){ return *p; }
+  static inline void
+  store( double* p, const V x ){ *p = x; }
+  static inline V
+  min( const V a, const V b ){ return a < b ? a : b; }
+  static inline V
+  max( const V a, const V b ){ return a > b ? a : b; }
+  static inline V
+  abs( const V a ){ return std::fabs( a ); }
+  static inline V
+  copysign( const V a, const V s ){ return std::copysign( a, s ); }
+  static inline M
+  lt( const V a, const V b ){ return a < b; }
+  static inline M
+  gt( const V a, const V b ){ return a > b; }
+  static inline M
+  eq( const V a, const V b ){ return a == b; }
+  static inline M
+  isnan( const V a ){ return a != a; }
+  static inline bool
+  any( const M m ){ return m; }
+  static inline bool
+  all( const M m ){ return m; }
+  static inline V
+  select( const M m, const V a, const V b ){ return m ? a : b; }
+
+  // 2^n for integer valued n in [-1022, 1023]
+  static inline V
+  pow2( const V n )
+  {
+    const uint64_t bits = (uint64_t)( (int64_t)n+1023 ) << 52;
+    double         ans;
+    std::memcpy( &ans, &bits, sizeof( double ) );
+    return ans;
+  }
+
+  // Splitting positive normal x into mantissa m in [1,2) and exponent e.
+  static inline void
+  frexp1( const V x, V& m, V& e )
+  {
+    uint64_t bits;
+    std::memcpy( &bits, &x, sizeof( double ) );
+    e    = (double)( (int)( ( bits >> 52 ) & 0x7ff )-1023 );
+    bits = ( bits & 0x000fffffffffffffULL ) | 0x3ff0000000000000ULL;
+    std::memcpy( &m, &bits, sizeof( double ) );
+  }
+};
+
+#include "SiPMCalib/SiPMCalc/interface/VecMathImpl.icc"
+
+}
+
+/**
+ * @{
+ * @brief Scalar versions of the kernels.
+ */
+template<Precision P = kAccurate>
+inline double
+Exp( const double x ){ return scalar::ExpV<P == kFast>( x ); }
+
+template<Precision P = kAccurate>
+inline double
+Log( const double x ){ return scalar::LogV<P == kFast>( x ); }
+
+template<Precision P = kAccurate>
+inline double
+Erf( const double x ){ return scalar::ErfV<P == kFast>( x ); }
+
+template<Precision P = kAccurate>
+inline double
+Erfc( const double x ){ return scalar::ErfcV<P == kFast>( x ); }
+
+template<Precision P = kAccurate>
+inline double
+NormalPdf( const double x, const double mu, const double sigma )
+{
+  return scalar::NormalPdfV<P == kFast>( x, mu, sigma );
+}
+
+
+template<Precision P = kAccurate>
+inline double
+NormalCdf( const double x, const double mu, const double sigma )
+{
+  return scalar::NormalCdfV<P == kFast>( x, mu, sigma );
+}
+
+
+/** @} */
+
+/**
+ * @{
+ * @brief Array versions of the kernels, out[i] = f( x[i] ).
+ *
+ * The output array may be the same as one of the input arrays.
+ */
+extern void Exp( const double* x, double* out, size_t n,
+                 Precision = kAccurate );
+extern void Log( const double* x, double* out, size_t n,
+                 Precision = kAccurate );
+extern void Erf( const double* x, double* out, size_t n,
+                 Precision = kAccurate );
+extern void Erfc( const double* x, double* out, size_t n,
+                  Precision = kAccurate );
+
+/** @} */
+
+/**
+ * @{
+ * @brief Array versions of the Gaussian PDF and CDF.
+ *
+ * The first variant evaluates a single point for a series of Gaussians
+ * (out[i] = f( x; mu[i], sigma[i] )), the second variant evaluates a single
+ * Gaussian over a series of points (out[i] = f( x[i]; mu, sigma ) ).
+ */
+extern void NormalPdf( double x, const double* mu, const double* sigma,
+                       double* out, size_t n, Precision = kAccurate );
+extern void NormalPdf( const double* x, double mu, double sigma,
+                       double* out, size_t n, Precision = kAccurate );
+extern void NormalCdf( double x, const double* mu, const double* sigma,
+                       double* out, size_t n, Precision = kAccurate );
+extern void NormalCdf( const double* x, double mu, double sigma,
+                       double* out, size_t n, Precision = kAccurate );
+
+/** @} */
+
+extern const char* BackendName();
+
+}
+
+#endif
@@ -1,4 +1,6 @@
 #include "SiPMCalib/SiPMCalc/interface/CrossTalkPdf.hpp"
+#include "SiPMCalib/SiPMCalc/interface/PdfCounters.hpp"
+#include "SiPMCalib/SiPMCalc/interface/VecMath.hpp"
 
 #include "RooRealVar.h"
 #include "TMath.h"
@@ -46,6 +48,9 @@ CrossTalkPdf::evaluate() const
 {
   double ans = 0;
 
+  SIPMCALIB_COUNT( kCrossTalkPdfEval, 1 );
+  SIPMCALIB_COUNT( kCrossTalkPdfTerms, 5 );
+
   for( int i = 0; i <= 4; ++i ){
     ans += cross_prob( i ) * gauss_k( i );
   }
@@ -68,8 +73,7 @@ CrossTalkPdf::cross_prob( const int k ) const
 double
 CrossTalkPdf::gauss_k( const int k ) const
 {
-  return TMath::Gaus( x,
-                      x0+k * gain,
-                      sqrt( s0 * s0+( k+1 ) * s1 * s1 ),
-                      kTRUE );
+  return vecmath::NormalPdf( x,
+                             x0+k * gain,
+                             sqrt( s0 * s0+( k+1 ) * s1 * s1 ) );
 }
@@ -0,0 +1,75 @@
+#include "SiPMCalib/SiPMCalc/interface/PdfCounters.hpp"
+
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+namespace pdfcount
+{
+
+std::atomic<uint64_t> counters[kNCounter] = {};
+
+/**
+ * @brief Current values of all counters.
+ */
+Snapshot
+Take()
+{
+  Snapshot ans;
+
+  for( unsigned i = 0; i < kNCounter; ++i ){
+    ans[i] = counters[i].load( std::memory_order_relaxed );
+  }
+
+  return ans;
+}
+
+
+static double
+Ratio( const double num, const double den )
+{
+  return den > 0 ? num / den : 0;
+}
+
+
+/**
+ * @brief Human readable summary of the work done between two snapshots. The
+ * counters are process wide, so the work of any concurrently running fit is
+ * included. The largest FFT size is that of the whole process.
+ */
+std::string
+Summary( const Snapshot& begin, const Snapshot& end )
+{
+  Snapshot d;
+
+  for( unsigned i = 0; i < kNCounter; ++i ){
+    d[i] = end[i]-begin[i];
+  }
+
+  return usr::fstr(
+    "SiPMPdf: %lu evaluations (%.1lf%% from FFT table), "
+    "%lu normalization integrals (%.1lf%% cached), "
+    "%.1lf peak terms per direct evaluation\n"
+    "SiPMDarkPdf: %lu evaluations\n"
+    "CrossTalkPdf: %lu evaluations, %.1lf terms per evaluation\n"
+    "MDistro: %lu lookups (%lu last table, %lu cache hits, %lu misses), "
+    "%lu FFT rebuilds (average size %.0lf, largest %lu), "
+    "%lu M function spectra, %lu quadrature tables",
+    (unsigned long)d[kSiPMPdfEval],
+    100 * Ratio( d[kSiPMPdfFFTEval], d[kSiPMPdfEval] ),
+    (unsigned long)d[kSiPMPdfIntegral],
+    100 * Ratio( d[kSiPMPdfIntegralHit], d[kSiPMPdfIntegral] ),
+    Ratio( d[kSiPMPdfTerms], d[kSiPMPdfDirect] ),
+    (unsigned long)d[kSiPMDarkPdfEval],
+    (unsigned long)d[kCrossTalkPdfEval],
+    Ratio( d[kCrossTalkPdfTerms], d[kCrossTalkPdfEval] ),
+    (unsigned long)d[kMDistroLookup],
+    (unsigned long)d[kMDistroLastHit],
+    (unsigned long)d[kMDistroCacheHit],
+    (unsigned long)d[kMDistroCacheMiss],
+    (unsigned long)d[kMDistroFFTBuild],
+    Ratio( d[kMDistroFFTSize], d[kMDistroFFTBuild] ),
+    (unsigned long)end[kMDistroFFTMaxSize],
+    (unsigned long)d[kMDistroSpectrumBuild],
+    (unsigned long)d[kMDistroQuadBuild] );
+}
+
+}
@@ -0,0 +1,254 @@
+#include "SiPMCalib/SiPMCalc/interface/RealFFT.hpp"
+
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#ifdef SIPMCALIB_USE_FFTW
+#include <fftw3.h>
+#else
+#include <gsl/gsl_fft_halfcomplex.h>
+#include <gsl/gsl_fft_real.h>
+#endif
+
+/**
+ * @class RealFFT
+ * @ingroup SiPMCalc
+ * @brief Real-to-complex FFT of a fixed size, with the transform plans shared
+ * between instances.
+ *
+ * @details The transforms are performed by the GSL mixed-radix routines by
+ * default, or by FFTW if the package is compiled with SIPMCALIB_USE_FFTW
+ * defined (see the CMake option of the same name). Both backends handle
+ * arbitrary sizes, though the GoodSize() function should be used to round the
+ * grid sizes up to a number with only 2, 3 and 5 as prime factors. These are
+ * typically within a few percent of the requested size, rather than up to a
+ * factor 2 larger for a power of 2.
+ *
+ * The GSL wavetables (or FFTW plans) only depend on the size, and are kept in a
+ * process-wide cache of the most recently used sizes, so that repeated
+ * transforms of the same size in different MDistro or SiPMSpectrumFFT
+ * instances do not recompute the trigonometric tables. The plans are read-only
+ * once created, the transforms themselves can be executed concurrently from
+ * multiple threads.
+ *
+ * The frequency domain layout is that of the FFTW r2c transforms: n/2+1
+ * complex values for the non-negative frequencies.
+ */
+
+static const size_t plan_cache_size = 16;
+
+// Process wide lock of the plan cache. The FFTW planner is not thread safe, so
+// the plan creation and destruction are also done under the lock.
+static std::mutex plan_mutex;
+
+#ifdef SIPMCALIB_USE_FFTW
+
+struct RealFFT::Plan
+{
+  fftw_plan fwd;
+  fftw_plan bwd;
+
+  explicit Plan( const size_t n )
+  {
+    // Planning with temporary arrays, the execution uses the new-array
+    // interface, hence the FFTW_UNALIGNED flag.
+    double*       r = fftw_alloc_real( n );
+    fftw_complex* c = fftw_alloc_complex( n / 2+1 );
+    fwd = fftw_plan_dft_r2c_1d( n, r, c, FFTW_ESTIMATE | FFTW_UNALIGNED );
+    bwd = fftw_plan_dft_c2r_1d( n, c, r, FFTW_ESTIMATE | FFTW_UNALIGNED );
+    fftw_free( r );
+    fftw_free( c );
+  }
+
+  // The last reference of a plan can be released by any thread, so the lock
+  // is taken here rather than by the owner.
+  ~Plan()
+  {
+    std::lock_guard<std::mutex> lock( plan_mutex );
+    fftw_destroy_plan( fwd );
+    fftw_destroy_plan( bwd );
+  }
+};
+
+#else
+
+struct RealFFT::Plan
+{
+  gsl_fft_real_wavetable*        real;
+  gsl_fft_halfcomplex_wavetable* hc;
+
+  explicit Plan( const size_t n ) :
+    real( gsl_fft_real_wavetable_alloc( n ) ),
+    hc  ( gsl_fft_halfcomplex_wavetable_alloc( n ) )
+  {}
+
+  ~Plan()
+  {
+    gsl_fft_real_wavetable_free( real );
+    gsl_fft_halfcomplex_wavetable_free( hc );
+  }
+};
+
+/**
+ * @brief GSL scratch space, one per thread, reallocated when the transform
+ * size changes.
+ */
+struct GSLWorkspace
+{
+  size_t                  n;
+  gsl_fft_real_workspace* work;
+
+  GSLWorkspace() : n( 0 ), work( nullptr ){}
+  ~GSLWorkspace(){ if( work ){ gsl_fft_real_workspace_free( work ); } }
+
+  gsl_fft_real_workspace*
+  Get( const size_t x )
+  {
+    if( x != n ){
+      if( work ){ gsl_fft_real_workspace_free( work ); }
+      work = gsl_fft_real_workspace_alloc( x );
+      n    = x;
+    }
+    return work;
+  }
+};
+
+static thread_local GSLWorkspace workspace;
+
+#endif
+
+// Process wide cache of the most recently used plans, guarded by plan_mutex.
+static std::list<std::pair<size_t, std::shared_ptr<const RealFFT::Plan> > >
+  plan_cache;
+
+
+RealFFT::RealFFT( const size_t n ) :
+  _n( n )
+{
+  // Plans evicted from the cache are only released after the lock is
+  // released, as the plan destructor may need to take the lock itself.
+  std::vector<std::shared_ptr<const Plan> > evicted;
+  std::lock_guard<std::mutex>               lock( plan_mutex );
+
+  for( auto it = plan_cache.begin(); it != plan_cache.end(); ++it ){
+    if( it->first == n ){
+      plan_cache.splice( plan_cache.begin(), plan_cache, it );
+      _plan = plan_cache.front().second;
+      return;
+    }
+  }
+
+  _plan = std::make_shared<const Plan>( n );
+  plan_cache.emplace_front( n, _plan );
+
+  while( plan_cache.size() > plan_cache_size ){
+    evicted.push_back( std::move( plan_cache.back().second ) );
+    plan_cache.pop_back();
+  }
+}
+
+
+RealFFT::~RealFFT(){}
+
+
+void
+RealFFT::Forward( const double* in, std::complex<double>* out ) const
+{
+#ifdef SIPMCALIB_USE_FFTW
+  fftw_execute_dft_r2c( _plan->fwd,
+                        const_cast<double*>( in ),
+                        reinterpret_cast<fftw_complex*>( out ) );
+#else
+  // Transforming in the output array, then unpacking the GSL mixed-radix
+  // half complex format ( r0, r1, i1, r2, i2, ... ) from the back so that no
+  // unread value is overwritten.
+  double* d = reinterpret_cast<double*>( out );
+  std::copy( in, in+_n, d );
+  gsl_fft_real_transform( d, 1, _n, _plan->real, workspace.Get( _n ) );
+
+  if( _n % 2 == 0 ){
+    out[_n / 2] = std::complex<double>( d[_n-1], 0 );
+  }
+
+  for( size_t m = ( _n-1 ) / 2; m >= 1; --m ){
+    out[m] = std::complex<double>( d[2 * m-1], d[2 * m] );
+  }
+
+  out[0] = std::complex<double>( d[0], 0 );
+#endif
+}
+
+
+void
+RealFFT::Inverse( std::complex<double>* in, double* out ) const
+{
+#ifdef SIPMCALIB_USE_FFTW
+  fftw_execute_dft_c2r( _plan->bwd,
+                        reinterpret_cast<fftw_complex*>( in ),
+                        out );
+
+  const double norm = 1.0 / _n;
+
+  for( size_t i = 0; i < _n; ++i ){
+    out[i] *= norm;
+  }
+#else
+  // Packing into the half complex format in the output array.
+  out[0] = in[0].real();
+
+  for( size_t m = 1; 2 * m < _n; ++m ){
+    out[2 * m-1] = in[m].real();
+    out[2 * m]   = in[m].imag();
+  }
+
+  if( _n % 2 == 0 ){
+    out[_n-1] = in[_n / 2].real();
+  }
+
+  gsl_fft_halfcomplex_inverse( out, 1, _n, _plan->hc, workspace.Get( _n ) );
+#endif
+}
+
+
+/**
+ * @brief Smallest number of the form 2^a 3^b 5^c that is no smaller than n.
+ */
+size_t
+RealFFT::GoodSize( const size_t n )
+{
+  if( n <= 1 ){ return 1; }
+
+  size_t best = 1;
+
+  while( best < n ){
+    best *= 2;
+  }
+
+  for( size_t p5 = 1; p5 < best; p5 *= 5 ){
+    for( size_t p35 = p5; p35 < best; p35 *= 3 ){
+      size_t x = p35;
+
+      while( x < n ){
+        x *= 2;
+      }
+
+      best = std::min( best, x );
+    }
+  }
+
+  return best;
+}
+
+
+const char*
+RealFFT::BackendName()
+{
+#ifdef SIPMCALIB_USE_FFTW
+  return "fftw";
+#else
+  return "gsl";
+#endif
+}
@@ -0,0 +1,307 @@
+#include "SiPMCalib/SiPMCalc/interface/SiPMBinnedNLL.hpp"
+
+#include "Math/MinimizerOptions.h"
+#include "RooArgSet.h"
+#include "RooLinkedListIter.h"
+#include "RooMinimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/**
+ * @class SiPMBinnedNLL
+ * @ingroup SiPMCalc
+ * @brief Multi-threaded negative log likelihood of a PDF with respect to a
+ * binned data set.
+ *
+ * @details The likelihood is the standard binned likelihood used by RooFit for
+ * a RooDataHist:
+ *
+ * NLL = -sum_i w_i log( f(x_i) / I )
+ *
+ * where x_i and w_i are the bin centers and bin contents in the fit range, f is
+ * the unnormalized PDF and I is the PDF integral over the fit range. The bins are
+ * partitioned across a persistent ThreadPool. Each thread evaluates a private
+ * clone of the full PDF expression tree, whose parameters are synchronized to
+ * the main parameters before each evaluation. The per-bin terms are written to a
+ * common scratch array and summed in bin order with Kahan summation on the
+ * calling thread, so the results are bit-wise identical regardless of the number
+ * of threads used.
+ *
+ * The object is a regular RooAbsReal depending on all the parameters of the
+ * input PDF, and can be passed directly to a RooMinimizer instance. See the
+ * ConvergeNLLMinimizer() function for the typical use case.
+ */
+
+SiPMBinnedNLL::SiPMBinnedNLL( const char*        name,
+                              const char*        title,
+                              RooAbsPdf&         pdf,
+                              RooRealVar&        x,
+                              const RooDataHist& data,
+                              const unsigned     nthreads ) :
+  SiPMBinnedNLL( name, title, pdf, x, data, x.getMin(), x.getMax(), nthreads )
+{}
+
+
+SiPMBinnedNLL::SiPMBinnedNLL( const char*        name,
+                              const char*        title,
+                              RooAbsPdf&         pdf,
+                              RooRealVar&        x,
+                              const RooDataHist& data,
+                              const double       xmin,
+                              const double       xmax,
+                              const unsigned     nthreads ) :
+  RooAbsReal( name, title ),
+  params    ( "params", "params", this ),
+  _pdf      ( &pdf ),
+  _x        ( &x ),
+  _data     ( &data ),
+  _xmin     ( xmin ),
+  _xmax     ( xmax )
+{
+  std::unique_ptr<RooArgSet> parset( pdf.getParameters( RooArgSet( x ) ) );
+  params.add( *parset );
+  init( nthreads );
+}
+
+
+SiPMBinnedNLL::SiPMBinnedNLL( const SiPMBinnedNLL& other, const char*name ) :
+  RooAbsReal( other, name ),
+  params    ( "params", this, other.params ),
+  _pdf      ( other._pdf ),
+  _x        ( other._x ),
+  _data     ( other._data ),
+  _xmin     ( other._xmin ),
+  _xmax     ( other._xmax )
+{
+  init( other.NThreads() );
+}
+
+
+SiPMBinnedNLL::~SiPMBinnedNLL(){}
+
+TObject*
+SiPMBinnedNLL::clone( const char*name ) const
+{
+  return new SiPMBinnedNLL( *this, name );
+}
+
+
+/**
+ * @brief Flattening the data in the fit range, creating the normalization
+ * integral and the per-thread PDF clones.
+ */
+void
+SiPMBinnedNLL::init( const unsigned nthreads )
+{
+  // Normalization integral over the fit range. The range is set on the
+  // observable of a PDF clone, leaving the ranges of the input observable
+  // untouched.
+  _range = std::string( GetName() )+"_nllrange";
+  _norm.reset();
+  init_context( _normcontext );
+  _normcontext.x->setRange( _range.c_str(), _xmin, _xmax );
+  _norm.reset( _normcontext.pdf->createIntegral( RooArgSet( *_normcontext.x ),
+                                                 _range.c_str() ) );
+
+  // Flattening the data
+  _xval.clear();
+  _weight.clear();
+
+  for( int i = 0; i < _data->numEntries(); ++i ){
+    const RooArgSet* row = _data->get( i );
+    const double     xv  = row->getRealValue( _x->GetName() );
+    const double     w   = _data->weight();
+    if( xv < _xmin || xv > _xmax || w == 0 ){ continue; }
+    _xval.push_back( xv );
+    _weight.push_back( w );
+  }
+
+  _binnll.resize( _xval.size() );
+
+  // Creating the thread contexts
+  _pool.reset( new ThreadPool( nthreads ) );
+  _context.clear();
+  _context.resize( _pool->NThreads() );
+
+  for( auto& ctx : _context ){
+    init_context( ctx );
+  }
+}
+
+
+/**
+ * @brief Cloning the PDF expression tree into an evaluation context, and
+ * pairing the main parameters with the cloned parameters.
+ */
+void
+SiPMBinnedNLL::init_context( ThreadContext& ctx ) const
+{
+  ctx.pdf.reset( dynamic_cast<RooAbsPdf*>( _pdf->cloneTree() ) );
+  ctx.sync.clear();
+
+  std::unique_ptr<RooArgSet> obs( ctx.pdf->getObservables( RooArgSet( *_x ) ) );
+  std::unique_ptr<RooArgSet> par( ctx.pdf->getParameters( RooArgSet( *_x ) ) );
+  ctx.x = dynamic_cast<RooRealVar*>( obs->find( _x->GetName() ) );
+
+  RooFIter iter = params.fwdIterator();
+
+  while( RooAbsArg* arg = iter.next() ){
+    RooRealVar* main  = dynamic_cast<RooRealVar*>( arg );
+    RooRealVar* clone = dynamic_cast<RooRealVar*>( par->find( arg->GetName() ) );
+    if( main && clone ){
+      ctx.sync.emplace_back( main, clone );
+    }
+  }
+}
+
+
+double
+SiPMBinnedNLL::evaluate() const
+{
+  // Synchronizing the parameters of the thread local PDF copies
+  for( auto& ctx : _context ){
+    for( auto& p : ctx.sync ){
+      p.second->setVal( p.first->getVal() );
+    }
+  }
+
+  for( auto& p : _normcontext.sync ){
+    p.second->setVal( p.first->getVal() );
+  }
+
+  _pool->ParallelFor( _xval.size(),
+                      [this]( const size_t begin,
+                              const size_t end,
+                              const unsigned thread ){
+    ThreadContext& ctx = _context[thread];
+
+    for( size_t i = begin; i < end; ++i ){
+      ctx.x->setVal( _xval[i] );
+      double f = ctx.pdf->getVal();
+      if( !( f > 0 ) ){
+        f = std::numeric_limits<double>::min();
+      }
+      _binnll[i] = _weight[i] * std::log( f );
+    }
+  } );
+
+  // Deterministic reduction in bin order (Kahan summation)
+  double sum  = 0;
+  double comp = 0;
+  double sumw = 0;
+
+  for( size_t i = 0; i < _binnll.size(); ++i ){
+    const double y = _binnll[i]-comp;
+    const double t = sum+y;
+    comp  = ( t-sum )-y;
+    sum   = t;
+    sumw += _weight[i];
+  }
+
+  return -( sum-sumw * std::log( _norm->getVal() ) );
+}
+
+
+/**
+ * @class SiPMSimultaneousNLL
+ * @ingroup SiPMCalc
+ * @brief Sum of independent negative log likelihoods, with the components
+ * evaluated in parallel.
+ *
+ * @details Used for the simultaneous fit of several spectra that share some of
+ * the parameters: each component is typically a SiPMBinnedNLL of a single
+ * spectrum, and the parameters shared between the spectra are the same
+ * RooRealVar objects in all components. The components are distributed over a
+ * persistent ThreadPool, with each component evaluated entirely by a single
+ * thread, so the components must not share any objects other than the
+ * parameters (each SiPMBinnedNLL can still use its own threads for the bins).
+ * The component results are summed in the list order on the calling thread, so
+ * the results do not depend on the number of threads used.
+ */
+
+SiPMSimultaneousNLL::SiPMSimultaneousNLL( const char*       name,
+                                          const char*       title,
+                                          const RooArgList& nlls,
+                                          const unsigned    nthreads ) :
+  RooAbsReal( name, title ),
+  _nlls     ( "nlls", "nlls", this ),
+  _pool     ( new ThreadPool( std::min( nthreads == 0 ?
+                                        ThreadPool::HardwareThreads() :
+                                        nthreads,
+                                        std::max( (unsigned)nlls.getSize(),
+                                                  1u ) ) ) ),
+  _compnll  ( nlls.getSize() )
+{
+  _nlls.add( nlls );
+}
+
+
+SiPMSimultaneousNLL::SiPMSimultaneousNLL( const SiPMSimultaneousNLL& other,
+                                          const char*                name ) :
+  RooAbsReal( other, name ),
+  _nlls     ( "nlls", this, other._nlls ),
+  _pool     ( new ThreadPool( other.NThreads() ) ),
+  _compnll  ( other._compnll.size() )
+{}
+
+
+SiPMSimultaneousNLL::~SiPMSimultaneousNLL(){}
+
+TObject*
+SiPMSimultaneousNLL::clone( const char*name ) const
+{
+  return new SiPMSimultaneousNLL( *this, name );
+}
+
+
+double
+SiPMSimultaneousNLL::evaluate() const
+{
+  _pool->ParallelFor( _compnll.size(),
+                      [this]( const size_t begin,
+                              const size_t end,
+                              const unsigned ){
+    for( size_t i = begin; i < end; ++i ){
+      _compnll[i] = static_cast<const RooAbsReal&>( _nlls[i] ).getVal();
+    }
+  } );
+
+  double sum = 0;
+
+  for( const double x : _compnll ){
+    sum += x;
+  }
+
+  return sum;
+}
+
+
+/**
+ * @brief Minimizing a negative log likelihood object with Migrad, retrying up
+ * to maxiter times until the minimizer reports a converged status, then
+ * running Hesse for the parameter uncertainties.
+ *
+ * The minimizer type is the ROOT default (see
+ * ROOT::Math::MinimizerOptions::SetDefaultMinimizer), for example Minuit2
+ * when running multiple minimizations concurrently. Returns the status of the
+ * last Migrad call.
+ */
+int
+ConvergeNLLMinimizer( RooAbsReal& nll, const unsigned maxiter )
+{
+  RooMinimizer minimizer( nll );
+  minimizer.setPrintLevel( -1 );
+  minimizer.setMinimizerType(
+    ROOT::Math::MinimizerOptions::DefaultMinimizerType().c_str() );
+
+  int status = -1;
+
+  for( unsigned i = 0; i < maxiter && status != 0; ++i ){
+    status = minimizer.migrad();
+  }
+
+  minimizer.hesse();
+  return status;
+}
@@ -1,4 +1,6 @@
+#include "SiPMCalib/SiPMCalc/interface/PdfCounters.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMDarkPdf.hpp"
+#include "SiPMCalib/SiPMCalc/interface/VecMath.hpp"
 #include "TMath.h"
 
 SiPMDarkPdf::SiPMDarkPdf( const char* name,
@@ -31,7 +33,7 @@ SiPMDarkPdf::SiPMDarkPdf( const SiPMDarkPdf& other, const char*name ) :
   s1       (      "s1",       this, other.s1   ),
   dcfrac   (  "dcfrac1",  this, other.dcfrac ),
   epsilon  ( "epsilon",  this, other.epsilon ),
-  mdistro  ( ped, gain, epsilon, sqrt( s0 * s0+s1 * s1 ) )
+  mdistro  ( other.mdistro.GetCache(), other.mdistro.GetMode() )
 {}
 
 
@@ -47,9 +49,13 @@ SiPMDarkPdf::~SiPMDarkPdf(){}
 double
 SiPMDarkPdf::evaluate() const
 {
-  mdistro.SetParam( ped, ped+gain, epsilon, sqrt( s0 * s0+s1 * s1 ) );
-  return ( 1-dcfrac ) * TMath::Gaus( x, ped, s0, kTRUE )
-         +dcfrac * mdistro.Evaluate( x );
+  // Using the returned table rather than the instance state, so that
+  // concurrent evaluations are independent.
+  const auto table = mdistro.Lookup( ped, ped+gain, epsilon,
+                                     sqrt( s0 * s0+s1 * s1 ) );
+  SIPMCALIB_COUNT( kSiPMDarkPdfEval, 1 );
+  return ( 1-dcfrac ) * vecmath::NormalPdf( x, ped, s0 )
+         +dcfrac * table->Evaluate( x );
 }
 
 
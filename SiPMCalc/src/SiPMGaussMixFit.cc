@@ -0,0 +1,457 @@
+#include "SiPMCalib/SiPMCalc/interface/SiPMGaussMixFit.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+/**
+ * @class SiPMGaussMixFit
+ * @ingroup SiPMCalc
+ * @brief Expectation-maximization fit of a binned low light spectrum with a
+ * mixture of Gaussian photo-electron peaks.
+ *
+ * @details The model is the SiPMPdf without the afterpulse and dark current
+ * terms: peak k is a Gaussian of mean ped+k*gain and variance s0^2+k*s1^2,
+ * with the generalized Poisson weight
+ *
+ * P(k) = mean (mean+k lambda)^(k-1) exp( -mean-k lambda ) / k!
+ *
+ * Each iteration runs the E-step, which computes the per-peak sums of the
+ * responsibilities (N_k) and of the first and second moments of the bin
+ * positions weighted by the responsibilities, then three conditional
+ * maximization steps (ECM):
+ *
+ * - ped and gain: weighted linear least squares of the peak moments, exact for
+ *   fixed peak widths.
+ * - s0^2 and s1^2: weighted linear least squares of the per-peak variances
+ *   against k, with weights N_k/var_k^2. This is the Fisher scoring step of the
+ *   expected log likelihood, and is exact if s1 = 0.
+ * - mean and lambda: the generalized Poisson weights have no closed form
+ *   maximum, this is solved by a few Newton iterations over the N_k, which
+ *   costs nothing compared with the E-step.
+ *
+ * Parameters can be fixed individually, in which case the other parameter of
+ * the same step is solved with the fixed value. The E-step is split into
+ * chunks of a fixed number of bins distributed over a ThreadPool, and the
+ * chunk sums are combined in chunk order, so the results do not depend on the
+ * number of threads. The range of the histogram should contain the whole
+ * spectrum, since the peak weights are normalized to the peaks within the
+ * range. The uncertainties are computed after convergence from the finite
+ * difference Hessian of the observed log likelihood.
+ */
+
+// Bins per E-step chunk, fixed such that the summation order does not depend
+// on the number of threads.
+static const size_t chunk_size = 256;
+
+// Solving the symmetric 2x2 system A x = b for the entries of x that are not
+// fixed, leaving the fixed entries untouched. Returns false without modifying x
+// if the system is singular.
+static bool
+Solve2( const double a00, const double a01, const double a11,
+        const double b0,  const double b1,
+        double& x0, double& x1,
+        const bool f0, const bool f1 )
+{
+  if( f0 && f1 ){
+    return true;
+  } else if( f0 ){
+    if( !( a11 > 0 ) ){ return false; }
+    x1 = ( b1-a01 * x0 ) / a11;
+  } else if( f1 ){
+    if( !( a00 > 0 ) ){ return false; }
+    x0 = ( b0-a01 * x1 ) / a00;
+  } else {
+    const double det = a00 * a11-a01 * a01;
+    if( !( det > 1e-12 * a00 * a11 ) ){ return false; }
+    x0 = ( a11 * b0-a01 * b1 ) / det;
+    x1 = ( a00 * b1-a01 * b0 ) / det;
+  }
+  return true;
+}
+
+
+SiPMGaussMixFit::SiPMGaussMixFit( const std::vector<double>& counts,
+                                  const double               xmin,
+                                  const double               binwidth,
+                                  const unsigned             nthreads ) :
+  maxiter  ( 500 ),
+  tolerance( 1e-10 ),
+  _counts  ( counts ),
+  _xmin    ( xmin ),
+  _bw      ( binwidth ),
+  _pool    ( nthreads ),
+  _niter   ( 0 ),
+  _logl    ( 0 )
+{
+  _par.fill( 0 );
+  _err.fill( 0 );
+  _fixed.fill( false );
+}
+
+
+/**
+ * @brief Setting the starting value of a parameter, fixed parameters are not
+ * modified by the fit.
+ */
+void
+SiPMGaussMixFit::SetParam( const Param i, const double val, const bool fixed )
+{
+  _par[i]   = val;
+  _fixed[i] = fixed;
+}
+
+
+/**
+ * @brief Running the EM iterations from the current parameter values, returns
+ * true if the fit converged within maxiter iterations.
+ */
+bool
+SiPMGaussMixFit::Run()
+{
+  _err.fill( 0 );
+  if( !( _par[kGain] > 0 ) || _counts.empty() ){ return false; }
+
+  // Starting values that the M-steps can move away from.
+  _par[kS0]     = std::max( _par[kS0], 0.1 * _bw );
+  _par[kS1]     = std::fabs( _par[kS1] );
+  _par[kMean]   = std::max( _par[kMean], 1e-3 );
+  _par[kLambda] = std::min( std::max( _par[kLambda], 0.0 ), 0.95 );
+
+  _logl = -std::numeric_limits<double>::infinity();
+  bool converged = false;
+
+  for( _niter = 0; _niter < maxiter && !converged; ++_niter ){
+    const Peaks         pk = make_peaks( _par );
+    std::vector<double> stats;
+    const double        logl = run_estep( pk, &stats );
+    if( !std::isfinite( logl ) ){ return false; }
+
+    converged = std::fabs( logl-_logl ) <= tolerance * std::fabs( logl );
+    _logl     = logl;
+    if( converged ){ break; }
+
+    mstep_position( stats, pk );
+    mstep_width( stats, pk );
+    mstep_weight( stats );
+  }
+
+  compute_errors();
+  return converged;
+}
+
+
+SiPMGaussMixFit::Peaks
+SiPMGaussMixFit::make_peaks( const std::array<double, kNParam>& p ) const
+{
+  const double xmax = _xmin+_bw * _counts.size();
+  const double mu0  = p[kMean];
+  const double lam  = p[kLambda];
+  Peaks        ans;
+  double       sum = 0;
+
+  for( unsigned k = 0; k < 200; ++k ){
+    const double mu  = p[kPed]+k * p[kGain];
+    const double var = p[kS0] * p[kS0]+k * p[kS1] * p[kS1];
+    if( k > 0 && mu > xmax+5 * std::sqrt( var ) ){ break; }
+
+    const double logw = k == 0 ? -mu0 :
+                        std::log( mu0 )+( k-1.0 ) * std::log( mu0+k * lam )
+                        -mu0-k * lam-std::lgamma( k+1.0 );
+    ans.mu.push_back( mu );
+    ans.var.push_back( var );
+    ans.norm.push_back( std::exp( logw ) );
+    sum += ans.norm.back();
+  }
+
+  for( unsigned k = 0; k < ans.mu.size(); ++k ){
+    ans.norm[k] *= _bw / ( sum * std::sqrt( 2 * M_PI * ans.var[k] ) );
+  }
+
+  return ans;
+}
+
+
+/**
+ * @brief Returning the log likelihood of the peaks, filling the per-peak sums
+ * of the responsibilities r, r*(x-mu_k) and r*(x-mu_k)^2 into stats if
+ * requested. Bins too far from all peaks are skipped.
+ */
+double
+SiPMGaussMixFit::run_estep( const Peaks& pk, std::vector<double>* stats )
+{
+  const size_t n      = _counts.size();
+  const size_t npeak  = pk.mu.size();
+  const size_t nchunk = ( n+chunk_size-1 ) / chunk_size;
+  const size_t stride = 3 * npeak+1;
+
+  std::vector<double> acc( nchunk * stride, 0.0 );
+
+  // Only the peaks within 10 sigma of a bin contribute, which for wide
+  // spectra is only a handful out of the npeak peaks.
+  const double gain  = npeak > 1 ? pk.mu[1]-pk.mu[0] : 1;
+  const double reach = npeak > 1 ? 10 * std::sqrt( pk.var.back() ) / gain+1 : 1;
+
+  _pool.ParallelFor( nchunk, [&]( const size_t begin, const size_t end,
+                                  const unsigned ){
+    std::vector<double> dens( npeak );
+
+    for( size_t c = begin; c < end; ++c ){
+      double* a = acc.data()+c * stride;
+
+      for( size_t i = c * chunk_size; i < std::min( n, ( c+1 ) * chunk_size ); ++i ){
+        const double h = _counts[i];
+        if( h <= 0 ){ continue; }
+
+        const double x    = _xmin+( i+0.5 ) * _bw;
+        const double kc   = ( x-pk.mu[0] ) / gain;
+        const size_t kmin = std::max( kc-reach, 0.0 );
+        const size_t kmax = std::min( std::max( kc+reach+1, 0.0 ), (double)npeak );
+        double       p    = 0;
+
+        for( size_t k = kmin; k < kmax; ++k ){
+          const double dx2 = ( x-pk.mu[k] ) * ( x-pk.mu[k] );
+          dens[k] = dx2 < 100 * pk.var[k] ?
+                    pk.norm[k] * std::exp( -dx2 / ( 2 * pk.var[k] ) ) : 0;
+          p += dens[k];
+        }
+
+        if( !( p > 0 ) ){ continue; }
+        a[3 * npeak] += h * std::log( p );
+        if( !stats ){ continue; }
+
+        for( size_t k = kmin; k < kmax; ++k ){
+          if( dens[k] == 0 ){ continue; }
+          const double r  = h * dens[k] / p;
+          const double dx = x-pk.mu[k];
+          a[3 * k]   += r;
+          a[3 * k+1] += r * dx;
+          a[3 * k+2] += r * dx * dx;
+        }
+      }
+    }
+  } );
+
+  double logl = 0;
+  if( stats ){ stats->assign( 3 * npeak, 0.0 ); }
+
+  for( size_t c = 0; c < nchunk; ++c ){
+    const double* a = acc.data()+c * stride;
+    logl += a[3 * npeak];
+    if( !stats ){ continue; }
+
+    for( size_t j = 0; j < 3 * npeak; ++j ){
+      ( *stats )[j] += a[j];
+    }
+  }
+
+  return logl;
+}
+
+
+void
+SiPMGaussMixFit::mstep_position( const std::vector<double>& stats,
+                                 const Peaks&               pk )
+{
+  double a00 = 0, a01 = 0, a11 = 0, b0 = 0, b1 = 0;
+
+  for( size_t k = 0; k < pk.mu.size(); ++k ){
+    const double w  = 1.0 / pk.var[k];
+    const double N  = stats[3 * k];
+    const double X  = stats[3 * k+1]+pk.mu[k] * N;// Sum of r*x
+    a00 += w * N;
+    a01 += w * k * N;
+    a11 += w * k * k * N;
+    b0  += w * X;
+    b1  += w * k * X;
+  }
+
+  // With a single populated peak, the gain cannot be updated.
+  if( !Solve2( a00, a01, a11, b0, b1, _par[kPed], _par[kGain],
+               _fixed[kPed], _fixed[kGain] ) ){
+    Solve2( a00, a01, a11, b0, b1, _par[kPed], _par[kGain],
+            _fixed[kPed], true );
+  }
+}
+
+
+void
+SiPMGaussMixFit::mstep_width( const std::vector<double>& stats,
+                              const Peaks&               pk )
+{
+  double a00 = 0, a01 = 0, a11 = 0, b0 = 0, b1 = 0;
+
+  for( size_t k = 0; k < pk.mu.size(); ++k ){
+    const double N = stats[3 * k];
+    if( !( N > 0 ) ){ continue; }
+
+    // Variance about the updated peak position, with Sheppard's correction for
+    // the binning.
+    const double d = _par[kPed]+k * _par[kGain]-pk.mu[k];
+    const double v = ( stats[3 * k+2]-2 * d * stats[3 * k+1]+d * d * N ) / N
+                     -_bw * _bw / 12;
+    const double u = N / ( pk.var[k] * pk.var[k] );
+    a00 += u;
+    a01 += u * k;
+    a11 += u * k * k;
+    b0  += u * v;
+    b1  += u * k * v;
+  }
+
+  double s0sq = _par[kS0] * _par[kS0];
+  double s1sq = _par[kS1] * _par[kS1];
+
+  if( !Solve2( a00, a01, a11, b0, b1, s0sq, s1sq,
+               _fixed[kS0], _fixed[kS1] ) ){
+    Solve2( a00, a01, a11, b0, b1, s0sq, s1sq, _fixed[kS0], true );
+  }
+
+  // Keeping the widths physical, the peaks cannot be narrower than the binning
+  // can resolve.
+  if( !_fixed[kS0] ){
+    _par[kS0] = std::sqrt( std::max( s0sq, 0.01 * _bw * _bw ) );
+  }
+  if( !_fixed[kS1] ){
+    _par[kS1] = std::sqrt( std::max( s1sq, 0.0 ) );
+  }
+}
+
+
+void
+SiPMGaussMixFit::mstep_weight( const std::vector<double>& stats )
+{
+  const size_t npeak = stats.size() / 3;
+
+  // Expected complete log likelihood of the weights, up to constants.
+  auto Q = [&stats, npeak]( const double mu, const double lam ){
+             double ans = 0;
+
+             for( size_t k = 0; k < npeak; ++k ){
+               const double N = stats[3 * k];
+               ans += k == 0 ? -N * mu :
+                      N * ( std::log( mu )+( k-1.0 ) * std::log( mu+k * lam )
+                            -mu-k * lam );
+             }
+
+             return ans;
+           };
+
+  double mu  = _par[kMean];
+  double lam = _par[kLambda];
+
+  for( unsigned iter = 0; iter < 20; ++iter ){
+    double g0 = 0, g1 = 0, a00 = 0, a01 = 0, a11 = 0;
+
+    for( size_t k = 1; k < npeak; ++k ){
+      const double N = stats[3 * k];
+      const double t = mu+k * lam;
+      g0  += N * ( 1 / mu+( k-1.0 ) / t-1 );
+      g1  += N * ( k * ( k-1.0 ) / t-k );
+      a00 += N * ( 1 / ( mu * mu )+( k-1.0 ) / ( t * t ) );
+      a01 += N * k * ( k-1.0 ) / ( t * t );
+      a11 += N * k * k * ( k-1.0 ) / ( t * t );
+    }
+
+    g0 -= stats[0];// k = 0 term
+
+    double dmu = 0, dlam = 0;
+    if( !Solve2( a00, a01, a11, g0, g1, dmu, dlam,
+                 _fixed[kMean], _fixed[kLambda] ) ){
+      Solve2( a00, a01, a11, g0, g1, dmu, dlam, _fixed[kMean], true );
+    }
+
+    // Halving the step until the parameters are physical and Q increases.
+    const double q0   = Q( mu, lam );
+    double       step = 1;
+    double       nmu  = mu, nlam = lam;
+
+    for( unsigned i = 0; i < 30; ++i, step /= 2 ){
+      nmu  = mu+step * dmu;
+      nlam = std::min( std::max( lam+step * dlam, 0.0 ), 0.95 );
+      if( nmu > 0 && Q( nmu, nlam ) >= q0 ){ break; }
+      nmu  = mu;
+      nlam = lam;
+    }
+
+    const bool done = std::fabs( nmu-mu ) <= 1e-10 * mu
+                      && std::fabs( nlam-lam ) <= 1e-10;
+    mu  = nmu;
+    lam = nlam;
+    if( done ){ break; }
+  }
+
+  _par[kMean]   = mu;
+  _par[kLambda] = lam;
+}
+
+
+/**
+ * Uncertainties from the inverse of the finite difference Hessian of the log
+ * likelihood with respect to the free parameters. Parameters sitting at a
+ * physical boundary are treated as fixed.
+ */
+void
+SiPMGaussMixFit::compute_errors()
+{
+  std::vector<unsigned> free;
+  std::vector<double>   step;
+
+  for( unsigned i = 0; i < kNParam; ++i ){
+    const double h = i <= kS1 ? 1e-3 * _par[kS0] : 1e-4;
+    const bool   bound = ( i == kS1 || i == kLambda ) && _par[i] <= 2 * h;
+    if( _fixed[i] || bound ){ continue; }
+    free.push_back( i );
+    step.push_back( h );
+  }
+
+  const size_t m = free.size();
+
+  auto L = [this, &free, &step]( const int i, const int si,
+                                 const int j, const int sj ){
+             std::array<double, kNParam> p = _par;
+             if( i >= 0 ){ p[free[i]] += si * step[i]; }
+             if( j >= 0 ){ p[free[j]] += sj * step[j]; }
+             return run_estep( make_peaks( p ), nullptr );
+           };
+
+  // Negative Hessian, augmented with the identity for the inversion.
+  std::vector<std::vector<double> > A( m, std::vector<double>( 2 * m, 0.0 ) );
+  const double                      L0 = L( -1, 0, -1, 0 );
+
+  for( size_t i = 0; i < m; ++i ){
+    A[i][m+i] = 1;
+    A[i][i]   = -( L( i, 1, -1, 0 )-2 * L0+L( i, -1, -1, 0 ) )
+                / ( step[i] * step[i] );
+
+    for( size_t j = 0; j < i; ++j ){
+      A[i][j] = -( L( i, 1, j, 1 )-L( i, 1, j, -1 )
+                   -L( i, -1, j, 1 )+L( i, -1, j, -1 ) )
+                / ( 4 * step[i] * step[j] );
+      A[j][i] = A[i][j];
+    }
+  }
+
+  // Gauss-Jordan elimination, the Hessian should be positive definite so no
+  // pivoting is needed.
+  for( size_t i = 0; i < m; ++i ){
+    const double piv = A[i][i];
+    if( !( piv > 0 ) ){ return; }
+
+    for( auto& x : A[i] ){
+      x /= piv;
+    }
+
+    for( size_t r = 0; r < m; ++r ){
+      if( r == i ){ continue; }
+      const double f = A[r][i];
+
+      for( size_t c = 0; c < 2 * m; ++c ){
+        A[r][c] -= f * A[i][c];
+      }
+    }
+  }
+
+  for( size_t i = 0; i < m; ++i ){
+    _err[free[i]] = A[i][m+i] > 0 ? std::sqrt( A[i][m+i] ) : 0;
+  }
+}
@@ -0,0 +1,312 @@
+#include "SiPMCalib/Common/interface/ProcessPool.hpp"
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightBatch.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
+
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+
+/**
+ * @class SiPMLowLightBatch
+ * @ingroup SiPMCalc
+ * @brief Batch fitting of many low light spectra with similar configurations.
+ *
+ * @details The inputs are listed in a manifest file, one input per line, with
+ * the input file name optionally followed by command line style options
+ * overriding the common settings for that file only, for example:
+ *
+ * ```
+ * # input           overrides
+ * tile/ch00.txt
+ * tile/ch01.txt     --gain 100 150 --binwidth 8
+ * ```
+ *
+ * Empty lines and everything after a `#` are ignored, and the options values
+ * cannot contain spaces. The settings of each fit are applied in the order:
+ * configuration file, common settings (typically the command line), then the
+ * per-file overrides. The manifest and all options are parsed on the calling
+ * thread when the instance is created, so that invalid manifests are reported
+ * before any fit is started.
+ *
+ * Each input runs the full MakeBinnedData(), RunPDFEstimation() and RunFit()
+ * sequence on its own SiPMLowLightFit instance. The minimizer and fit result
+ * creation of RooFit go through global state that is not thread safe, so
+ * rather than sharing a process, each fit runs in a worker process forked from
+ * the batch process with a ProcessPool. The libraries and settings are already
+ * loaded in the forked process, so the ROOT startup cost is only paid once, and
+ * a new fit is started as soon as any fit finishes, as the fit time can vary
+ * greatly between inputs. The fit parameters are sent back to the batch
+ * process once the fit is done. The likelihood of each fit can still be
+ * evaluated on multiple threads with the nthreads option. A failure, a crash
+ * or a non-converged fit of a single input is reported in the output table
+ * instead of stopping the batch. The stage profiles of the fits running in the
+ * worker processes are not included in the profiler output, except when
+ * running with a single job, where the fits run directly in the batch process.
+ */
+
+const std::vector<std::string> SiPMLowLightBatch::parameter_names = {
+  "ped", "gain", "s0", "s1", "mean", "lambda", "alpha", "beta", "dcfrac",
+  "epsilon"
+};
+
+/**
+ * @brief Options that can be overridden per input file.
+ */
+static usr::po::options_description
+OverrideArguments()
+{
+  usr::po::options_description desc( "Per-file override options" );
+  desc.add_options()
+    ( "input", usr::po::value<std::string>(), "Input data file" )
+  ;
+  desc.add( SiPMLowLightFit::DataArguments( false ) );
+  desc.add( SiPMLowLightFit::FitArguments() );
+  desc.add( SiPMLowLightFit::OperationArguments() );
+  desc.add( SiPMLowLightFit::EstArguments() );
+  return desc;
+}
+
+
+SiPMLowLightBatch::SiPMLowLightBatch( const std::string& manifest ) :
+  _common( nullptr ),
+  _njobs ( 1 )
+{
+  std::ifstream fin( manifest );
+  if( !fin.is_open() ){
+    throw std::runtime_error( "Cannot open manifest file " + manifest );
+  }
+
+  std::string line;
+
+  while( std::getline( fin, line ) ){
+    line = line.substr( 0, line.find( '#' ) );
+
+    std::istringstream       sin( line );
+    std::vector<std::string> tokens;
+    std::string              token;
+
+    while( sin >> token ){
+      tokens.push_back( token );
+    }
+
+    if( tokens.empty() ){ continue; }
+
+    // Parsing as a command line: program name, input file and overrides.
+    tokens.insert( tokens.begin()+1, "--input" );
+    tokens.insert( tokens.begin(), manifest );
+    std::vector<char*> argv;
+
+    for( auto& t : tokens ){
+      argv.push_back( &t[0] );
+    }
+
+    Task task;
+    task.input   = tokens[2];
+    task.success = false;
+    task.time    = 0;
+    task.args.reset( new usr::ArgumentExtender() );
+    task.args->AddOptions( OverrideArguments() );
+    task.args->ParseOptions( argv.size(), argv.data() );
+    _tasks.push_back( std::move( task ) );
+  }
+}
+
+
+usr::po::options_description
+SiPMLowLightBatch::BatchArguments()
+{
+  usr::po::options_description desc( "Options for batch fitting" );
+  desc.add_options()
+    ( "manifest",
+    usr::po::reqvalue<std::string>(),
+    "File listing the input files, one per line, each optionally followed by "
+    "options overriding the common settings for that file" )
+    ( "njobs",
+    usr::po::value<unsigned>(),
+    "Number of fits running concurrently in worker processes (0 for all "
+    "cores). Use the nthreads option to also evaluate the likelihood of each "
+    "fit on multiple threads" )
+  ;
+  return desc;
+}
+
+
+/**
+ * @brief Configuration file applied to all fits before the common settings.
+ */
+void
+SiPMLowLightBatch::SetConfig( const std::string& config )
+{
+  _config.reset( new usr::ArgumentExtender() );
+  _config->AddOptions( SiPMLowLightFit::DataArguments( false ) );
+  _config->AddOptions( SiPMLowLightFit::FitArguments() );
+  _config->ParseFile( config );
+}
+
+
+/**
+ * @brief Settings common to all fits, the arguments must stay valid until Run()
+ * is called.
+ */
+void
+SiPMLowLightBatch::UpdateSettings( const usr::ArgumentExtender& args )
+{
+  _common = &args;
+  _njobs  = args.ArgOpt<unsigned>( "njobs", _njobs );
+}
+
+
+void
+SiPMLowLightBatch::Run()
+{
+  ProcessPool pool( _njobs );
+  pool.ParallelTasks( _tasks.size(), [this]( const size_t i ){
+    return run_task( _tasks[i] );
+  }, [this]( const size_t i, const bool success, const std::string& output ){
+    read_result( _tasks[i], success, output );
+  } );
+}
+
+
+/**
+ * @brief Running the fit of a single input. The results are returned as the
+ * success flag, fit time and the value and uncertainty of each fit parameter
+ * as raw doubles, followed by the error message, so that they can be passed
+ * back from the worker process.
+ */
+std::string
+SiPMLowLightBatch::run_task( const Task& task ) const
+{
+  SIPMCALIB_PROFILE( "SiPMLowLightBatch::Task" );
+
+  const auto          start = std::chrono::steady_clock::now();
+  const double        nan   = std::numeric_limits<double>::quiet_NaN();
+  std::vector<double> result( 2+2 * parameter_names.size(), nan );
+  std::string         error;
+
+  result[0] = 0;
+
+  try {
+    SiPMLowLightFit fit;
+    if( _config ){ fit.UpdateSettings( *_config ); }
+    if( _common ){ fit.UpdateSettings( *_common ); }
+    fit.UpdateSettings( *task.args );
+    fit.MakeBinnedData();
+    fit.RunPDFEstimation();
+    fit.RunFit();
+
+    const std::vector<const RooRealVar*> vars = {
+      &fit.ped(), &fit.gain(), &fit.s0(), &fit.s1(), &fit.mean(),
+      &fit.lambda(), &fit.alpha(), &fit.beta(), &fit.dcfrac(), &fit.eps()
+    };
+
+    for( unsigned i = 0; i < vars.size(); ++i ){
+      result[2+2*i] = vars[i]->getVal();
+      result[3+2*i] = vars[i]->getError();
+    }
+
+    result[0] = fit.Converged();
+    if( !result[0] ){
+      error = "fit did not converge";
+      usr::log::PrintLog( usr::log::WARNING,
+                          "Fit of " + task.input + " did not converge" );
+    }
+  } catch( std::exception& e ){
+    error = e.what();
+    usr::log::PrintLog( usr::log::WARNING,
+                        "Fit of " + task.input + " failed: " + e.what() );
+  }
+
+  result[1] = std::chrono::duration<double>(
+    std::chrono::steady_clock::now()-start ).count();
+
+  return std::string( reinterpret_cast<const char*>( result.data() ),
+                      result.size() * sizeof( double ) ) + error;
+}
+
+
+/**
+ * @brief Storing the output of run_task() in the task entry. A worker process
+ * that did not exit normally is reported as a failed fit.
+ */
+void
+SiPMLowLightBatch::read_result( Task&              task,
+                                const bool         success,
+                                const std::string& output )
+{
+  const size_t        nres = 2+2 * parameter_names.size();
+  std::vector<double> result( nres );
+
+  if( !success || output.size() < nres * sizeof( double ) ){
+    task.success = false;
+    task.error   = "worker process failed";
+    usr::log::PrintLog( usr::log::WARNING,
+                        "Worker process of " + task.input + " failed" );
+    return;
+  }
+
+  std::memcpy( result.data(), output.data(), nres * sizeof( double ) );
+  task.success = result[0];
+  task.time    = result[1];
+  task.error   = output.substr( nres * sizeof( double ) );
+  task.result.clear();
+
+  for( unsigned i = 0; i < parameter_names.size(); ++i ){
+    task.result.emplace_back( result[2+2*i], result[3+2*i] );
+  }
+}
+
+
+unsigned
+SiPMLowLightBatch::NFailed() const
+{
+  unsigned ans = 0;
+
+  for( const auto& task : _tasks ){
+    if( !task.success ){ ++ans; }
+  }
+
+  return ans;
+}
+
+
+/**
+ * @brief One line per input in the manifest order: input file, status, fit time
+ * in seconds, then the value and uncertainty of each fit parameter (nan for
+ * failed fits).
+ */
+void
+SiPMLowLightBatch::PrintTable( std::ostream& sout ) const
+{
+  sout << usr::fstr( "#%-39s %8s %9s", "input", "status", "time" );
+
+  for( const auto& name : parameter_names ){
+    sout << usr::fstr( " %12s %12s", name, name+"_err" );
+  }
+
+  sout << "\n";
+
+  const double nan = std::numeric_limits<double>::quiet_NaN();
+
+  for( const auto& task : _tasks ){
+    sout << usr::fstr( "%-40s %8s %9.2lf",
+                       task.input,
+                       task.success ? "ok" : "failed",
+                       task.time );
+
+    for( unsigned i = 0; i < parameter_names.size(); ++i ){
+      const bool has = task.success && i < task.result.size();
+      sout << usr::fstr( " %12.5lf %12.5lf",
+                         has ? task.result[i].first : nan,
+                         has ? task.result[i].second : nan );
+    }
+
+    sout << "\n";
+  }
+}
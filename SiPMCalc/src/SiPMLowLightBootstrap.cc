@@ -0,0 +1,231 @@
+#include "SiPMCalib/Common/interface/ProcessPool.hpp"
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightBootstrap.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
+
+#include "UserUtils/Common/interface/Maths.hpp"
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+
+/**
+ * @class SiPMLowLightBootstrap
+ * @ingroup SiPMCalc
+ * @brief Bootstrap uncertainties of the parameters and derived observables of
+ * a fitted SiPMLowLightFit instance.
+ *
+ * @details The error propagation of the derived observables (crosstalk
+ * probability, excess noise factor, mean photons from the pedestal fraction)
+ * uses simple approximations that ignore the correlations between the fit
+ * parameters. The bootstrap instead resamples the area list of the nominal
+ * fit with replacement, refits each replica, and reports the percentile
+ * interval of each observable over the replicas.
+ *
+ * Each replica is a separate SiPMLowLightFit instance with the settings and
+ * binning of the nominal instance, starting from the nominal fit result, so
+ * the replica fits typically converge in a few iterations. The replicas run in
+ * worker processes forked with a ProcessPool, in the same way as the fits of
+ * SiPMLowLightBatch, as the RooFit minimization cannot run concurrently within
+ * a process. The observables of each replica are sent back to the main
+ * process, and a replica that fails, does not converge or crashes is excluded
+ * from the intervals. The random numbers of replica i are generated by a
+ * std::mt19937_64 seeded with (seed, i) only, and the results are stored by
+ * replica index, so the output is identical for a given seed regardless of the
+ * number of jobs and the scheduling of the replicas.
+ */
+
+const std::vector<std::string> SiPMLowLightBootstrap::observable_names = {
+  "ped", "gain", "s0", "s1", "mean", "lambda", "alpha", "beta", "dcfrac",
+  "epsilon", "Pct", "tau_ap", "tau_dc", "ENF", "mfrac", "ENFfrac"
+};
+
+SiPMLowLightBootstrap::SiPMLowLightBootstrap( const SiPMLowLightFit& nominal ) :
+  _nominal    ( nominal ),
+  _nominal_obs( observables( nominal ) ),
+  _nreplica   ( 100 ),
+  _njobs      ( 1 ),
+  _seed       ( 0 ),
+  _cl         ( 0.6827 )
+{}
+
+
+usr::po::options_description
+SiPMLowLightBootstrap::BootstrapArguments()
+{
+  usr::po::options_description desc( "Options for the bootstrap uncertainties" );
+  desc.add_options()
+    ( "bootstrap",
+    usr::po::value<unsigned>(),
+    "Number of bootstrap replicas, the bootstrap is not run if not set" )
+    ( "bootseed",
+    usr::po::value<unsigned>(),
+    "Random seed of the bootstrap resampling" )
+    ( "bootjobs",
+    usr::po::value<unsigned>(),
+    "Number of bootstrap replicas fitted concurrently in worker processes (0 "
+    "for all cores)" )
+    ( "bootcl",
+    usr::po::value<double>(),
+    "Confidence level of the central percentile intervals" )
+  ;
+  return desc;
+}
+
+
+void
+SiPMLowLightBootstrap::UpdateSettings( const usr::ArgumentExtender& args )
+{
+  _nreplica = args.ArgOpt<unsigned>( "bootstrap", _nreplica );
+  _seed     = args.ArgOpt<unsigned>( "bootseed", _seed );
+  _njobs    = args.ArgOpt<unsigned>( "bootjobs", _njobs );
+  _cl       = args.ArgOpt<double>( "bootcl", _cl );
+}
+
+
+std::vector<double>
+SiPMLowLightBootstrap::observables( const SiPMLowLightFit& fit )
+{
+  return {
+    fit.ped().getVal(), fit.gain().getVal(), fit.s0().getVal(),
+    fit.s1().getVal(), fit.mean().getVal(), fit.lambda().getVal(),
+    fit.alpha().getVal(), fit.beta().getVal(), fit.dcfrac().getVal(),
+    fit.eps().getVal(),
+    fit.ProbCrosstalk().CentralValue(),
+    fit.AfterpulseTimeNS().CentralValue(),
+    fit.DarkcurrentTimeNS().CentralValue(),
+    fit.ExcessNoiseFactor( fit.MeanPhotons() ).CentralValue(),
+    fit.MeanPhotonsFromFrac().CentralValue(),
+    fit.ExcessNoiseFactor( fit.MeanPhotonsFromFrac() ).CentralValue()
+  };
+}
+
+
+void
+SiPMLowLightBootstrap::Run()
+{
+  const size_t nobs = observable_names.size();
+  _replicas.assign( _nreplica, std::vector<double>() );
+
+  ProcessPool pool( _njobs );
+  pool.ParallelTasks( _nreplica, [this]( const size_t i ){
+    return run_replica( i );
+  }, [this, nobs]( const size_t i, const bool success, const std::string& out ){
+    if( success && out.size() == nobs * sizeof( double ) ){
+      _replicas[i].resize( nobs );
+      std::memcpy( _replicas[i].data(), out.data(), out.size() );
+    }
+  } );
+}
+
+
+/**
+ * @brief Resampling and fitting replica of the given index. The observables
+ * are returned as raw doubles so that they can be passed back from the worker
+ * process, the output is empty if the replica fit failed.
+ */
+std::string
+SiPMLowLightBootstrap::run_replica( const size_t index ) const
+{
+  SIPMCALIB_PROFILE( "SiPMLowLightBootstrap::Replica" );
+
+  const std::vector<double>& nominal = _nominal._arealist;
+
+  std::seed_seq       seq = { _seed, (unsigned)index };
+  std::mt19937_64     rng( seq );
+  std::vector<double> arealist( nominal.size() );
+
+  // Drawing the indices directly rather than through a distribution object,
+  // whose algorithm is implementation defined. The modulo bias is negligible
+  // for 64 bit random numbers.
+  for( auto& a : arealist ){
+    a = nominal[rng() % nominal.size()];
+  }
+
+  try {
+    SiPMLowLightFit fit( _nominal, arealist );
+    fit.RunFit();
+    if( fit.Converged() ){
+      const std::vector<double> obs = observables( fit );
+      return std::string( reinterpret_cast<const char*>( obs.data() ),
+                          obs.size() * sizeof( double ) );
+    }
+  } catch( std::exception& e ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        usr::fstr( "Bootstrap replica %u failed: %s",
+                                   (unsigned)index, e.what() ) );
+  }
+
+  return "";
+}
+
+
+unsigned
+SiPMLowLightBootstrap::NFailed() const
+{
+  return std::count_if( _replicas.begin(), _replicas.end(),
+                        []( const std::vector<double>& x ){
+    return x.empty();
+  } );
+}
+
+
+/**
+ * @brief Quantile q of an observable over the successful replicas, linearly
+ * interpolated between the sorted values. Returns NaN if no replica succeeded.
+ */
+double
+SiPMLowLightBootstrap::Percentile( const unsigned obs, const double q ) const
+{
+  std::vector<double> val;
+
+  for( const auto& rep : _replicas ){
+    if( !rep.empty() ){ val.push_back( rep[obs] ); }
+  }
+
+  if( val.empty() ){
+    return std::numeric_limits<double>::quiet_NaN();
+  }
+
+  std::sort( val.begin(), val.end() );
+  const double   pos = std::min( std::max( q, 0.0 ), 1.0 ) * ( val.size()-1 );
+  const unsigned lo  = std::floor( pos );
+  const unsigned hi  = std::min<unsigned>( lo+1, val.size()-1 );
+  return val[lo]+( pos-lo ) * ( val[hi]-val[lo] );
+}
+
+
+/**
+ * @brief One line per observable: nominal value, the bootstrap median and
+ * standard deviation, and the lower and upper edges of the central percentile
+ * interval.
+ */
+void
+SiPMLowLightBootstrap::PrintTable( std::ostream& sout ) const
+{
+  sout << usr::fstr( "# Bootstrap with %u replicas (%u failed), seed %u, "
+                     "%.2lf%% intervals\n",
+                     NReplicas(), NFailed(), _seed, _cl * 100 );
+  sout << usr::fstr( "#%9s %12s %12s %12s %12s %12s\n",
+                     "name", "nominal", "median", "stddev", "lower", "upper" );
+
+  for( unsigned i = 0; i < observable_names.size(); ++i ){
+    std::vector<double> val;
+
+    for( const auto& rep : _replicas ){
+      if( !rep.empty() ){ val.push_back( rep[i] ); }
+    }
+
+    sout << usr::fstr( "%10s %12.5lf %12.5lf %12.5lf %12.5lf %12.5lf\n",
+                       observable_names[i],
+                       _nominal_obs[i],
+                       Percentile( i, 0.5 ),
+                       val.size() > 1 ? usr::StdDev( val ) :
+                       std::numeric_limits<double>::quiet_NaN(),
+                       Percentile( i, ( 1-_cl ) / 2 ),
+                       Percentile( i, ( 1+_cl ) / 2 ) );
+  }
+}
@@ -1,5 +1,8 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/Common/interface/StdFormat.hpp"
 #include "SiPMCalib/Common/interface/WaveFormat.hpp"
+#include "SiPMCalib/SiPMCalc/interface/PdfCounters.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMBinnedNLL.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
 
 #include "UserUtils/Common/interface/Maths.hpp"
@@ -9,6 +12,8 @@
 #include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <cmath>
+#include <limits>
 
 #include "RooDataHist.h"
 
@@ -36,6 +41,16 @@ SiPMLowLightFit::set_all_defaults()
   _pedrms    = 0.5;
   _maxarea   = 2147483647;
 
+  // Fit running options
+  _nthreads    = 1;
+  _isolated    = false;
+  _mixtureonly = false;
+
+  // Parameter store key, unknown by default
+  _storekey.detid = "";
+  _storekey.bias  = std::numeric_limits<double>::quiet_NaN();
+  _storekey.temp  = std::numeric_limits<double>::quiet_NaN();
+
   // Fitting related options
   const double min = std::numeric_limits<double>::min();
 
@@ -65,19 +80,7 @@ SiPMLowLightFit::set_all_defaults()
   _eps =
     std::make_unique<RooRealVar>(     "eps",     "eps", 1e-5,     1e-1 );
 
-  _pdf = std::make_unique<SiPMPdf>( "pdf",
-                                    "pdf",
-                                    *_x,
-                                    *_ped,
-                                    *_gain,
-                                    *_s0,
-                                    *_s1,
-                                    *_mean,
-                                    *_lambda,
-                                    *_alpha,
-                                    *_beta,
-                                    *_dcfrac,
-                                    *_eps );
+  make_pdf();
 
   // Estimation options
   ignore_ped_est     = false;
@@ -86,7 +89,14 @@ SiPMLowLightFit::set_all_defaults()
   ignore_s1_est      = false;
   ignore_mean_est    = false;
   ignore_lambda_est  = false;
+  ignore_alpha_est   = false;
+  ignore_beta_est    = false;
+  ignore_dcfrac_est  = false;
+  ignore_eps_est     = false;
   _est_minpeak       = 0.05;
+  _est_method        = "tspectrum";
+  _est_success       = false;
+  _est_em            = false;
   _est_gausswindow   = 3;
   _est_maxgausswidth = 6;
 
@@ -99,6 +109,61 @@ SiPMLowLightFit::set_all_defaults()
 }
 
 
+/**
+ * @brief (Re)creating the PDF from the current parameter objects, keeping the
+ * evaluation settings of the previous PDF if there is one.
+ */
+void
+SiPMLowLightFit::make_pdf()
+{
+  std::unique_ptr<SiPMPdf> pdf = std::make_unique<SiPMPdf>( "pdf",
+                                                            "pdf",
+                                                            *_x,
+                                                            *_ped,
+                                                            *_gain,
+                                                            *_s0,
+                                                            *_s1,
+                                                            *_mean,
+                                                            *_lambda,
+                                                            *_alpha,
+                                                            *_beta,
+                                                            *_dcfrac,
+                                                            *_eps );
+  if( _pdf ){
+    pdf->SetEvalMode( _pdf->GetEvalMode() );
+    pdf->SetDarkMode( _pdf->GetDarkMode() );
+  }
+  _pdf = std::move( pdf );
+}
+
+
+/**
+ * @brief Replacing all parameters except the observable and the mean number of
+ * photons with those of another instance, so that the PDFs of both instances
+ * depend on the same detector parameter objects.
+ */
+void
+SiPMLowLightFit::share_parameters( const SiPMLowLightFit& other )
+{
+  // The replaced parameters are kept alive until the PDF depending on them is
+  // replaced.
+  const std::vector<std::shared_ptr<RooRealVar> > prev = {
+    _ped, _gain, _s0, _s1, _lambda, _alpha, _beta, _dcfrac, _eps
+  };
+
+  _ped    = other._ped;
+  _gain   = other._gain;
+  _s0     = other._s0;
+  _s1     = other._s1;
+  _lambda = other._lambda;
+  _alpha  = other._alpha;
+  _beta   = other._beta;
+  _dcfrac = other._dcfrac;
+  _eps    = other._eps;
+  make_pdf();
+}
+
+
 SiPMLowLightFit::SiPMLowLightFit()
 {
   set_all_defaults();
@@ -118,16 +183,74 @@ SiPMLowLightFit::SiPMLowLightFit( const std::string& config )
 }
 
 
+/**
+ * @brief Replica of a fitted instance with a different area list, used for
+ * the bootstrap resampling. The settings, binning and evaluation modes are
+ * those of the nominal instance, and the parameters start from the nominal
+ * values (including the fixed state and range). The replica always fits in
+ * isolation with a single thread.
+ */
+SiPMLowLightFit::SiPMLowLightFit( const SiPMLowLightFit&     nominal,
+                                  const std::vector<double>& arealist )
+{
+  set_all_defaults();
+  _inputfile = nominal._inputfile;
+  _binwidth  = nominal._binwidth;
+  _maxarea   = nominal._maxarea;
+  _intwindow = nominal._intwindow;
+  _sipmtime  = nominal._sipmtime;
+  _sipmtype  = nominal._sipmtype;
+  _lumitype  = nominal._lumitype;
+  _biasv     = nominal._biasv;
+  _nthreads  = 1;
+  _isolated  = true;
+
+  auto copy = []( RooRealVar& to, const RooRealVar& from ){
+                to.setRange( from.getMin(), from.getMax() );
+                to = from.getVal();
+                to.setError( from.getError() );
+                to.setConstant( from.isConstant() );
+              };
+
+  copy( *_ped,    nominal.ped() );
+  copy( *_gain,   nominal.gain() );
+  copy( *_s0,     nominal.s0() );
+  copy( *_s1,     nominal.s1() );
+  copy( *_mean,   nominal.mean() );
+  copy( *_lambda, nominal.lambda() );
+  copy( *_alpha,  nominal.alpha() );
+  copy( *_beta,   nominal.beta() );
+  copy( *_dcfrac, nominal.dcfrac() );
+  copy( *_eps,    nominal.eps() );
+  _pdf->SetEvalMode( nominal._pdf->GetEvalMode() );
+  _pdf->SetDarkMode( nominal._pdf->GetDarkMode() );
+
+  x().setRange( nominal.x().getMin(), nominal.x().getMax() );
+  x().setBins( nominal.x().getBins() );
+  _arealist = arealist;
+  std::sort( _arealist.begin(), _arealist.end() );
+  fill_data();
+}
+
+
 usr::po::options_description
-SiPMLowLightFit::DataArguments()
+SiPMLowLightFit::DataArguments( const bool reqinput )
 {
   usr::po::options_description desc(
     "Options for parsing the data file for low-light SiPM spectrum model" );
+  if( reqinput ){
+    desc.add_options()
+      ( "input", usr::po::reqvalue<std::string>(), "Input data file" )
+      ( "waveform",
+      usr::po::reqvalue<bool>(),
+      "Whether in input data is a raw waveform (True) are integrated (False)" );
+  } else {
+    desc.add_options()
+      ( "waveform",
+      usr::po::value<bool>(),
+      "Whether in input data is a raw waveform (True) are integrated (False)" );
+  }
   desc.add_options()
-    ( "input", usr::po::reqvalue<std::string>(), "Input data file" )
-    ( "waveform",
-    usr::po::reqvalue<bool>(),
-    "Whether in input data is a raw waveform (True) are integrated (False)" )
     ( "binwidth",
     usr::po::value<double>(),
     "The bin width to use for binned data" )
@@ -183,6 +306,30 @@ SiPMLowLightFit::FitArguments()
     ( "epsilon",
     usr::po::multivalue<double>(),
     "Resolution factor to be used for the dark current curve" )
+    ( "nthreads",
+    usr::po::value<unsigned>(),
+    "Number of threads used for the likelihood evaluation (0 for all cores)" )
+    ( "darkmode",
+    usr::po::value<std::string>(),
+    "Evaluation method of the dark current shape: \"fft\" (grid convolution, "
+    "tens of ms per parameter point then ~10 ns per evaluation) or \"quad\" "
+    "(Gauss-Legendre quadrature, ~10 us per parameter point but a few hundred "
+    "ns per evaluation, only faster if the parameters change more often than "
+    "every ~100k evaluations)" )
+    ( "paramstore",
+    usr::po::value<std::string>(),
+    "Parameter store file, the fit starts from the stored result nearest to "
+    "the detid/biasvolt/temperature options if there is one, and the fit "
+    "result is added to the store" )
+    ( "detid",
+    usr::po::value<std::string>(),
+    "Detector id used as the parameter store key" )
+    ( "biasvolt",
+    usr::po::value<double>(),
+    "Bias voltage used as the parameter store key (units: V)" )
+    ( "temperature",
+    usr::po::value<double>(),
+    "Temperature used as the parameter store key (units: C)" )
   ;
 
   return desc;
@@ -235,6 +382,15 @@ SiPMLowLightFit::EstArguments()
     ( "estmaxgausswidth",
     usr::po::value<int>(),
     "Maximum number of bins that the gaussian width can be before it is discarded as a primary peak candidate" )
+    ( "estmethod",
+    usr::po::value<std::string>(),
+    "Estimation method: \"tspectrum\" (peak search and Gaussian fits) or "
+    "\"moment\" (histogram moments, much faster, falls back to tspectrum if "
+    "the peak structure is not clear enough)" )
+    ( "estem",
+    usr::po::value<bool>(),
+    "Refine the estimation with the Gaussian mixture EM fit before the full "
+    "fit" )
   ;
   return desc;
 }
@@ -292,7 +448,31 @@ SiPMLowLightFit::UpdateSettings( const usr::ArgumentExtender& args )
   update_arg( *_dcfrac, "dcfrac"  );
   update_arg( *_eps,    "epsilon" );
 
-  // Option parsing for estimation related variables
+  _nthreads = args.ArgOpt<unsigned>( "nthreads", _nthreads );
+
+  if( args.CheckArg( "darkmode" ) ){
+    const std::string mode = args.Arg<std::string>( "darkmode" );
+    if( mode == "fft" ){
+      _pdf->SetDarkMode( MDistro::kFFT );
+    } else if( mode == "quad" ){
+      _pdf->SetDarkMode( MDistro::kQuadrature );
+    } else {
+      usr::log::PrintLog( usr::log::WARNING,
+                          "Unknown darkmode \""+mode+"\", keeping the "
+                          "current dark current evaluation method" );
+    }
+  }
+
+  if( args.CheckArg( "paramstore" ) ){
+    _store = SiPMParamStore::Open( args.Arg<std::string>( "paramstore" ) );
+  }
+  _storekey.detid = args.ArgOpt<std::string>( "detid", _storekey.detid );
+  _storekey.bias  = args.ArgOpt<double>( "biasvolt",    _storekey.bias );
+  _storekey.temp  = args.ArgOpt<double>( "temperature", _storekey.temp );
+
+  // Option parsing for estimation related variables. Variables not given in
+  // the arguments keep the status of the previous settings, so that settings
+  // can be layered (configuration file, then command line options).
   auto lock = [&args]( bool& ignore, const std::string& var ){
                 if( args.CheckArg( var ) ){
                   const auto vec = args.ArgList<double>( var );
@@ -301,8 +481,6 @@ SiPMLowLightFit::UpdateSettings( const usr::ArgumentExtender& args )
                   } else {
                     ignore = false;
                   }
-                } else {
-                  ignore = false;
                 }
               };
 
@@ -312,12 +490,18 @@ SiPMLowLightFit::UpdateSettings( const usr::ArgumentExtender& args )
   lock( ignore_s1_est,     "s1"     );
   lock( ignore_mean_est,   "mean"   );
   lock( ignore_lambda_est, "lambda" );
+  lock( ignore_alpha_est,  "alpha"  );
+  lock( ignore_beta_est,   "beta"   );
+  lock( ignore_dcfrac_est, "dcfrac" );
+  lock( ignore_eps_est,    "epsilon" );
 
   _est_minpeak     = args.ArgOpt<double>( "estminpeak", _est_minpeak       );
   _est_gausswindow =
     args.ArgOpt<double>( "estgausswindow", _est_gausswindow   );
   _est_maxgausswidth = args.ArgOpt<double>( "estmaxgausswidth",
                                             _est_maxgausswidth );
+  _est_method = args.ArgOpt<std::string>( "estmethod", _est_method );
+  _est_em     = args.ArgOpt<bool>( "estem", _est_em );
 
   // Operation parameters related variables
   _intwindow = args.ArgOpt<double>( "intwindow", _intwindow );
@@ -333,6 +517,8 @@ SiPMLowLightFit::UpdateSettings( const usr::ArgumentExtender& args )
 void
 SiPMLowLightFit::MakeBinnedData()
 {
+  SIPMCALIB_PROFILE( "SiPMLowLightFit::MakeBinnedData" );
+
   if( _waveform ){
     make_array_from_waveform();
   } else {
@@ -351,7 +537,18 @@ SiPMLowLightFit::MakeBinnedData()
 
   x().setRange( xmin, xmax );
   x().setBins( nbins );
+  fill_data();
+}
 
+
+/**
+ * @brief Filling the binned data set from the area list in the current binning
+ * of the observable.
+ */
+void
+SiPMLowLightFit::fill_data()
+{
+  const double xmax = x().getMax();
   _data.reset( new RooDataHist( "data", "data", RooArgList( x() ) ) );
 
   for( const auto a : _arealist ){
@@ -402,9 +599,49 @@ SiPMLowLightFit::make_array_from_sum()
 void
 SiPMLowLightFit::RunFit()
 {
-  usr::ConvergeFitPDFToData( *_pdf, *_data, usr::MaxFitIteration( 3 ) );
+  SIPMCALIB_PROFILE( "SiPMLowLightFit::RunFit" );
+
+  const pdfcount::Snapshot count0 = pdfcount::Take();
+  _mixtureonly = false;
+
+  // Limiting to 3 iterations to save runtime.
+  if( _nthreads == 1 && !_isolated ){
+    usr::ConvergeFitPDFToData( *_pdf, *_data, usr::MaxFitIteration( 3 ) );
+  } else {
+    SiPMBinnedNLL nll( "nll", "nll",
+                       *_pdf, x(),
+                       dynamic_cast<const RooDataHist&>( *_data ),
+                       _nthreads );
+    ConvergeNLLMinimizer( nll, 3 );
+  }
+
+  // Only printed in the verbose output. The counters are process-wide, so
+  // they are skipped for the isolated fits that may run concurrently.
+  if( pdfcount::Enabled() && !_isolated ){
+    usr::log::PrintLog( usr::log::DEBUG,
+                        "PDF evaluation counters of the fit:\n"
+                        +pdfcount::Summary( count0, pdfcount::Take() ) );
+  }
+
+  if( _store ){
+    save_to_store();
+  }
+}
+
+
+bool
+SiPMLowLightFit::Converged() const
+{
+  for( const RooRealVar* var : { &ped(), &gain(), &s0(), &s1(), &mean(),
+                                 &lambda(), &alpha(), &beta(), &dcfrac(),
+                                 &eps() } ){
+    if( !var->isConstant()
+        && !( std::isfinite( var->getVal() ) && var->getError() > 0 ) ){
+      return false;
+    }
+  }
 
-  // Limiting to 3 to save runtime.
+  return true;
 }
 
 
@@ -1,6 +1,7 @@
 // ------------------------------------------------------------------------------
 // Functions for running variable estimation from data set.
 // ------------------------------------------------------------------------------
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
 
 #include "UserUtils/Common/interface/STLUtils/OStreamUtils.hpp"
@@ -8,6 +9,10 @@
 #include "UserUtils/MathUtils/interface/RooFitExt.hpp"
 #include "UserUtils/PlotUtils/interface/Simple1DCanvas.hpp"
 
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
 #include "TError.h"
 #include "TF1.h"
 #include "TGraphErrors.h"
@@ -18,7 +23,10 @@
 void
 SiPMLowLightFit::RunPDFEstimation()
 {
+  SIPMCALIB_PROFILE( "SiPMLowLightFit::RunPDFEstimation" );
+
   // Resetting the objects used for estimation
+  _est_success = false;
   _peakfits.clear();
   _gain_graph.reset( nullptr );
   _gain_fit.reset( nullptr );
@@ -27,6 +35,34 @@ SiPMLowLightFit::RunPDFEstimation()
   _height_graph.reset( nullptr );
   _height_fit.reset( nullptr );
 
+  _est_hist.reset( nullptr );
+  _spectrum.reset( nullptr );
+
+  if( _est_method == "moment" ){
+    _est_success = run_moment_est();
+  } else if( _est_method != "tspectrum" ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        "Unknown estmethod \""+_est_method+"\", using "
+                        "tspectrum" );
+  }
+
+  if( !_est_success ){
+    run_tspectrum_est();
+  }
+
+  if( _store ){
+    run_warm_start();
+  }
+
+  if( _est_em ){
+    RunMixtureFit();
+  }
+}
+
+
+void
+SiPMLowLightFit::run_tspectrum_est()
+{
   _est_hist.reset( usr::TH1DFromRooData( *_data, *_x ) );
   _spectrum.reset( new TSpectrum( 20 ) );// 20 peaks should be plenty
   _spectrum->Search( _est_hist.get(), 1, "nobackground" );
@@ -44,17 +80,104 @@ SiPMLowLightFit::RunPDFEstimation()
     return left->GetParameter( 1 ) < right->GetParameter( 1 );
   } );
 
-  // Early exit if peak finding failed to more than 1 peak.
+  // Skipping the estimation if peak finding failed to more than 1 peak.
   if( _peakfits.size() < 2 ){
     usr::log::PrintLog( usr::log::WARNING,
                         "Peak finder found less than two peaks! Results from the estimations " "routine will not be used. Check to see if data is behaving properly "
                         "running as expected" );
+  } else {
+    run_gain_est();
+    run_width_est();
+    run_height_est();
+    _est_success = true;
+  }
+}
+
+
+// Fit parameters in the order of SiPMParamStore::parameter_names
+static std::vector<RooRealVar*>
+StoreParams( SiPMLowLightFit& fit )
+{
+  return { &fit.ped(), &fit.gain(), &fit.s0(), &fit.s1(), &fit.mean(),
+           &fit.lambda(), &fit.alpha(), &fit.beta(), &fit.dcfrac(),
+           &fit.eps() };
+}
+
+
+/**
+ * @brief Overriding the estimated values with the parameter store entry
+ * nearest to the operating condition of the data. Parameters fixed or given a
+ * starting value by the user are not modified. The mean number of photons
+ * depends on the light source rather than on the detector, so the stored value
+ * is only used if the estimation from the data failed. Returns false if there
+ * is no suitable entry in the store.
+ */
+bool
+SiPMLowLightFit::run_warm_start()
+{
+  SiPMParamStore::Entry entry;
+
+  if( !_store->Find( _storekey, entry ) ){
+    usr::log::PrintLog( usr::log::INFO,
+                        "No nearby entry in the parameter store, using the "
+                        "estimated values" );
+    return false;
+  }
+
+  usr::log::PrintLog( usr::log::INFO,
+                      usr::fstr( "Starting from the parameter store entry "
+                                 "[%s, %lg V, %lg C] (distance %lg)",
+                                 entry.key.detid,
+                                 entry.key.bias,
+                                 entry.key.temp,
+                                 SiPMParamStore::Distance( _storekey,
+                                                           entry.key ) ) );
+
+  const std::vector<RooRealVar*> vars   = StoreParams( *this );
+  const std::vector<bool>        ignore = {
+    ignore_ped_est, ignore_gain_est, ignore_s0_est, ignore_s1_est,
+    ignore_mean_est || _est_success,
+    ignore_lambda_est, ignore_alpha_est, ignore_beta_est,
+    ignore_dcfrac_est, ignore_eps_est
+  };
+
+  for( unsigned i = 0; i < vars.size(); ++i ){
+    RooRealVar& var = *vars[i];
+    if( ignore[i] || var.isConstant() ){ continue; }
+    var = std::min( std::max( entry.values[i], var.getMin() ), var.getMax() );
+  }
+
+  return true;
+}
+
+
+/**
+ * @brief Adding the fit result to the parameter store if the fit converged.
+ */
+void
+SiPMLowLightFit::save_to_store()
+{
+  SiPMParamStore::Entry entry;
+  entry.key = _storekey;
+
+  if( !Converged() ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        "Fit did not converge properly, result is not added "
+                        "to the parameter store" );
     return;
   }
 
-  run_gain_est();
-  run_width_est();
-  run_height_est();
+  for( const auto var : StoreParams( *this ) ){
+    entry.values.push_back( var->getVal() );
+  }
+
+  _store->Insert( entry );
+
+  try {
+    _store->Save();
+  } catch( std::exception& e ){
+    usr::log::PrintLog( usr::log::WARNING, e.what() );
+  }
 }
 
 
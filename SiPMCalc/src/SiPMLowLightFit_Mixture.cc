@@ -0,0 +1,96 @@
+// ------------------------------------------------------------------------------
+// Quick fit of the low light spectrum with the Gaussian mixture model.
+// ------------------------------------------------------------------------------
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMGaussMixFit.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
+
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "RooDataHist.h"
+
+/**
+ * @brief Bin contents of the binned data set, in the binning of the x variable.
+ */
+std::vector<double>
+SiPMLowLightFit::binned_counts() const
+{
+  const RooDataHist&  data = dynamic_cast<const RooDataHist&>( *_data );
+  const double        xmin = x().getMin();
+  const double        bw   = x().getBinning().averageBinWidth();
+  std::vector<double> ans( x().getBins(), 0.0 );
+
+  for( int i = 0; i < data.numEntries(); ++i ){
+    const double xv  = data.get( i )->getRealValue( x().GetName() );
+    const int    bin = std::floor( ( xv-xmin ) / bw );
+    if( bin >= 0 && bin < (int)ans.size() ){
+      ans[bin] += data.weight();
+    }
+  }
+
+  return ans;
+}
+
+
+/**
+ * @brief Fitting the ped, gain, s0, s1, mean and lambda parameters with the
+ * Gaussian mixture model of SiPMGaussMixFit, starting from the current values.
+ *
+ * @details The afterpulse and dark current terms are ignored, so this is meant
+ * either as a fast first pass calibration, or as a refinement of the estimated
+ * starting values of the full fit (the `estem` option). Constant parameters are
+ * kept fixed, the fitted values are clamped to the parameter ranges, and the
+ * parameter errors are set to the uncertainties of the mixture fit. The
+ * parameters are left untouched if the fit does not converge. Until the next
+ * RunFit() call, PrintRaw() and PrintTable() omit the afterpulse and dark
+ * current results, which are not fitted by the mixture model.
+ */
+bool
+SiPMLowLightFit::RunMixtureFit()
+{
+  SIPMCALIB_PROFILE( "SiPMLowLightFit::RunMixtureFit" );
+
+  SiPMGaussMixFit fit( binned_counts(),
+                       x().getMin(),
+                       x().getBinning().averageBinWidth(),
+                       _nthreads );
+
+  const std::vector<std::pair<SiPMGaussMixFit::Param, RooRealVar*> > pars = {
+    {SiPMGaussMixFit::kPed,    _ped.get()   },
+    {SiPMGaussMixFit::kGain,   _gain.get()  },
+    {SiPMGaussMixFit::kS0,     _s0.get()    },
+    {SiPMGaussMixFit::kS1,     _s1.get()    },
+    {SiPMGaussMixFit::kMean,   _mean.get()  },
+    {SiPMGaussMixFit::kLambda, _lambda.get()}
+  };
+
+  for( const auto& p : pars ){
+    fit.SetParam( p.first, p.second->getVal(), p.second->isConstant() );
+  }
+
+  if( !fit.Run() ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        usr::fstr( "Gaussian mixture fit did not converge "
+                                   "after %u iterations, keeping the previous "
+                                   "parameter values", fit.NIter() ) );
+    return false;
+  }
+
+  for( const auto& p : pars ){
+    RooRealVar& var = *p.second;
+    if( var.isConstant() ){ continue; }
+    var = std::min( std::max( fit.Value( p.first ), var.getMin() ),
+                    var.getMax() );
+    var.setError( fit.Error( p.first ) );
+  }
+
+  usr::log::PrintLog( usr::log::INFO,
+                      usr::fstr( "Gaussian mixture fit converged after %u "
+                                 "iterations", fit.NIter() ) );
+  _mixtureonly = true;
+  return true;
+}
@@ -0,0 +1,344 @@
+// ------------------------------------------------------------------------------
+// Fast estimation of the fit parameters from the moments of the histogram.
+// ------------------------------------------------------------------------------
+#include "SiPMCalib/SiPMCalc/interface/RealFFT.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
+
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <vector>
+
+namespace {
+
+struct MomentPeak
+{
+  int    index;// Number of photo-electrons
+  double area; // Truncation corrected peak area
+  double pos;
+  double var;// Truncation corrected variance
+};
+
+struct MomentResult
+{
+  bool                    success;
+  std::string             error;
+  double                  gain;
+  double                  area0;// Area of the pedestal and 1 p.e. peaks
+  double                  area1;
+  std::vector<MomentPeak> peaks;// Peaks above the minimum area
+};
+
+/**
+ * Variance of a unit Gaussian truncated to [-a,a].
+ */
+double
+TruncatedVar( const double a )
+{
+  const double phi = std::exp( -a * a / 2 ) / std::sqrt( 2 * M_PI );
+  const double cen = std::erf( a / std::sqrt( 2 ) );
+  return 1-2 * a * phi / cen;
+}
+
+
+/**
+ * Peak period of the histogram in units of bins, from the autocorrelation
+ * R(k) = sum_i h(i) h(i+k), computed by FFT. The period is the first maximum
+ * after the first minimum of R, refined by parabolic interpolation. Returns 0 if
+ * no periodic structure is found.
+ */
+double
+AutoCorrPeriod( const std::vector<double>& h )
+{
+  const size_t n = h.size();
+  const size_t N = RealFFT::GoodSize( 2 * n );// Zero padded for linear correlation
+
+  RealFFT                            fft( N );
+  std::vector<double>                in( N, 0.0 );
+  std::vector<std::complex<double> > out( fft.NFreq() );
+
+  std::copy( h.begin(), h.end(), in.begin() );
+  fft.Forward( in.data(), out.data() );
+
+  for( auto& c : out ){
+    c = std::norm( c );
+  }
+
+  fft.Inverse( out.data(), in.data() );
+  const std::vector<double>& R = in;
+
+  size_t kmin = 1;
+
+  while( kmin+1 < n / 2 && !( R[kmin] < R[kmin-1] && R[kmin] <= R[kmin+1] ) ){
+    ++kmin;
+  }
+
+  if( kmin < 2 || kmin+1 >= n / 2 ){ return 0; }
+
+  size_t kmax = kmin+1;
+
+  for( size_t k = kmin+1; k < std::min( 3 * kmin, n / 2 ); ++k ){
+    if( R[k] > R[kmax] ){ kmax = k; }
+  }
+
+  // Requiring a clear modulation on top of the envelope
+  if( R[kmax] < R[kmin] * ( 1+1e-3 ) || kmax+1 >= n ){ return 0; }
+
+  const double den = R[kmax-1]-2 * R[kmax]+R[kmax+1];
+  const double del = den < 0 ? 0.5 * ( R[kmax-1]-R[kmax+1] ) / den : 0;
+  return kmax+std::max( std::min( del, 0.5 ), -0.5 );
+}
+
+
+/**
+ * Estimating the gain and the positions, widths and areas of the
+ * photo-electron peaks of the histogram h with the given bin centers. See
+ * SiPMLowLightFit::run_moment_est for the method.
+ */
+MomentResult
+MomentEstimate( const std::vector<double>& h,
+                const double               xmin,
+                const double               bw,
+                const double               minpeak )
+{
+  MomentResult ans;
+  ans.success = false;
+  ans.gain    = 0;
+  ans.area0   = 0;
+  ans.area1   = 0;
+
+  const double period = AutoCorrPeriod( h );
+  if( period == 0 ){
+    ans.error = "no periodic peak structure found";
+    return ans;
+  }
+  ans.gain = period * bw;
+
+  const int n      = h.size();
+  const int maxbin = std::max_element( h.begin(), h.end() )-h.begin();
+
+  // Window moments around the expected peak positions, the window center is
+  // moved to the mean of the window content until it is stable.
+  std::vector<MomentPeak> cand;
+
+  for( int k = -(int)( maxbin / period )-1; k <= ( n-maxbin ) / period+1; ++k ){
+    double c = maxbin+k * period;// In bins
+    double w = 0, m = 0, v = 0;
+
+    for( unsigned iter = 0; iter < 3; ++iter ){
+      const int lo = std::max( (int)std::ceil( c-period / 2 ), 0 );
+      const int hi = std::min( (int)std::ceil( c+period / 2 ), n );
+      double    s0 = 0, s1 = 0, s2 = 0;
+
+      for( int i = lo; i < hi; ++i ){
+        s0 += h[i];
+        s1 += h[i] * i;
+        s2 += h[i] * i * i;
+      }
+
+      if( s0 <= 0 ){ w = 0; break; }
+      w = s0;
+      m = s1 / s0;
+      v = s2 / s0-m * m;
+      c = m;
+    }
+
+    if( w <= 0 || v <= 0 ){ continue; }
+
+    // Correcting for the truncation of the Gaussian tails at half a period,
+    // and for the binning (Sheppard's correction).
+    const double a   = period / 2;
+    double       sig = std::sqrt( v );
+
+    for( unsigned iter = 0; iter < 10; ++iter ){
+      sig = std::sqrt( v / TruncatedVar( std::min( a / sig, 10.0 ) ) );
+    }
+
+    MomentPeak p;
+    p.pos  = xmin+( m+0.5 ) * bw;
+    p.var  = std::max( sig * sig-1.0 / 12.0, 0.0 ) * bw * bw;
+    p.area = w / std::erf( std::min( a / sig, 10.0 ) / std::sqrt( 2 ) );
+    cand.push_back( p );
+  }
+
+  std::sort( cand.begin(), cand.end(),
+             []( const MomentPeak& x, const MomentPeak& y ){
+    return x.pos < y.pos;
+  } );
+
+  // Windows that drifted onto the same peak
+  cand.erase( std::unique( cand.begin(), cand.end(),
+                           [&ans]( const MomentPeak& x, const MomentPeak& y ){
+    return y.pos-x.pos < ans.gain / 2;
+  } ), cand.end() );
+
+  double maxarea = 0;
+
+  for( const auto& p : cand ){
+    maxarea = std::max( maxarea, p.area );
+  }
+
+  // The pedestal is the leftmost statistically significant peak, even if it is
+  // too small to be used for the regressions (large mean).
+  const auto ref = std::find_if( cand.begin(), cand.end(),
+                                 [maxarea]( const MomentPeak& p ){
+    return p.area >= std::max( 25.0, 1e-3 * maxarea );
+  } );
+
+  if( ref == cand.end() ){
+    ans.error = "no significant peak found";
+    return ans;
+  }
+
+  ans.area0 = ref->area;
+  ans.area1 = 0;
+
+  for( auto p = ref; p != cand.end(); ++p ){
+    p->index = std::lround( ( p->pos-ref->pos ) / ans.gain );
+    if( p->index == 1 ){ ans.area1 = p->area; }
+    if( p->area >= minpeak * maxarea ){
+      ans.peaks.push_back( *p );
+    }
+  }
+
+  if( ans.peaks.size() < 2 ){
+    ans.error = "less than two peaks found";
+    return ans;
+  }
+
+  ans.success = true;
+  return ans;
+}
+
+
+/**
+ * Weighted least squares of the straight line y = a+b*x.
+ */
+bool
+LinearRegression( const std::vector<double>& x,
+                  const std::vector<double>& y,
+                  const std::vector<double>& w,
+                  double&                    a,
+                  double&                    b )
+{
+  double sw = 0, sx = 0, sy = 0, sxx = 0, sxy = 0;
+
+  for( size_t i = 0; i < x.size(); ++i ){
+    sw  += w[i];
+    sx  += w[i] * x[i];
+    sy  += w[i] * y[i];
+    sxx += w[i] * x[i] * x[i];
+    sxy += w[i] * x[i] * y[i];
+  }
+
+  const double det = sw * sxx-sx * sx;
+  if( !( det > 0 ) ){ return false; }
+
+  a = ( sxx * sy-sx * sxy ) / det;
+  b = ( sw * sxy-sx * sy ) / det;
+  return true;
+}
+
+}
+
+
+/**
+ * @brief Estimating the fit parameters from the histogram counts only, without
+ * any fitting.
+ *
+ * @details The gain is the period of the autocorrelation of the histogram
+ * (computed with FFTs). The position, width and area of each photo-electron
+ * peak is then given by the weighted moments of the histogram within half a
+ * period of the peak, iterated so that the window is centered on the peak,
+ * corrected for the truncation of the Gaussian tails by the window and for the
+ * binning. The pedestal and gain are then the closed-form weighted linear
+ * regression of the peak positions against the number of photo-electrons, and
+ * s0 and s1 that of the peak variances (var = s0^2+n s1^2). The mean and
+ * lambda are given by the areas of the first two peaks relative to the total,
+ * from the generalized Poisson distribution: P0 = exp( -mean ) and P1/P0 = mean
+ * exp( -lambda ).
+ *
+ * Returns false without modifying the parameters if no periodic structure is
+ * found, if fewer than two peaks pass the est_minpeak threshold, or if the
+ * results are unphysical, in which case the TSpectrum estimation should be
+ * used instead.
+ */
+bool
+SiPMLowLightFit::run_moment_est()
+{
+  const double        xmin = x().getMin();
+  const double        bw   = x().getBinning().averageBinWidth();
+  std::vector<double> h    = binned_counts();
+
+  const MomentResult res = MomentEstimate( h, xmin, bw, _est_minpeak );
+
+  auto fail = []( const std::string& msg ){
+                usr::log::PrintLog( usr::log::INFO,
+                                    "Moment estimation failed ("+msg
+                                    +"), falling back to peak fitting" );
+                return false;
+              };
+
+  if( !res.success ){
+    return fail( res.error );
+  }
+
+  std::vector<double> idx, pos, posw, var, varw;
+
+  for( const auto& p : res.peaks ){
+    idx.push_back( p.index );
+    pos.push_back( p.pos );
+    posw.push_back( p.area / p.var );// Inverse variance of the peak mean
+    var.push_back( p.var );
+    varw.push_back( p.area );
+  }
+
+  double pedval, gainval, s0sq, s1sq;
+
+  if( !LinearRegression( idx, pos, posw, pedval, gainval ) || gainval <= 0 ){
+    return fail( "unphysical gain" );
+  }
+  if( !LinearRegression( idx, var, varw, s0sq, s1sq ) ){
+    return fail( "peak width regression" );
+  }
+  if( !( s0sq > 0 ) ){// Also catching NaN from degenerate peak widths
+    s0sq = res.peaks.front().var;
+  }
+  if( !std::isfinite( s0sq ) || !std::isfinite( s1sq ) ){
+    return fail( "peak width regression" );
+  }
+
+  // Generalized Poisson from the areas of the first two peaks
+  double total = 0;
+
+  for( const double y : h ){
+    total += y;
+  }
+
+  const double meanval   = -std::log( std::min( res.area0 / total, 1.0 ) );
+  const double lambdaval = res.area1 > 0 && meanval > 0 ?
+                           std::log( meanval * res.area0 / res.area1 ) : 0;
+
+  if( !std::isfinite( meanval ) || !std::isfinite( lambdaval ) ){
+    return fail( "unphysical peak areas" );
+  }
+
+  auto set = []( RooRealVar& var, const double val ){
+               var = std::min( std::max( val, var.getMin() ), var.getMax() );
+             };
+
+  if( !ignore_ped_est ){ set( ped(), pedval ); }
+  if( !ignore_gain_est ){ set( gain(), gainval ); }
+  if( !ignore_s0_est ){ set( s0(), std::sqrt( s0sq ) ); }
+  if( !ignore_s1_est ){ set( s1(), std::sqrt( std::max( s1sq, 0.0 ) ) ); }
+  if( !ignore_mean_est ){ set( mean(), meanval ); }
+  if( !ignore_lambda_est ){ set( lambda(), std::max( lambdaval, 0.0 ) ); }
+
+  usr::log::PrintLog( usr::log::DEBUG,
+                      usr::fstr( "Moment estimation with %u peaks: "
+                                 "gain %lg, ped %lg",
+                                 (unsigned)res.peaks.size(), gainval, pedval ) );
+  return true;
+}
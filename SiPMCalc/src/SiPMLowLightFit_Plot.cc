@@ -1,3 +1,4 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMLowLightFit.hpp"
 #include "UserUtils/PlotUtils/interface/Ratio1DCanvas.hpp"
 #include "UserUtils/PlotUtils/interface/Simple1DCanvas.hpp"
@@ -6,6 +7,15 @@
 void
 SiPMLowLightFit::PlotPeakFind( const std::string& output )
 {
+  SIPMCALIB_PROFILE( "SiPMLowLightFit::PlotPeakFind" );
+
+  if( !_est_hist || !_spectrum ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        "Peak finding results not available for the estimation "
+                        "method, skipping " + output );
+    return;
+  }
+
   usr::plt::Simple1DCanvas c;
 
   c.PlotHist( _est_hist.get(),
@@ -44,6 +54,15 @@ SiPMLowLightFit::PlotPeakFind( const std::string& output )
 void
 SiPMLowLightFit::PlotGainFit( const std::string& output )
 {
+  SIPMCALIB_PROFILE( "SiPMLowLightFit::PlotGainFit" );
+
+  if( !_gain_graph || !_gain_fit ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        "Gain fit not available for the estimation "
+                        "method, skipping " + output );
+    return;
+  }
+
   usr::plt::Simple1DCanvas c;
 
   c.PlotGraph( _gain_graph.get(),
@@ -77,6 +96,15 @@ SiPMLowLightFit::PlotGainFit( const std::string& output )
 void
 SiPMLowLightFit::PlotWidthFit( const std::string& output )
 {
+  SIPMCALIB_PROFILE( "SiPMLowLightFit::PlotWidthFit" );
+
+  if( !_width_graph || !_width_fit ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        "Width fit not available for the estimation "
+                        "method, skipping " + output );
+    return;
+  }
+
   usr::plt::Simple1DCanvas c;
 
   c.PlotGraph( _width_graph.get(),
@@ -109,6 +137,15 @@ SiPMLowLightFit::PlotWidthFit( const std::string& output )
 void
 SiPMLowLightFit::PlotPoissonFit( const std::string& output )
 {
+  SIPMCALIB_PROFILE( "SiPMLowLightFit::PlotPoissonFit" );
+
+  if( !_height_graph || !_height_fit ){
+    usr::log::PrintLog( usr::log::WARNING,
+                        "Peak height fit not available for the estimation "
+                        "method, skipping " + output );
+    return;
+  }
+
   usr::plt::Simple1DCanvas c;
 
   TH1D hist( usr::RandomString( 5 ).c_str(), "", _height_graph->GetN(), -0.5,
@@ -152,6 +189,8 @@ SiPMLowLightFit::PlotPoissonFit( const std::string& output )
 void
 SiPMLowLightFit::PlotSpectrumFit( const std::string& output )
 {
+  SIPMCALIB_PROFILE( "SiPMLowLightFit::PlotSpectrumFit" );
+
   usr::plt::Ratio1DCanvas c( x() );
 
   auto& fitgraph =
@@ -227,10 +266,14 @@ SiPMLowLightFit::PrintRaw( std::ostream& sout ) const
   sout << make_rooline( "s1",      s1() );
   sout << make_rooline( "mean",    mean() );
   sout << make_rooline( "lambda",  lambda() );
-  sout << make_rooline( "alpha",   alpha() );
-  sout << make_rooline( "beta",    beta() );
-  sout << make_rooline( "dcfrac",  dcfrac() );
-  sout << make_rooline( "epsilon", eps() );
+
+  // Not fitted by the Gaussian mixture model
+  if( !_mixtureonly ){
+    sout << make_rooline( "alpha",   alpha() );
+    sout << make_rooline( "beta",    beta() );
+    sout << make_rooline( "dcfrac",  dcfrac() );
+    sout << make_rooline( "epsilon", eps() );
+  }
 
   // "Nominal" method for measuring ENF
   const usr::Measurement enf = ExcessNoiseFactor( MeanPhotons() );
@@ -265,16 +308,19 @@ SiPMLowLightFit::PrintTable( std::ostream& sout ) const
              "P_\\text{ct}",
              mkstr(  ProbCrosstalk() * 100.0 ),
              "\\%"     );
-  usr::fout( fmt,
-             "P_\\text{ap}",
-             mkstr( ProbAfterpulse() * 100.0 ),
-             "\\%"     );
-  usr::fout( fmt, "\\tau_\\text{ap}", mkstr(  AfterpulseTimeNS() ), "ns"      );
-  usr::fout( fmt,
-             "\\tau_\\text{dc}",
-             mkstr(
-               DarkcurrentTimeNS() / 1000.0 ),
-             "\\mus"   );
+  // Not fitted by the Gaussian mixture model
+  if( !_mixtureonly ){
+    usr::fout( fmt,
+               "P_\\text{ap}",
+               mkstr( ProbAfterpulse() * 100.0 ),
+               "\\%"     );
+    usr::fout( fmt, "\\tau_\\text{ap}", mkstr(  AfterpulseTimeNS() ), "ns" );
+    usr::fout( fmt,
+               "\\tau_\\text{dc}",
+               mkstr(
+                 DarkcurrentTimeNS() / 1000.0 ),
+               "\\mus"   );
+  }
   usr::fout( fmt,
              "ENF",
              mkstr( ExcessNoiseFactor( MeanPhotons() ) ),
@@ -0,0 +1,225 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMBinnedNLL.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMLowLightMultiFit.hpp"
+
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <algorithm>
+
+#include "RooArgList.h"
+#include "RooDataHist.h"
+
+/**
+ * @class SiPMLowLightMultiFit
+ * @ingroup SiPMCalc
+ * @brief Simultaneous fit of low light spectra of the same SiPM taken at
+ * different light intensities.
+ *
+ * @details Each spectrum is handled by a SiPMLowLightFit instance, which is
+ * used for the data parsing, the parameter estimation and the result
+ * outputs. For the fit, the detector parameters (pedestal, gain, noise
+ * widths, crosstalk, afterpulse and dark current parameters) of all instances
+ * are replaced by those of the first instance, while each spectrum keeps its
+ * own mean number of photons (named mean_0, mean_1, ... in the fit). The
+ * starting values of the shared parameters are the average of the per-spectrum
+ * estimates. The likelihood is the sum of the SiPMBinnedNLL of each spectrum,
+ * evaluated in parallel with SiPMSimultaneousNLL: with N spectra and the
+ * requested number of threads T, min( N, T ) spectra are evaluated
+ * concurrently, each spreading its bins over T/N threads if T > N.
+ *
+ * All settings (including the ranges of the mean) are common to all spectra,
+ * only the input files differ.
+ */
+
+SiPMLowLightMultiFit::SiPMLowLightMultiFit( const std::vector<std::string>&
+                                            inputs ) :
+  _inputs  ( inputs ),
+  _nthreads( 1 )
+{
+  for( unsigned i = 0; i < _inputs.size(); ++i ){
+    _fits.emplace_back( new SiPMLowLightFit() );
+    _fits.back()->_inputfile = _inputs[i];
+    _fits.back()->mean().SetName( usr::fstr( "mean_%u", i ).c_str() );
+  }
+}
+
+
+SiPMLowLightMultiFit::SiPMLowLightMultiFit( const std::vector<std::string>&
+                                            inputs,
+                                            const std::string& config ) :
+  SiPMLowLightMultiFit( inputs )
+{
+  // The input files are given by the argument, not by the configuration file.
+  usr::ArgumentExtender args;
+  args.AddOptions( SiPMLowLightFit::DataArguments( false ) );
+  args.AddOptions( SiPMLowLightFit::FitArguments() );
+  args.ParseFile( config );
+
+  UpdateSettings( args );
+}
+
+
+usr::po::options_description
+SiPMLowLightMultiFit::MultiArguments()
+{
+  usr::po::options_description desc(
+    "Options for the simultaneous fit of multiple low light spectra" );
+  desc.add_options()
+    ( "inputs",
+    usr::po::multivalue<std::string>(),
+    "Input data files, one per light intensity. All files must use the same "
+    "data format" )
+  ;
+  return desc;
+}
+
+
+/**
+ * @brief Applying the same settings to all spectra, the input files are kept.
+ */
+void
+SiPMLowLightMultiFit::UpdateSettings( const usr::ArgumentExtender& args )
+{
+  for( unsigned i = 0; i < _fits.size(); ++i ){
+    _fits[i]->UpdateSettings( args );
+    _fits[i]->_inputfile = _inputs[i];
+  }
+
+  _nthreads = args.ArgOpt<unsigned>( "nthreads", _nthreads );
+}
+
+
+void
+SiPMLowLightMultiFit::MakeBinnedData()
+{
+  for( auto& fit : _fits ){
+    fit->MakeBinnedData();
+  }
+}
+
+
+/**
+ * @brief Running the estimation of each spectrum, then setting the floating
+ * shared parameters to the average of the estimates of the spectra where the
+ * estimation succeeded.
+ *
+ * All the parameters replaced in share_parameters() are averaged, including
+ * the afterpulse and dark current parameters, which are not estimated from the
+ * spectrum but can be seeded from the parameter store.
+ */
+void
+SiPMLowLightMultiFit::RunPDFEstimation()
+{
+  for( auto& fit : _fits ){
+    fit->RunPDFEstimation();
+  }
+
+  std::vector<const SiPMLowLightFit*> good;
+
+  for( const auto& fit : _fits ){
+    if( fit->_est_success ){
+      good.push_back( fit.get() );
+    }
+  }
+
+  if( good.empty() ){
+    return;
+  }
+
+  // Averaging before sharing, so that the estimates of the other spectra are
+  // still available.
+  for( const auto member : { &SiPMLowLightFit::_ped,
+                             &SiPMLowLightFit::_gain,
+                             &SiPMLowLightFit::_s0,
+                             &SiPMLowLightFit::_s1,
+                             &SiPMLowLightFit::_lambda,
+                             &SiPMLowLightFit::_alpha,
+                             &SiPMLowLightFit::_beta,
+                             &SiPMLowLightFit::_dcfrac,
+                             &SiPMLowLightFit::_eps } ){
+    double sum = 0;
+
+    for( const auto fit : good ){
+      sum += ( fit->*member )->getVal();
+    }
+
+    RooRealVar& var = *( _fits.front().get()->*member );
+    if( !var.isConstant() ){
+      var = sum / good.size();
+    }
+  }
+
+  share_parameters();
+}
+
+
+void
+SiPMLowLightMultiFit::RunFit()
+{
+  SIPMCALIB_PROFILE( "SiPMLowLightMultiFit::RunFit" );
+
+  if( _fits.empty() ){ return; }
+
+  share_parameters();
+
+  const unsigned nthreads = _nthreads == 0 ? ThreadPool::HardwareThreads() :
+                            _nthreads;
+  const unsigned nouter = std::min( nthreads, NSpectra() );
+  const unsigned ninner = std::max( nthreads / nouter, 1u );
+
+  std::vector<std::unique_ptr<SiPMBinnedNLL> > comps;
+  RooArgList                                   list;
+
+  for( unsigned i = 0; i < _fits.size(); ++i ){
+    SiPMLowLightFit&  fit  = *_fits[i];
+    const std::string name = usr::fstr( "nll_%u", i );
+    comps.emplace_back( new SiPMBinnedNLL(
+                          name.c_str(), name.c_str(),
+                          *fit._pdf, fit.x(),
+                          dynamic_cast<const RooDataHist&>( *fit._data ),
+                          ninner ) );
+    list.add( *comps.back() );
+  }
+
+  SiPMSimultaneousNLL nll( "nll", "nll", list, nouter );
+  ConvergeNLLMinimizer( nll, 3 );
+
+  for( auto& fit : _fits ){
+    fit->_mixtureonly = false;
+  }
+}
+
+
+/**
+ * @brief Making the PDFs of all spectra depend on the detector parameters of
+ * the first spectrum. Does nothing if the parameters are already shared.
+ */
+void
+SiPMLowLightMultiFit::share_parameters()
+{
+  for( unsigned i = 1; i < _fits.size(); ++i ){
+    if( _fits[i]->_ped != _fits.front()->_ped ){
+      _fits[i]->share_parameters( *_fits.front() );
+    }
+  }
+}
+
+
+void
+SiPMLowLightMultiFit::PrintRaw( std::ostream& sout ) const
+{
+  for( unsigned i = 0; i < _fits.size(); ++i ){
+    sout << "Spectrum " << i << ": " << _inputs[i] << "\n";
+    _fits[i]->PrintRaw( sout );
+  }
+}
+
+
+void
+SiPMLowLightMultiFit::PrintTable( std::ostream& sout ) const
+{
+  for( unsigned i = 0; i < _fits.size(); ++i ){
+    sout << "Spectrum " << i << ": " << _inputs[i] << "\n";
+    _fits[i]->PrintTable( sout );
+  }
+}
@@ -1,3 +1,4 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
 #include "SiPMCalib/Common/interface/StdFormat.hpp"
 #include "SiPMCalib/InvSqCalc/interface/InvSqFunc.hpp"
 #include "SiPMCalib/SiPMCalc/interface/NonLinearModel.hpp"
@@ -214,6 +215,8 @@ SiPMNonLinearFit::UpdateSettings( const usr::ArgumentExtender& args )
 void
 SiPMNonLinearFit::ReadFiles( const std::string& zscan, const std::string& corr )
 {
+  SIPMCALIB_PROFILE( "SiPMNonLinearFit::ReadFiles" );
+
   // Making the common data container for the raw data.
   _raw_data.reset( new StdFormat( zscan ));
 
@@ -312,6 +315,8 @@ SiPMNonLinearFit::MakeInterpolator3D( const std::string& corr )
 void
 SiPMNonLinearFit::MakeLinearGraph()
 {
+  SIPMCALIB_PROFILE( "SiPMNonLinearFit::MakeLinearGraph" );
+
   auto lin_power = [this]( const StdFormat::RowFormat& row )->bool {
                      return row.bias >= this->_lin_pmin &&
                             row.bias <= this->_lin_pmax;
@@ -389,6 +394,8 @@ SiPMNonLinearFit::MakeNonLinearGraph( const double ref_n,
                                       const double gain,
                                       const double ped  )
 {
+  SIPMCALIB_PROFILE( "SiPMNonLinearFit::MakeNonLinearGraph" );
+
   // Finding the new reference point data power
   const auto ref_row = *std::min_element(
     _raw_data->begin(),
@@ -443,6 +450,8 @@ SiPMNonLinearFit::MakeNonLinearGraph( const double ref_n,
 void
 SiPMNonLinearFit::RunNonLinearFit()
 {
+  SIPMCALIB_PROFILE( "SiPMNonLinearFit::RunNonLinearFit" );
+
   const double xmin = usr::plt::GetXmin( _nl_data );
   const double xmax = usr::plt::GetXmax( _nl_data );
 
@@ -486,6 +495,8 @@ SiPMNonLinearFit::RunNonLinearFit()
 void
 SiPMNonLinearFit::PlotLinearity( const std::string& outfile )
 {
+  SIPMCALIB_PROFILE( "SiPMNonLinearFit::PlotLinearity" );
+
   usr::plt::Ratio1DCanvas c;
 
   TF1          lfunc = _lin_func;
@@ -571,6 +582,8 @@ SiPMNonLinearFit::PlotLinearity( const std::string& outfile )
 void
 SiPMNonLinearFit::PlotOriginal( const std::string& outfile )
 {
+  SIPMCALIB_PROFILE( "SiPMNonLinearFit::PlotOriginal" );
+
   usr::plt::Flat2DCanvas c;
 
   auto zval    = _raw_data->Z();
@@ -608,6 +621,8 @@ SiPMNonLinearFit::PlotOriginal( const std::string& outfile )
 void
 SiPMNonLinearFit::PlotMorphed( const std::string& outfile )
 {
+  SIPMCALIB_PROFILE( "SiPMNonLinearFit::PlotMorphed" );
+
   usr::plt::Flat2DCanvas c;
   c.PlotColGraph( _nl_data,
                   usr::plt::MarkerSize( 0.5 ),
@@ -631,6 +646,8 @@ SiPMNonLinearFit::PlotMorphed( const std::string& outfile )
 void
 SiPMNonLinearFit::PlotNonLinearity( const std::string& outfile )
 {
+  SIPMCALIB_PROFILE( "SiPMNonLinearFit::PlotNonLinearity" );
+
   usr::plt::Ratio1DCanvas c;
 
   TGraphErrors _nl_g = TGraphErrors( _nl_data.GetN(),
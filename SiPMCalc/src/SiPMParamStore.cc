@@ -0,0 +1,303 @@
+#include "SiPMCalib/SiPMCalc/interface/SiPMParamStore.hpp"
+
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+/**
+ * @class SiPMParamStore
+ * @ingroup SiPMCalc
+ * @brief File backed store of low light fit results, used to seed the fits of
+ * similar operating conditions.
+ *
+ * @details Each entry holds the fit parameters of a SiPMLowLightFit along with
+ * the detector id, the bias voltage and the temperature of the measurement.
+ * The Find() method returns the entry closest to the requested operating
+ * condition, with the distance
+ *
+ * d = |dV|/bias_scale + |dT|/temp_scale + ( detid differ ? detid_penalty : 0 )
+ *
+ * such that the same SiPM at an adjacent bias and a sister channel at the same
+ * bias are both considered nearby. An unknown (NaN) bias or temperature matches
+ * another unknown value exactly, and is one scale unit away from any known
+ * value. Among entries of equal distance, the most
+ * recently inserted one is used. No entry is returned if the closest entry is
+ * further than max_distance, in which case the fit should fall back to the
+ * estimation from the data.
+ *
+ * The store is a plain text file with one entry per line: detector id (no
+ * spaces, - if empty), bias, temperature, then the values of the parameters in
+ * the order of parameter_names. Lines starting with # are ignored. Instances are shared
+ * per file path within the process, and all methods are thread safe, so that
+ * the concurrent fits of a batch can use the same store. Save() merges the
+ * entries written by other processes since the file was loaded, then replaces
+ * the file atomically, holding a file lock so that concurrent saves of
+ * different processes are also serialized.
+ */
+
+const std::vector<std::string> SiPMParamStore::parameter_names = {
+  "ped", "gain", "s0", "s1", "mean", "lambda", "alpha", "beta", "dcfrac",
+  "epsilon"
+};
+
+double SiPMParamStore::bias_scale    = 0.5;
+double SiPMParamStore::temp_scale    = 2.0;
+double SiPMParamStore::detid_penalty = 1.0;
+double SiPMParamStore::max_distance  = 4.0;
+
+// Identical keys, with the NaN bias and temperature matching each other.
+static bool
+SameKey( const SiPMParamStore::Key& x, const SiPMParamStore::Key& y )
+{
+  auto same = []( const double a, const double b ){
+                return a == b || ( std::isnan( a ) && std::isnan( b ) );
+              };
+  return x.detid == y.detid && same( x.bias, y.bias ) && same( x.temp, y.temp );
+}
+
+static std::mutex open_mutex;
+static std::map<std::string, std::weak_ptr<SiPMParamStore> > open_stores;
+
+/**
+ * @brief Returning the store of the given file, shared with all other users of
+ * the same file in the process. The file is created on the first Save() if it
+ * does not exist.
+ */
+std::shared_ptr<SiPMParamStore>
+SiPMParamStore::Open( const std::string& file )
+{
+  std::lock_guard<std::mutex>     lock( open_mutex );
+  std::shared_ptr<SiPMParamStore> ans = open_stores[file].lock();
+
+  if( !ans ){
+    ans.reset( new SiPMParamStore( file ) );
+    open_stores[file] = ans;
+  }
+
+  return ans;
+}
+
+
+SiPMParamStore::SiPMParamStore( const std::string& file ) :
+  _file   ( file ),
+  _entries( read_file( file ) )
+{}
+
+
+std::vector<SiPMParamStore::Entry>
+SiPMParamStore::read_file( const std::string& file )
+{
+  std::vector<Entry> ans;
+  std::ifstream      fin( file );
+  std::string        line;
+
+  while( std::getline( fin, line ) ){
+    if( line.empty() || line[0] == '#' ){ continue; }
+
+    std::istringstream sin( line );
+    Entry              entry;
+    std::string        bias, temp;// As strings for parsing nan
+    sin >> entry.key.detid >> bias >> temp;
+    if( entry.key.detid == "-" ){ entry.key.detid = ""; }
+    entry.key.bias = std::strtod( bias.c_str(), nullptr );
+    entry.key.temp = std::strtod( temp.c_str(), nullptr );
+
+    double x;
+
+    while( sin >> x ){
+      entry.values.push_back( x );
+    }
+
+    if( entry.values.size() == parameter_names.size() ){
+      ans.push_back( entry );
+    }
+  }
+
+  return ans;
+}
+
+
+double
+SiPMParamStore::Distance( const Key& x, const Key& y )
+{
+  // Differences with an unknown value on one side count as one scale unit.
+  auto diff = []( const double a, const double b, const double scale ){
+                if( std::isnan( a ) && std::isnan( b ) ){ return 0.0; }
+                if( std::isnan( a ) || std::isnan( b ) ){ return 1.0; }
+                return std::fabs( a-b ) / scale;
+              };
+
+  return ( x.detid == y.detid ? 0 : detid_penalty )
+         +diff( x.bias, y.bias, bias_scale )
+         +diff( x.temp, y.temp, temp_scale );
+}
+
+
+/**
+ * @brief Finding the nearest entry within max_distance of the key, returns
+ * false if there is none.
+ */
+bool
+SiPMParamStore::Find( const Key& key, Entry& ans ) const
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+
+  double mindist = std::numeric_limits<double>::max();
+  bool   found   = false;
+
+  for( const auto& entry : _entries ){
+    const double dist = Distance( key, entry.key );
+    if( dist <= mindist && dist <= max_distance ){
+      mindist = dist;
+      ans     = entry;
+      found   = true;
+    }
+  }
+
+  return found;
+}
+
+
+/**
+ * @brief Adding an entry, replacing any entry with the identical key.
+ */
+void
+SiPMParamStore::Insert( const Entry& entry )
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+
+  for( auto it = _entries.begin(); it != _entries.end(); ++it ){
+    if( SameKey( it->key, entry.key ) ){
+      _entries.erase( it );
+      break;
+    }
+  }
+
+  _entries.push_back( entry );
+}
+
+
+/**
+ * @brief Exclusive advisory lock on the lock file next to the store file,
+ * released when the object goes out of scope.
+ */
+struct StoreFileLock
+{
+  int fd;
+
+  explicit StoreFileLock( const std::string& file ) :
+    fd( ::open( file.c_str(), O_RDWR | O_CREAT, 0644 ) )
+  {
+    if( fd < 0 ){
+      throw std::runtime_error( "Cannot open parameter store lock file "+file );
+    }
+
+    int ret;
+
+    do {
+      ret = ::flock( fd, LOCK_EX );
+    } while( ret != 0 && errno == EINTR );
+
+    if( ret != 0 ){
+      ::close( fd );
+      throw std::runtime_error( "Cannot lock parameter store lock file "+file );
+    }
+  }
+
+  ~StoreFileLock(){ ::close( fd ); }// Closing releases the lock
+};
+
+
+/**
+ * @brief Merging the entries in the file and writing the file. The whole
+ * read/merge/write/rename sequence is done while holding a flock on the
+ * [file].lock file, so that concurrent Save() calls of different processes do
+ * not drop each other's entries. Throws an std::runtime_error if the file
+ * cannot be written, in which case the file is left unchanged.
+ */
+void
+SiPMParamStore::Save()
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+  StoreFileLock               filelock( _file+".lock" );
+
+  // Keeping the entries added to the file by other processes, older than any
+  // entry of this instance.
+  std::vector<Entry> merged;
+
+  for( const auto& entry : read_file( _file ) ){
+    bool known = false;
+
+    for( const auto& x : _entries ){
+      if( SameKey( x.key, entry.key ) ){
+        known = true;
+        break;
+      }
+    }
+
+    if( !known ){ merged.push_back( entry ); }
+  }
+
+  merged.insert( merged.end(), _entries.begin(), _entries.end() );
+  _entries = merged;
+
+  // Writing to a temporary file then renaming, so that readers never see a
+  // partially written file.
+  const std::string tmp = _file+".tmp"+std::to_string( std::random_device()() );
+  {
+    std::ofstream fout( tmp );
+    if( !fout.is_open() ){
+      throw std::runtime_error( "Cannot open temporary parameter store file "
+                                +tmp );
+    }
+    fout << "# detid bias temp";
+
+    for( const auto& name : parameter_names ){
+      fout << " " << name;
+    }
+
+    fout << "\n" << std::setprecision( 10 );
+
+    for( const auto& entry : _entries ){
+      fout << ( entry.key.detid.empty() ? "-" : entry.key.detid )
+           << " " << entry.key.bias << " " << entry.key.temp;
+
+      for( const double x : entry.values ){
+        fout << " " << x;
+      }
+
+      fout << "\n";
+    }
+
+    fout.close();
+    if( fout.fail() ){
+      std::remove( tmp.c_str() );
+      throw std::runtime_error( "Failed writing parameter store file "+tmp );
+    }
+  }
+
+  if( std::rename( tmp.c_str(), _file.c_str() ) != 0 ){
+    std::remove( tmp.c_str() );
+    throw std::runtime_error( "Cannot replace parameter store file "+_file );
+  }
+}
+
+
+unsigned
+SiPMParamStore::Size() const
+{
+  std::lock_guard<std::mutex> lock( _mutex );
+  return _entries.size();
+}
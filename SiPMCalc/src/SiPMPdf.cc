@@ -1,4 +1,7 @@
+#include "SiPMCalib/SiPMCalc/interface/PdfCounters.hpp"
 #include "SiPMCalib/SiPMCalc/interface/SiPMPdf.hpp"
+#include "SiPMCalib/SiPMCalc/interface/VecMath.hpp"
+#include "UserUtils/Common/interface/Maths.hpp"
 
 #include "RooAbsData.h"
 #include "RooConstVar.h"
@@ -7,6 +10,12 @@
 
 #include "TMath.h"
 
+#include <algorithm>
+#include <cmath>
+#include <memory>
+
+unsigned SiPMPdf::fft_minbins = 4096;
+
 // Full model construction
 SiPMPdf::SiPMPdf( const char* name,
                   const char* title,
@@ -33,7 +42,7 @@ SiPMPdf::SiPMPdf( const char* name,
   beta       (       "beta",   "beta", this, _beta ),
   dcfraction ( "dcfrac", "darkfraction", this, _dcfrac ),
   epsilon    (    "eps",    "epsilon", this, _epsilon ),
-  mdistro    ( ped, ped+gain, epsilon, sqrt( s0 * s0+s1 * s1 ) )
+  _evalmode  ( kAuto )
 {}
 
 
@@ -61,7 +70,7 @@ SiPMPdf::SiPMPdf( const char* name,
   beta       (       "beta",   "beta", this, _beta ),
   dcfraction ( "dcfrac", "darkfraction", this, RooFit::RooConst( 0 ) ),
   epsilon    (    "eps",    "epsilon", this, RooFit::RooConst( 0.01 ) ),
-  mdistro    ( ped, ped+gain, epsilon, sqrt( s0 * s0+s1 * s1 ) )
+  _evalmode  ( kAuto )
 {}
 
 SiPMPdf::SiPMPdf( const char* name,
@@ -85,7 +94,7 @@ SiPMPdf::SiPMPdf( const char* name,
   beta       (       "beta",   "beta", this, RooFit::RooConst( 1000 ) ),
   dcfraction ( "dcfrac", "dcfraction", this, RooFit::RooConst( 0 ) ),
   epsilon    (    "eps",    "epsilon", this, RooFit::RooConst( 0.01 ) ),
-  mdistro    ( ped, ped+gain, epsilon, sqrt( s0 * s0+s1 * s1 ) )
+  _evalmode  ( kAuto )
 {}
 
 
@@ -102,7 +111,8 @@ SiPMPdf::SiPMPdf( const SiPMPdf& other, const char*name ) :
   beta       ( "beta", this, other.beta ),
   dcfraction ( "dcfrac", this, other.dcfraction ),
   epsilon    ( "eps", this, other.epsilon ),
-  mdistro    ( ped, ped+gain, epsilon, sqrt( s0 * s0+s1 * s1 ) )
+  mdistro    ( other.mdistro.GetCache(), other.mdistro.GetMode() ),
+  _evalmode  ( other._evalmode )
 {}
 
 SiPMPdf::~SiPMPdf(){}
@@ -120,8 +130,164 @@ SiPMPdf::clone( const char*name ) const
 static double
 GaussCDF( const double x, const double sig )
 {
-  static const double sqrt2 = TMath::Sqrt( 2 );
-  return 0.5 * ( 1+TMath::Erf( x / ( sqrt2 * sig ) ) );
+  return vecmath::NormalCdf( x, 0, sig );
+}
+
+
+/**
+ * @brief Binomial probabilities of i afterpulses out of k discharges, for all
+ * i = 0...k, stored in out[i]. Uses the recurrence
+ *
+ * b(i+1) = b(i) * (k-i)/(i+1) * alpha/(1-alpha)
+ *
+ * which is identical to the difference of the cumulative binomial functions
+ * used by SiPMPdf::binomial_prob.
+ */
+static void
+BinomialSequence( const double         alpha,
+                  const unsigned       k,
+                  std::vector<double>& out )
+{
+  out.resize( k+1 );
+
+  if( alpha >= 1 ){
+    std::fill( out.begin(), out.end(), 0 );
+    out[k] = 1;
+    return;
+  }
+
+  const double ratio = alpha / ( 1-alpha );
+  out[0] = std::pow( 1-alpha, k );
+
+  for( unsigned i = 0; i < k; ++i ){
+    out[i+1] = out[i] * ratio * ( k-i ) / ( i+1 );
+  }
+}
+
+
+/**
+ * @brief Sum of the weighted Erlang densities for i = 2...k:
+ *
+ * sum_i b[i] * y^(i-1) exp(-y/beta) / ( beta^i (i-1)! )
+ *
+ * e1 should be the i=1 term exp(-y/beta)/beta, which is already available in
+ * the calling functions. The i+1 term is then given by multiplying the i term
+ * by y/(beta i). If e1 underflows, the recurrence is run on the logarithm
+ * of the terms instead.
+ */
+static double
+ErlangSum( const double  y,
+           const double  beta,
+           const double  e1,
+           const double* b,
+           const unsigned k )
+{
+  if( y <= 0 || k < 2 ){ return 0; }
+
+  const double r   = y / beta;
+  double       ans = 0;
+
+  if( e1 > 0 ){
+    double term = e1;
+
+    for( unsigned i = 2; i <= k; ++i ){
+      term *= r / ( i-1 );
+      ans  += b[i] * term;
+    }
+  } else {
+    const double logr    = vecmath::Log( r );
+    double       logterm = -r-vecmath::Log( beta );
+
+    for( unsigned i = 2; i <= k; ++i ){
+      logterm += logr-vecmath::Log( i-1 );
+      ans     += b[i] * vecmath::Exp( logterm );
+    }
+  }
+
+  return ans;
+}
+
+
+/**
+ * @brief Sum of the weighted regularized lower incomplete Gamma functions for
+ * i = 2...k, sum_i b[i] * P( i, z ). The P(i,z) functions are evaluated using
+ * the recurrence relation:
+ *
+ * P(i+1,z) = P(i,z) - z^i exp(-z) / i!
+ *
+ * Upward evaluation starting from P(1,z) = 1-exp(-z) is used if z > k, where
+ * P(i,z) is close to unity. Otherwise, the P(k,z) is evaluated with its power
+ * series, and the recurrence is run downwards, so that all terms are added
+ * rather than subtracted. The z^i exp(-z)/i! terms are evaluated outwards from
+ * the largest term i = min(floor(z),k), and underflow gracefully to 0 away from
+ * it. tmp is used as scratch space.
+ */
+static double
+GammaPSum( const double         z,
+           const double*        b,
+           const unsigned       k,
+           std::vector<double>& tmp )
+{
+  if( z <= 0 || k < 2 ){ return 0; }
+
+  // The Poisson terms are seeded at the peak term in log space and
+  // propagated outwards, so that exp(-z) underflowing for large z does not
+  // zero out the whole sequence.
+  const unsigned m = z < k ? (unsigned)z : k;
+  tmp.resize( k+1 );
+  tmp[m] = vecmath::Exp( -z+m * vecmath::Log( z )-std::lgamma( m+1.0 ) );
+
+  for( unsigned i = m; i > 0; --i ){
+    tmp[i-1] = tmp[i] * i / z;
+  }
+
+  for( unsigned i = m+1; i <= k; ++i ){
+    tmp[i] = tmp[i-1] * z / i;
+  }
+
+  double ans = 0;
+
+  if( z > k ){
+    double p = -std::expm1( -z );
+
+    for( unsigned i = 1; i < k; ++i ){
+      p    = std::max( p-tmp[i], 0.0 );
+      ans += b[i+1] * p;
+    }
+  } else {
+    // Power series for P(k,z), converges quickly as z <= k.
+    double sum  = 1;
+    double term = 1;
+
+    for( unsigned j = 1; term > 1e-17 * sum; ++j ){
+      term *= z / ( k+j );
+      sum  += term;
+    }
+
+    double p = tmp[k] * sum;
+
+    for( unsigned i = k; i >= 2; --i ){
+      ans += b[i] * p;
+      p   += tmp[i-1];
+    }
+  }
+
+  return ans;
+}
+
+
+/**
+ * @brief Single regularized lower incomplete Gamma function P( i, z ), using
+ * the same recurrence as GammaPSum with unit weight on the i-th term.
+ */
+static double
+GammaP( const unsigned i, const double z )
+{
+  thread_local std::vector<double> b;
+  thread_local std::vector<double> tmp;
+  b.assign( i+1, 0 );
+  b[i] = 1;
+  return GammaPSum( z, b.data(), i, tmp );
 }
 
 
@@ -134,32 +300,228 @@ SiPMPdf::GeneralPoissonProb( const int    x,
     return TMath::Poisson( x, mean );
   }
 
-  return TMath::Exp(
-    TMath::Log( mean )
-    +( x-1 ) * TMath::Log( mean+x * lambda )
+  return vecmath::Exp(
+    vecmath::Log( mean )
+    +( x-1 ) * vecmath::Log( mean+x * lambda )
     -( mean+x * lambda )-TMath::LnGamma( x+1 ));
 }
 
 
+/**
+ * @brief Scratch arrays for the batched evaluation over the discharge peaks.
+ * These are kept per thread rather than per instance, so that the const
+ * evaluation methods do not modify any shared state.
+ */
+struct SiPMPdf::Workspace
+{
+  unsigned            n;// Number of discharge peaks
+  std::vector<double> pk;// Peak positions
+  std::vector<double> sk;// Peak widths
+  std::vector<double> f0;
+  std::vector<double> f1;
+  std::vector<double> f2;
+  std::vector<double> pp;// Generalized Poisson probabilities
+  std::vector<double> bi;// Binomial sequence of a single peak
+  std::vector<double> gt;// Scratch for the incomplete gamma terms
+};
+
+
+/**
+ * @brief Number of discharge peaks to include in the sum, and filling the peak
+ * position and width arrays used for the batched Gaussian evaluations.
+ */
+SiPMPdf::Workspace&
+SiPMPdf::fill_peaks() const
+{
+  static thread_local Workspace w;
+  const unsigned                n = std::ceil( mean+10 * std::sqrt( mean )+15 );
+
+  w.n = n;
+  w.pk.resize( n );
+  w.sk.resize( n );
+  w.f0.resize( n );
+  w.f1.resize( n );
+  w.f2.resize( n );
+
+  for( unsigned k = 0; k < n; ++k ){
+    w.pk[k] = ped+gain * k;
+    w.sk[k] = std::sqrt( s0 * s0+k * s1 * s1 );
+  }
+
+  fill_poisson( w, n );
+
+  return w;
+}
+
+
+/**
+ * @brief Filling the generalized Poisson probabilities of the first n discharge
+ * counts as a batch, with the log factorial accumulated along the array.
+ */
+void
+SiPMPdf::fill_poisson( Workspace& w, const unsigned n ) const
+{
+  std::vector<double>& pp = w.pp;
+  pp.resize( n );
+
+  if( mean <= 0 || lambda < 0 ){
+    for( unsigned k = 0; k < n; ++k ){
+      pp[k] = GeneralPoissonProb( k, mean, lambda );
+    }
+
+    return;
+  }
+
+  for( unsigned k = 0; k < n; ++k ){
+    pp[k] = mean+k * lambda;
+  }
+
+  vecmath::Log( pp.data(), pp.data(), n );
+
+  const double logmean = vecmath::Log( mean );
+  double       logfact = 0;
+
+  for( unsigned k = 0; k < n; ++k ){
+    logfact += k > 1 ? vecmath::Log( k ) : 0;
+    pp[k]   = logmean+( (double)k-1 ) * pp[k]-( mean+k * lambda )-logfact;
+  }
+
+  vecmath::Exp( pp.data(), pp.data(), n );
+}
+
+
+/**
+ * @brief FFT whole-spectrum table for the current parameters, or a null pointer
+ * if the FFT evaluation is not to be used.
+ */
+std::shared_ptr<const SiPMSpectrumFFT::Table>
+SiPMPdf::fft_table() const
+{
+  if( _evalmode == kDirect ){ return nullptr; }
+
+  const RooRealVar* var = dynamic_cast<const RooRealVar*>( &x.arg() );
+  if( !var ){ return nullptr; }
+  if( _evalmode == kAuto && (unsigned)var->getBins() < fft_minbins ){
+    return nullptr;
+  }
+
+  return fftspec.Lookup( var->getMin(), var->getMax(),
+                         ped, gain, s0, s1, mean, lambda, alpha, beta,
+                         dcfraction );
+}
+
+
 double
 SiPMPdf::evaluate() const
 {
-  double prob = gen_poisson( 0 ) * gauss_k( 0 );
+  double     prob;
+  const auto fft = fft_table();
 
-  for( int k = 1; k < mean+10 * TMath::Sqrt( mean )+15; ++k ){
-    double probk = binomial_prob( k, 0 ) * gauss_k( k );
+  SIPMCALIB_COUNT( kSiPMPdfEval, 1 );
 
-    for( int i = 1; i <= k; ++i ){
-      probk += binomial_prob( k, i ) * ap_eff( k, i );
-    }
+  // Whole spectrum lookup, the dark current term is added separately
+  // (dark_mix(0) is the dark current part of the pedestal term).
+  if( fft && fft->InRange( x ) ){
+    SIPMCALIB_COUNT( kSiPMPdfFFTEval, 1 );
+    prob = fft->Evaluate( x )+gen_poisson( 0 ) * dark_mix( 0 );
+  } else {
+    prob = evaluate_direct();
+  }
 
-    prob += gen_poisson( k ) * probk;
+  // Forcing non-zero to avoid fit crashing.
+  return prob > 0 ? prob : std::numeric_limits<double>::min();
+}
+
+
+/**
+ * @brief Choosing the model variant for the current parameter values: the
+ * afterpulse and dark current terms are only included in the sum if alpha and
+ * the dark current fraction are non-zero.
+ */
+double
+SiPMPdf::evaluate_direct() const
+{
+  if( alpha > 0 ){
+    return dcfraction != 0 ?
+           evaluate_variant<true, true>() :
+           evaluate_variant<true, false>();
+  } else {
+    return dcfraction != 0 ?
+           evaluate_variant<false, true>() :
+           evaluate_variant<false, false>();
   }
+}
+
 
-  if( prob <= 0 ){
-    prob = std::numeric_limits<double>::min();
+/**
+ * @brief Sum of a[i]*b[i] for i in [1,n) with independent partial sums, so that
+ * the loop can be vectorized without reassociation by the compiler.
+ */
+static double
+PeakSum( const double* a, const double* b, const unsigned n )
+{
+  double   s[4] = {0, 0, 0, 0};
+  unsigned k    = 1;
+
+  for( ; k+4 <= n; k += 4 ){
+    s[0] += a[k+0] * b[k+0];
+    s[1] += a[k+1] * b[k+1];
+    s[2] += a[k+2] * b[k+2];
+    s[3] += a[k+3] * b[k+3];
+  }
 
-    // Forcing non-zero to avoid fit crashing.
+  for( ; k < n; ++k ){
+    s[0] += a[k] * b[k];
+  }
+
+  return ( s[0]+s[1] )+( s[2]+s[3] );
+}
+
+
+template<bool AP, bool DC>
+double
+SiPMPdf::evaluate_variant() const
+{
+  Workspace&           w  = fill_peaks();
+  const unsigned       n  = w.n;
+  std::vector<double>& pk = w.pk;
+  std::vector<double>& sk = w.sk;
+  std::vector<double>& f0 = w.f0;
+  std::vector<double>& f1 = w.f1;
+  std::vector<double>& f2 = w.f2;
+  std::vector<double>& pp = w.pp;
+  std::vector<double>& bi = w.bi;
+
+  SIPMCALIB_COUNT( kSiPMPdfDirect, 1 );
+  SIPMCALIB_COUNT( kSiPMPdfTerms, n );
+
+  // Gaussian peaks for all discharge counts in a single batch
+  vecmath::NormalPdf( x, pk.data(), sk.data(), f0.data(), n );
+
+  const double prob0 = DC ?
+                       pp[0] * dark_mix( f0[0] ) :
+                       pp[0] * f0[0];
+
+  if( !AP ){
+    return prob0+PeakSum( pp.data(), f0.data(), n );
+  }
+
+  // Smeared single afterpulse terms: exp( -y/beta ) / beta * GaussCDF( y )
+  for( unsigned k = 0; k < n; ++k ){
+    f2[k] = -( x-pk[k] ) / beta;
+  }
+
+  vecmath::NormalCdf( x, pk.data(), sk.data(), f1.data(), n );
+  vecmath::Exp( f2.data(), f2.data(), n );
+
+  double prob = prob0;
+
+  for( unsigned k = 1; k < n; ++k ){
+    const double e1 = f2[k] / beta;
+    BinomialSequence( alpha, k, bi );
+    prob += pp[k] * ( bi[0] * f0[k]
+                       +bi[1] * e1 * f1[k]
+                       +ErlangSum( x-pk[k], beta, e1, bi.data(), k ) );
   }
 
   return prob;
@@ -177,18 +539,19 @@ double
 SiPMPdf::ap_eff( const int k, const int i ) const
 {
   const double pk = ped+gain * k;
-  const double sk = TMath::Sqrt( s0 * s0+k * s1 * s1 );
+  const double sk = std::sqrt( s0 * s0+k * s1 * s1 );
   const double y  = x-pk;
 
   if( i > 1 ){
     if( y < 0 ){ return 0; }
 
-    // Moving to LnGamma method for evaluating factorials
-    return TMath::Exp( ( i-1 ) * TMath::Log( y )
-                       -y / beta-i * TMath::Log( beta )
-                       -TMath::LnGamma( i ));
+    // Moving to LnGamma method for evaluating factorials, the log-factorial
+    // has no vecmath counterpart and stays with TMath.
+    return vecmath::Exp( ( i-1 ) * vecmath::Log( y )
+                         -y / beta-i * vecmath::Log( beta )
+                         -TMath::LnGamma( i ));
   } else {
-    const double ap    = TMath::Exp( -y / beta ) / beta;
+    const double ap    = vecmath::Exp( -y / beta ) / beta;
     const double smear = GaussCDF( y, sk );
     return ap * smear;
   }
@@ -199,25 +562,65 @@ double
 SiPMPdf::gauss_k( const int k ) const
 {
   const double pk = ped+gain * k;
-  const double sk = TMath::Sqrt( s0 * s0+k * s1 * s1 );
+  const double sk = std::sqrt( s0 * s0+k * s1 * s1 );
+  const double g  = vecmath::NormalPdf( x, pk, sk );
 
   // Adding dark current to all Geiger discharge peaks
-  if( dcfraction == 0. || k > 0  ){
-    return TMath::Gaus( x, pk, sk, true );
+  return k > 0 ? g : dark_mix( g );
+}
+
+
+/**
+ * @brief Mixing the pedestal Gaussian with the dark current distribution.
+ */
+double
+SiPMPdf::dark_mix( const double gauss0 ) const
+{
+  if( dcfraction == 0. ){
+    return gauss0;
   } else {
-    mdistro.SetParam( 0, gain, epsilon, TMath::Sqrt( s0 * s0+s1 * s1 ) );
-    return ( 1-dcfraction ) * TMath::Gaus( x, pk, sk, true )
-           +dcfraction * mdistro.Evaluate( x-pk );
+    return ( 1-dcfraction ) * gauss0
+           +dcfraction * dark_table()->Evaluate( x-ped );
   }
 }
 
 
+/**
+ * @brief Dark current distribution table at the current parameter values.
+ */
+std::shared_ptr<const MDistro::Table>
+SiPMPdf::dark_table() const
+{
+  return mdistro.Lookup( 0, gain, epsilon, std::sqrt( s0 * s0+s1 * s1 ) );
+}
+
+
+/**
+ * @brief Dark current distribution set to the current parameter values. This
+ * modifies the MDistro instance, and is not meant for concurrent use.
+ */
+MDistro&
+SiPMPdf::darkdistro()
+{
+  mdistro.SetParam( 0, gain, epsilon, std::sqrt( s0 * s0+s1 * s1 ) );
+  return mdistro;
+}
+
+
 double
 SiPMPdf::binomial_prob( const int k, const int i ) const
 {
-  if( alpha > 0 ){
-    return TMath::BinomialI( alpha, k, i )
-           -TMath::BinomialI( alpha, k, i+1 );
+  if( i < 0 || i > k ){
+    return 0;
+  } else if( alpha >= 1 ){
+    return i == k ? 1 : 0;
+  } else if( alpha > 0 ){
+    // Binomial probability in log space. The log-factorials have no vecmath
+    // counterpart and are left to TMath, as there is one call per term.
+    return vecmath::Exp( TMath::LnGamma( k+1 )-TMath::LnGamma( i+1 )
+                         -TMath::LnGamma( k-i+1 )
+                         +i * vecmath::Log( alpha )
+                         +( k-i ) * vecmath::Log( 1-alpha ) );
   } else {
     return i == 0 ?
            1 :
@@ -239,47 +642,249 @@ SiPMPdf::getAnalyticalIntegral( RooArgSet& allvars,
 }
 
 
+/**
+ * @brief Normalization integral over the named range. RooFit requests the
+ * normalization much more often than the parameters change, so the results are
+ * cached per range name, and only recalculated if the range or any of the
+ * parameters (including the evaluation backend choice) have changed.
+ */
 double
 SiPMPdf::analyticalIntegral( const int code, const char*range ) const
 {
   assert( code == 1 );
-  const double xmin = x.min( range );
-  const double xmax = x.max( range );
-  return analyticalIntegral( xmax )-analyticalIntegral( xmin );
+  const double      xmin = x.min( range );
+  const double      xmax = x.max( range );
+  const RooRealVar* var  = dynamic_cast<const RooRealVar*>( &x.arg() );
+  const uint64_t    hash = usr::OrderedHash64( {
+    xmin, xmax, ped, gain, s0, s1, mean, lambda, alpha, beta, dcfraction,
+    epsilon, (double)_evalmode, (double)fft_minbins, (double)GetDarkMode(),
+    var ? (double)var->getBins() : 0.} );
+
+  const std::string name = range ? range : "";
+
+  SIPMCALIB_COUNT( kSiPMPdfIntegral, 1 );
+
+  {
+    std::lock_guard<std::mutex> lock( _intmutex );
+    const auto                  it = _intcache.find( name );
+    if( it != _intcache.end() && it->second.first == hash ){
+      SIPMCALIB_COUNT( kSiPMPdfIntegralHit, 1 );
+      return it->second.second;
+    }
+  }
+
+  // Calculated without the lock, concurrent misses give identical results.
+  const double ans = analyticalIntegral( xmax )-analyticalIntegral( xmin );
+
+  std::lock_guard<std::mutex> lock( _intmutex );
+  _intcache[name] = std::make_pair( hash, ans );
+  return ans;
 }
 
 
 double
-SiPMPdf::analyticalIntegral( const double x ) const
+SiPMPdf::analyticalIntegral( const double xx ) const
 {
-  double ans = gen_poisson( 0 ) * erf_k( x, 0 );
+  const auto fft = fft_table();
+  if( fft && fft->InRange( xx ) ){
+    return fft->EvaluateAccum( xx )
+           +gen_poisson( 0 ) * dark_mix_cdf( xx, 0 );
+  }
 
-  for( int k = 1; k < mean+10 * TMath::Sqrt( mean )+15; ++k ){
-    double ans_k = binomial_prob( k, 0 ) * erf_k( x, k );
+  return integral_direct( xx );
+}
 
-    for( int i = 1; i <= k; ++i ){
-      ans_k += binomial_prob( k, i ) * erf_ap_eff( x, k, i );
-    }
 
-    ans += gen_poisson( k ) * ans_k;
+double
+SiPMPdf::integral_direct( const double xx ) const
+{
+  if( alpha > 0 ){
+    return dcfraction != 0 ?
+           integral_variant<true, true>( xx ) :
+           integral_variant<true, false>( xx );
+  } else {
+    return dcfraction != 0 ?
+           integral_variant<false, true>( xx ) :
+           integral_variant<false, false>( xx );
+  }
+}
+
+
+template<bool AP, bool DC>
+double
+SiPMPdf::integral_variant( const double xx ) const
+{
+  Workspace&           w  = fill_peaks();
+  const unsigned       n  = w.n;
+  std::vector<double>& pk = w.pk;
+  std::vector<double>& sk = w.sk;
+  std::vector<double>& f0 = w.f0;
+  std::vector<double>& f1 = w.f1;
+  std::vector<double>& f2 = w.f2;
+  std::vector<double>& pp = w.pp;
+  std::vector<double>& bi = w.bi;
+
+  SIPMCALIB_COUNT( kSiPMPdfDirect, 1 );
+  SIPMCALIB_COUNT( kSiPMPdfTerms, n );
+
+  vecmath::NormalCdf( xx, pk.data(), sk.data(), f0.data(), n );
+
+  const double ans0 = DC ?
+                      pp[0] * dark_mix_cdf( xx, f0[0] ) :
+                      pp[0] * f0[0];
+
+  if( !AP ){
+    return ans0+PeakSum( pp.data(), f0.data(), n );
+  }
+
+  // Single afterpulse CDF terms, the shifted Gaussian CDF
+  // GaussCDF( y+s^2/beta, s ) is evaluated as a batch.
+  for( unsigned k = 0; k < n; ++k ){
+    f1[k] = pk[k]-sk[k] * sk[k] / beta;
+    f2[k] = -( xx-pk[k] ) / beta;
+  }
+
+  vecmath::NormalCdf( xx, f1.data(), sk.data(), f1.data(), n );
+  vecmath::Exp( f2.data(), f2.data(), n );
+
+  double ans = ans0;
+
+  for( unsigned k = 1; k < n; ++k ){
+    const double norm = vecmath::Exp( sk[k] * sk[k] / ( 2 * beta * beta ) );
+    BinomialSequence( alpha, k, bi );
+    ans += pp[k] * ( bi[0] * f0[k]
+                      +bi[1] * ( norm * f1[k]-f2[k] * f0[k] )
+                      +GammaPSum( ( xx-pk[k] ) / beta, bi.data(), k, w.gt ) );
   }
 
   return ans;
 }
 
 
+/**
+ * @brief Cumulative distribution at all the bin edges of a histogram, such that
+ * the expected fraction of entries of bin i is cdf[i+1]-cdf[i].
+ *
+ * @details The sum is arranged with the discharge peaks in the outer loop, so
+ * that the per-peak terms (Poisson probability, binomial afterpulse sequence
+ * and the Gaussian normalization factors) are calculated once for all edges,
+ * and the Gaussian CDF and exponential terms are evaluated as a batch over the
+ * edges. The cost per edge is thus about that of a single analyticalIntegral()
+ * call.
+ */
+void
+SiPMPdf::EdgeCDF( const std::vector<double>& edges,
+                  std::vector<double>&       cdf ) const
+{
+  const unsigned ne = edges.size();
+  cdf.assign( ne, 0 );
+  if( ne == 0 ){ return; }
+
+  const auto range = std::minmax_element( edges.begin(), edges.end() );
+
+  const auto fft = fft_table();
+
+  if( fft
+      && fft->InRange( *range.first )
+      && fft->InRange( *range.second ) ){
+    for( unsigned i = 0; i < ne; ++i ){
+      cdf[i] = fft->EvaluateAccum( edges[i] );
+    }
+
+    if( dcfraction != 0 ){
+      const double p0 = gen_poisson( 0 );
+      const auto   md = dark_table();
+
+      for( unsigned i = 0; i < ne; ++i ){
+        cdf[i] += p0 * dcfraction * md->EvaluateAccum( edges[i]-ped );
+      }
+    }
+
+    return;
+  }
+
+  Workspace&           w  = fill_peaks();
+  const unsigned       n  = w.n;
+  std::vector<double>& pk = w.pk;
+  std::vector<double>& sk = w.sk;
+  std::vector<double>& pp = w.pp;
+  std::vector<double>& bi = w.bi;
+  std::vector<double> g0( ne );
+  std::vector<double> g1( ne );
+  std::vector<double> ex( ne );
+
+  SIPMCALIB_COUNT( kSiPMPdfDirect, ne );
+  SIPMCALIB_COUNT( kSiPMPdfTerms, (uint64_t)n * ne );
+
+  // Pedestal term with the dark current mixing
+  vecmath::NormalCdf( edges.data(), pk[0], sk[0], g0.data(), ne );
+  if( dcfraction != 0 ){
+    const auto md = dark_table();
+
+    for( unsigned i = 0; i < ne; ++i ){
+      cdf[i] = pp[0] * ( ( 1-dcfraction ) * g0[i]
+                          +dcfraction * md->EvaluateAccum( edges[i]-ped ) );
+    }
+  } else {
+    for( unsigned i = 0; i < ne; ++i ){
+      cdf[i] = pp[0] * g0[i];
+    }
+  }
+
+  for( unsigned k = 1; k < n; ++k ){
+    vecmath::NormalCdf( edges.data(), pk[k], sk[k], g0.data(), ne );
+
+    if( !( alpha > 0 ) ){
+      for( unsigned i = 0; i < ne; ++i ){
+        cdf[i] += pp[k] * g0[i];
+      }
+
+      continue;
+    }
+
+    const double norm = vecmath::Exp( sk[k] * sk[k] / ( 2 * beta * beta ) );
+    BinomialSequence( alpha, k, bi );
+
+    for( unsigned i = 0; i < ne; ++i ){
+      ex[i] = -( edges[i]-pk[k] ) / beta;
+    }
+
+    vecmath::NormalCdf( edges.data(), pk[k]-sk[k] * sk[k] / beta, sk[k],
+                        g1.data(), ne );
+    vecmath::Exp( ex.data(), ex.data(), ne );
+
+    for( unsigned i = 0; i < ne; ++i ){
+      cdf[i] += pp[k] * ( bi[0] * g0[i]
+                           +bi[1] * ( norm * g1[i]-ex[i] * g0[i] )
+                           +GammaPSum( ( edges[i]-pk[k] ) / beta,
+                                       bi.data(), k, w.gt ) );
+    }
+  }
+}
+
+
 double
 SiPMPdf::erf_k( const double xx, const int k ) const
 {
   const double pk = ped+gain * k;
-  const double sk = TMath::Sqrt( s0 * s0+k * s1 * s1 );
+  const double sk = std::sqrt( s0 * s0+k * s1 * s1 );
+  const double g  = GaussCDF( xx-pk, sk );
 
-  if( dcfraction == 0 || k > 0 ){
-    return GaussCDF( xx-pk, sk );
+  return k > 0 ? g : dark_mix_cdf( xx, g );
+}
+
+
+/**
+ * @brief Cumulative counterpart of the dark_mix method.
+ */
+double
+SiPMPdf::dark_mix_cdf( const double xx, const double cdf0 ) const
+{
+  if( dcfraction == 0 ){
+    return cdf0;
   } else {
-    mdistro.SetParam( 0, gain, epsilon, TMath::Sqrt( s0 * s0+s1 * s1 ) );
-    return ( 1-dcfraction ) * GaussCDF( xx-pk, sk )
-           +dcfraction * mdistro.EvaluateAccum( xx-pk );
+    return ( 1-dcfraction ) * cdf0
+           +dcfraction * dark_table()->EvaluateAccum( xx-ped );
   }
 }
 
@@ -288,29 +893,14 @@ double
 SiPMPdf::erf_ap_eff( const double xx, const int k, const int i ) const
 {
   const double pk = ped+gain * k;
-  const double sk = TMath::Sqrt( s0 * s0+k * s1 * s1 );
+  const double sk = std::sqrt( s0 * s0+k * s1 * s1 );
   const double y  = xx-pk;
 
   if( i > 1 ){
-    if( y < 0 ){
-      return 0;
-    } else {
-      const double ans1 = TMath::Gamma( i, y / beta );
-      assert( ans1 >= 0 );
-      assert( ans1 <= 1 );
-      return TMath::Gamma( i, y / beta );
-    }
+    return y < 0 ? 0 : GammaP( i, y / beta );
   } else {
-    static const double sqrt2 = TMath::Sqrt( 2 );
-    const double        norm  = TMath::Exp( sk * sk / ( 2 * beta * beta ) );
-    const double        cdf1  = 0.5
-                                * ( TMath::Erf( sk / ( sqrt2 * beta )+y
-                                                / ( sqrt2 * sk ) )+1 );
-    const double ans2 = norm * cdf1-TMath::Exp( -y / beta ) * GaussCDF(
-      y,
-      sk );
-
-    // assert( ans2 >= 0 );
-    return ans2;
+    const double norm = vecmath::Exp( sk * sk / ( 2 * beta * beta ) );
+    const double cdf1 = GaussCDF( y+sk * sk / beta, sk );
+    return norm * cdf1-vecmath::Exp( -y / beta ) * GaussCDF( y, sk );
   }
 }
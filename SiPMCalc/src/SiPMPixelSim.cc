@@ -0,0 +1,464 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/Philox.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMPixelSim.hpp"
+#include "SiPMCalib/SiPMCalc/interface/VecMath.hpp"
+
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdexcept>
+
+/**
+ * @class SiPMPixelSim
+ * @ingroup SiPMCalc
+ * @brief Event level simulation of the pixel occupancy of a SiPM, for checking
+ * the non-linear response models against a known number of photons.
+ *
+ * @details Each event simulates the discharges of the npixels pixels (on a
+ * square grid filled row by row) for a LED pulse of a given mean number of
+ * effective (PDE multiplied) photons, the same x as the LOModel and NLOModel
+ * functions:
+ *
+ * - The number of photons is Poisson distributed, with uniformly distributed
+ *   pixels and arrival times following the LED pulse shape
+ *   exp(-t/leddecay)-exp(-t/ledrise).
+ * - A discharge on a pixel that has already fired only happens if the pixel
+ *   has recharged enough: with the recovered fraction
+ *   q = 1-exp(-dt/recovery) of the overvoltage as the probability, and q as
+ *   the discharge charge.
+ * - Each discharge of charge q triggers a crosstalk discharge on one of the 4
+ *   neighbouring pixels with probability crosstalk*q at the same time, and an
+ *   afterpulse on the same pixel with probability afterpulse*q, delayed by an
+ *   exponential time of mean aptime. The secondary discharges follow the same
+ *   recovery rules, so the cascades are also suppressed by the occupancy.
+ * - The readout is ped+gain*sum(q)+noise, summing the charges of the
+ *   discharges inside the integration window (the pulse tails are not
+ *   modelled), with Gaussian noise.
+ *
+ * The occupancy is held as a bitset of 64-bit words which is cleared with a
+ * single memset per event, the last discharge time of a pixel is only read
+ * when its bit is set, and the number of distinct fired pixels is the
+ * population count of the bitset. The sorted photon arrival times are obtained
+ * without sorting, as the normalized cumulative sums of exponential spacings
+ * (batched logarithms) mapped through the tabulated inverse of the pulse
+ * cumulative distribution, and merged in time with a heap of the pending
+ * secondary discharges.
+ *
+ * The random numbers come from the Philox counter-based generator with the
+ * seed as the key, and the event index and draw number as the counter, so each
+ * event only depends on the seed and its index. The events of the Run method
+ * are split into batches of batch_size events distributed over a ThreadPool,
+ * and the results do not depend on the number of threads.
+ */
+
+unsigned SiPMPixelSim::batch_size = 16;
+
+const SiPMPixelSim::Settings SiPMPixelSim::default_settings = {
+  7500,// npixels
+  1.0,// gain
+  0.0,// ped
+  0.0,// noise
+  1.0,// ledrise
+  4.0,// leddecay
+  8.0,// recovery
+  0.05,// crosstalk
+  0.05,// afterpulse
+  10.0,// aptime
+  60.0// window
+};
+
+// Draw numbers of the counter {sub-index, event index, draw}: the event level
+// numbers (number of photons and noise), the batched photon numbers, and the
+// secondary discharges.
+static const uint32_t event_draw     = 0;
+static const uint32_t photon_draw    = 1;
+static const uint32_t secondary_draw = 2;
+
+// Number of intervals in the inverse pulse table
+static const unsigned pulse_table_size = 4096;
+
+/**
+ * @brief Discharge pending in the time ordered heap. A discharge on a fired
+ * pixel happens if its uniform number u is below 1-exp(-dt/recovery), or
+ * equivalently if the time since the last discharge dt is above
+ * wait = -recovery*log(1-u), so the uniform number is stored as the waiting
+ * time.
+ */
+struct Discharge
+{
+  double   time;
+  double   wait;
+  unsigned pixel;
+
+  inline bool
+  operator>( const Discharge& x ) const { return time > x.time; }
+};
+
+
+/**
+ * @brief Per thread scratch arrays of an event.
+ */
+struct SiPMPixelSim::Workspace
+{
+  std::vector<uint64_t>  bits;
+  std::vector<double>    last;// Last discharge time of the pixels
+  std::vector<unsigned>  pixel;
+  std::vector<double>    wait;
+  std::vector<double>    time;
+  std::vector<Discharge> heap;
+
+  void
+  Reset( const unsigned npixels, const unsigned nphotons )
+  {
+    bits.assign( ( npixels+63 ) / 64, 0 );
+    last.resize( npixels );
+    pixel.resize( nphotons+1 );
+    wait.resize( nphotons+1 );
+    time.resize( nphotons+1 );
+    heap.clear();
+  }
+};
+
+
+static inline philox::Counter
+Draw( const philox::Key key,
+      const uint64_t    index,
+      const uint32_t    sub,
+      const uint32_t    draw )
+{
+  return philox::Generate( philox::Counter{ sub, (uint32_t)index, draw, 0 },
+                           key );
+}
+
+
+/**
+ * @brief Poisson number of photons from a uniform number u, by inversion of
+ * the cumulative distribution for small means, and from the Gaussian number z
+ * with the normal approximation for large means.
+ */
+static unsigned
+Poisson( const double mean, const double u, const double z )
+{
+  if( mean >= 64 ){
+    return std::max( std::llround( mean+std::sqrt( mean ) * z ), 0LL );
+  }
+
+  const unsigned kmax = std::ceil( mean+20 * std::sqrt( mean )+20 );
+  double         p    = std::exp( -mean );
+  double         cdf  = p;
+  unsigned       k    = 0;
+
+  while( u >= cdf && k < kmax ){
+    ++k;
+    p   *= mean / k;
+    cdf += p;
+  }
+
+  return k;
+}
+
+
+SiPMPixelSim::SiPMPixelSim( const Settings& settings,
+                            const uint64_t  seed,
+                            const unsigned  nthreads ) :
+  _settings( settings ),
+  _seed    ( seed ),
+  _pool    ( nthreads )
+{
+  const Settings& s = _settings;
+
+  if( s.npixels == 0 || !( s.gain > 0 ) || s.noise < 0 ){
+    throw std::invalid_argument( usr::fstr(
+                                   "Invalid pixels, gain or noise (%u,%lf,%lf)",
+                                   s.npixels, s.gain, s.noise ) );
+  }
+  if( !( s.ledrise > 0 ) || !( s.leddecay > 0 ) || !( s.recovery > 0 )
+      || !( s.window > 0 ) ){
+    throw std::invalid_argument( usr::fstr(
+                                   "Invalid time constants (%lf,%lf,%lf,%lf)",
+                                   s.ledrise, s.leddecay, s.recovery,
+                                   s.window ) );
+  }
+  if( s.crosstalk < 0 || s.afterpulse < 0 || s.crosstalk+s.afterpulse >= 1
+      || ( s.afterpulse > 0 && !( s.aptime > 0 ) ) ){
+    throw std::invalid_argument( usr::fstr(
+                                   "Invalid crosstalk or afterpulse "
+                                   "(%lf,%lf,%lf)",
+                                   s.crosstalk, s.afterpulse, s.aptime ) );
+  }
+
+  _width = std::ceil( std::sqrt( (double)s.npixels ) );
+  make_pulse_table();
+}
+
+
+/**
+ * @brief Inverse of the cumulative distribution of the LED pulse shape at the
+ * uniform grid of pulse_table_size intervals, by bisection. The last entry is
+ * the time at which all but 1e-12 of the pulse has arrived.
+ */
+void
+SiPMPixelSim::make_pulse_table()
+{
+  const double rise  = _settings.ledrise;
+  const double decay = std::abs( _settings.leddecay-rise ) > 1e-3 * rise ?
+                       _settings.leddecay :
+                       rise * ( 1+1e-3 );
+  const double tmax = 50 * ( rise+decay );
+
+  auto cdf = [rise, decay]( const double t ){
+               return 1-( decay * std::exp( -t / decay )
+                          -rise * std::exp( -t / rise ) ) / ( decay-rise );
+             };
+
+  _pulse_inv.resize( pulse_table_size+1 );
+
+  for( unsigned j = 0; j <= pulse_table_size; ++j ){
+    const double target = j < pulse_table_size ?
+                          (double)j / pulse_table_size :
+                          1-1e-12;
+    double lo = 0;
+    double hi = tmax;
+
+    for( unsigned i = 0; i < 64; ++i ){
+      const double mid = ( lo+hi ) / 2;
+      ( cdf( mid ) < target ? lo : hi ) = mid;
+    }
+
+    _pulse_inv[j] = ( lo+hi ) / 2;
+  }
+
+  _pulse_inv[0] = 0;
+}
+
+
+/**
+ * @brief Readout of a single event with the given mean number of photons and
+ * event index. The number of distinct pixels fired in the integration window
+ * is stored in fired if it is given.
+ */
+double
+SiPMPixelSim::Event( const double   photons,
+                     const uint64_t index,
+                     unsigned*      fired ) const
+{
+  static thread_local Workspace w;
+  const Settings&               s   = _settings;
+  const philox::Key             key = philox::MakeKey( _seed );
+
+  // Event level numbers: the Poisson uniform and a Box-Muller pair
+  const philox::Counter c0 = Draw( key, index, 0, event_draw );
+  const philox::Counter c1 = Draw( key, index, 1, event_draw );
+  const double          r   = std::sqrt( -2 * std::log(
+                                           1-philox::ToUniform( c0[2], c0[3] ) ) );
+  const double          phi = 2 * M_PI * philox::ToUniform( c1[0], c1[1] );
+  const unsigned        n   = Poisson( photons,
+                                       philox::ToUniform( c0[0], c0[1] ),
+                                       r * std::cos( phi ) );
+
+  w.Reset( s.npixels, n );
+
+  // Pixels and exponential spacings of the n+1 photon arrival intervals, with
+  // the uniform numbers in (0,1] for the logarithms. The fractional part of the
+  // pixel position is an independent uniform number, used for the waiting
+  // time.
+  philox::Uniform( key, index << 32, photon_draw,
+                   w.wait.data(), w.time.data(), n+1 );
+
+  for( unsigned i = 0; i <= n; ++i ){
+    const double x = w.wait[i] * s.npixels;
+    w.pixel[i] = std::min( (unsigned)x, s.npixels-1 );
+    w.wait[i]  = 1-( x-w.pixel[i] );
+    w.time[i]  = 1-w.time[i];
+  }
+
+  vecmath::Log( w.wait.data(), w.wait.data(), n+1 );
+  vecmath::Log( w.time.data(), w.time.data(), n+1 );
+
+  double sum = 0;
+
+  for( unsigned i = 0; i <= n; ++i ){
+    sum      -= w.time[i];
+    w.time[i] = sum;
+  }
+
+  // Sorted uniform numbers to arrival times
+  const double scale = pulse_table_size / sum;
+
+  for( unsigned i = 0; i < n; ++i ){
+    const double   x = std::min( w.time[i] * scale, pulse_table_size-1e-9 );
+    const unsigned j = x;
+    w.time[i] = _pulse_inv[j]+( x-j ) * ( _pulse_inv[j+1]-_pulse_inv[j] );
+  }
+
+  const double xtprob  = s.crosstalk;
+  const double approb  = s.afterpulse;
+  const bool   cascade = xtprob > 0 || approb > 0;
+  double       charge  = 0;
+  uint32_t     nsec    = 0;
+  unsigned     i       = 0;
+
+  while( true ){
+    Discharge d;
+
+    if( !w.heap.empty() && ( i == n || w.heap.front().time <= w.time[i] ) ){
+      std::pop_heap( w.heap.begin(), w.heap.end(), std::greater<Discharge>() );
+      d = w.heap.back();
+      w.heap.pop_back();
+    } else if( i < n ){
+      if( w.time[i] >= s.window ){
+        i = n;
+        continue;
+      }
+
+      d.time  = w.time[i];
+      d.wait  = -s.recovery * w.wait[i];
+      d.pixel = w.pixel[i];
+      ++i;
+    } else {
+      break;
+    }
+
+    const unsigned word = d.pixel >> 6;
+    const uint64_t bit  = uint64_t( 1 ) << ( d.pixel & 63 );
+    double         q    = 1;
+
+    if( w.bits[word] & bit ){
+      const double dt = d.time-w.last[d.pixel];
+      if( dt <= d.wait ){ continue; }
+      q = dt < 40 * s.recovery ? -std::expm1( -dt / s.recovery ) : 1;
+    }
+
+    w.bits[word]    |= bit;
+    w.last[d.pixel]  = d.time;
+    charge          += q;
+
+    if( !cascade ){ continue; }
+
+    // Secondary discharges, with 32-bit uniform numbers. The uniform number of
+    // a decision below threshold p, divided by p, is reused as an independent
+    // uniform number.
+    const philox::Counter c = Draw( key, index, nsec++, secondary_draw );
+    const double          u[4] = { c[0] * 0x1p-32, c[1] * 0x1p-32,
+                                   c[2] * 0x1p-32, c[3] * 0x1p-32 };
+
+    if( u[0] < xtprob * q ){
+      const unsigned row = d.pixel / _width;
+      const unsigned col = d.pixel % _width;
+      const unsigned dir = std::min( (unsigned)( u[1] * 4 ), 3u );
+      unsigned       nb  = s.npixels;
+
+      switch( dir ){
+      case 0: if( col > 0 ){ nb = d.pixel-1; }
+        break;
+      case 1: if( col+1 < _width ){ nb = d.pixel+1; }
+        break;
+      case 2: if( row > 0 ){ nb = d.pixel-_width; }
+        break;
+      default: nb = d.pixel+_width;
+        break;
+      }
+
+      if( nb < s.npixels ){
+        const double wait = -s.recovery * std::log1p( -u[0] / ( xtprob * q ) );
+        w.heap.push_back( Discharge{ d.time, wait, nb } );
+        std::push_heap( w.heap.begin(), w.heap.end(),
+                        std::greater<Discharge>() );
+      }
+    }
+
+    if( u[2] < approb * q ){
+      const double t = d.time-s.aptime * std::log1p( -u[3] );
+
+      if( t < s.window ){
+        const double wait = -s.recovery * std::log1p( -u[2] / ( approb * q ) );
+        w.heap.push_back( Discharge{ t, wait, d.pixel } );
+        std::push_heap( w.heap.begin(), w.heap.end(),
+                        std::greater<Discharge>() );
+      }
+    }
+  }
+
+  if( fired ){
+    unsigned count = 0;
+
+    for( const uint64_t b : w.bits ){
+      count += __builtin_popcountll( b );
+    }
+
+    *fired = count;
+  }
+
+  return s.ped+s.gain * charge+s.noise * r * std::sin( phi );
+}
+
+
+/**
+ * @brief Mean readout of nevents events for each of the mean numbers of
+ * photons. The event indices of point i are i*nevents to (i+1)*nevents-1, and
+ * must fit in 32 bits.
+ */
+std::vector<SiPMPixelSim::Result>
+SiPMPixelSim::Run( const std::vector<double>& photons, const unsigned nevents )
+{
+  SIPMCALIB_PROFILE( "SiPMPixelSim::Run" );
+
+  const uint64_t npoints = photons.size();
+  const uint64_t nbatch  = ( nevents+batch_size-1 ) / batch_size;
+
+  if( nevents == 0 || npoints * nevents > ( uint64_t( 1 ) << 32 ) ){
+    throw std::invalid_argument( usr::fstr(
+                                   "Too many events (%lu points x %u events)",
+                                   (unsigned long)npoints, nevents ) );
+  }
+  for( const double x : photons ){
+    if( !( x >= 0 ) ){
+      throw std::invalid_argument( usr::fstr( "Invalid number of photons %lf",
+                                              x ) );
+    }
+  }
+
+  // Readout sum, readout square sum and fired pixels sum of each batch
+  std::vector<std::array<double, 3> > sums( npoints * nbatch );
+
+  _pool.ParallelTasks( npoints * nbatch, [&]( const size_t task,
+                                              const unsigned ){
+    const uint64_t point = task / nbatch;
+    const uint64_t begin = ( task % nbatch ) * batch_size;
+    const uint64_t end   = std::min<uint64_t>( begin+batch_size, nevents );
+    auto&          sum   = sums[task];
+    sum = { 0, 0, 0 };
+
+    for( uint64_t e = begin; e < end; ++e ){
+      unsigned     fired;
+      const double x = Event( photons[point], point * nevents+e, &fired );
+      sum[0] += x;
+      sum[1] += x * x;
+      sum[2] += fired;
+    }
+  } );
+
+  std::vector<Result> ans( npoints );
+
+  for( uint64_t p = 0; p < npoints; ++p ){
+    std::array<double, 3> total = { 0, 0, 0 };
+
+    for( uint64_t b = 0; b < nbatch; ++b ){
+      for( unsigned j = 0; j < 3; ++j ){
+        total[j] += sums[p * nbatch+b][j];
+      }
+    }
+
+    const double mean = total[0] / nevents;
+    const double var  = nevents > 1 ?
+                        std::max( total[1]-nevents * mean * mean, 0.0 )
+                        / ( nevents-1 ) :
+                        0;
+    ans[p] = Result{ photons[p], mean, std::sqrt( var / nevents ),
+                     total[2] / nevents };
+  }
+
+  return ans;
+}
@@ -0,0 +1,554 @@
+#include "SiPMCalib/Common/interface/Profiler.hpp"
+#include "SiPMCalib/SiPMCalc/interface/Philox.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMPdf.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMToyMC.hpp"
+#include "SiPMCalib/SiPMCalc/interface/VecMath.hpp"
+
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+/**
+ * @class SiPMToyMC
+ * @ingroup SiPMCalc
+ * @brief Toy Monte Carlo generator of readout areas from the SiPM response
+ * models used in the fits.
+ *
+ * @details The areas are sampled from the physical processes behind the PDFs,
+ * rather than from the PDF shapes themselves:
+ *
+ * - kLowLight (SiPMPdf): the number of discharges k follows the generalized
+ *   Poisson distribution of mean and lambda, truncated to the same number of
+ *   peaks as the SiPMPdf sum. Each discharge has an afterpulse with probability
+ *   alpha, and the afterpulses add an exponential area of mean beta each. The
+ *   Gaussian noise has width sqrt(s0^2+k s1^2). A fraction dcfrac of the
+ *   pedestal events (k = 0) instead has a dark current pulse, which is sampled
+ *   from the M function between ped and ped+gain with the cutoff epsilon, with
+ *   the noise width of a single discharge.
+ * - kDark (SiPMDarkPdf): the same as kLowLight with mean = 0.
+ * - kCrossTalk (CrossTalkPdf): up to 4 additional discharges, with the
+ *   relative weights of the CrossTalkPdf::cross_prob method, at x0+k*gain with
+ *   the noise width sqrt(s0^2+(k+1) s1^2).
+ *
+ * The discrete distributions are sampled by inversion of their cumulative
+ * tables (using a guide table for the number of discharges), the dark current
+ * distance to the discharge edges is sampled exactly from its 1/s density, and
+ * the Gaussian noise uses the Box-Muller transform. The random numbers come
+ * from the Philox counter-based generator, with the seed as the key and the
+ * event index and draw number as the counter. Each event therefore only
+ * depends on the seed and its index, and the events are generated in blocks of
+ * block_size events distributed over a ThreadPool, with the uniform numbers and
+ * logarithms of each block computed as batched array operations. The results
+ * do not depend on the number of threads.
+ */
+
+unsigned SiPMToyMC::block_size = 4096;
+
+const SiPMToyMC::WaveSettings SiPMToyMC::default_wave = {
+  60,// nsamples
+  12,// start
+  1.0,// time
+  0.1,// adc
+  2.0,// rise
+  8.0,// decay
+  16384// baseline
+};
+
+// Draw numbers of the counter: the first draws are the batched uniform pairs,
+// the afterpulse areas start at afterpulse_draw.
+static const uint32_t afterpulse_draw = 3;
+
+/**
+ * @brief Sampling tables for the current parameter values.
+ */
+struct SiPMToyMC::Tables
+{
+  std::vector<double>   kcdf;// Cumulative probability of k discharges
+  std::vector<unsigned> guide;// Smallest k with kcdf[k] > g/guide.size()
+  std::vector<double>   width;// Noise width of k discharges
+  std::vector<double>   gain;// Position of k discharges relative to ped
+
+  // Cumulative probabilities of i afterpulses out of k discharges, starting at
+  // apoffset[k].
+  std::vector<double>   apcdf;
+  std::vector<unsigned> apoffset;
+
+  double ped;
+  double beta;
+  double dcfrac;
+  double dcwidth;
+  double dcedge;
+  double epsilon;
+  double logratio;// Log of the ratio of the largest and smallest edge distance
+
+  inline unsigned
+  Discharges( const double u ) const
+  {
+    unsigned k = guide[u * guide.size()];
+
+    while( u >= kcdf[k] ){ ++k; }
+
+    return k;
+  }
+
+  inline unsigned
+  Afterpulses( const unsigned k, const double u ) const
+  {
+    const double* cdf = apcdf.data()+apoffset[k];
+    unsigned      i   = 0;
+
+    while( u >= cdf[i] ){ ++i; }
+
+    return i;
+  }
+};
+
+
+/**
+ * @brief Per thread scratch arrays of a block.
+ */
+struct SiPMToyMC::Workspace
+{
+  std::vector<double>   u0;
+  std::vector<double>   u1;
+  std::vector<double>   u2;
+  std::vector<double>   u3;
+  std::vector<double>   z;
+  std::vector<unsigned> k;
+
+  void
+  Resize( const unsigned n )
+  {
+    u0.resize( n );
+    u1.resize( n );
+    u2.resize( n );
+    u3.resize( n );
+    z.resize( n );
+    k.resize( n );
+  }
+};
+
+
+/**
+ * @brief Cumulative table from the probabilities, normalized to the total such
+ * that the last entry is exactly 1.
+ */
+static void
+MakeCDF( std::vector<double>& p )
+{
+  double sum = 0;
+
+  for( auto& x : p ){
+    sum += x;
+    x    = sum;
+  }
+
+  for( auto& x : p ){
+    x /= sum;
+  }
+
+  p.back() = 1;
+}
+
+
+SiPMToyMC::SiPMToyMC( const Model    model,
+                      const uint64_t seed,
+                      const unsigned nthreads ) :
+  _model( model ),
+  _seed ( seed ),
+  _pool ( nthreads )
+{
+  _par[kPed]     = 0;
+  _par[kGain]    = 100;
+  _par[kS0]      = 10;
+  _par[kS1]      = 3;
+  _par[kMean]    = 2;
+  _par[kLambda]  = 0.05;
+  _par[kAlpha]   = 0.05;
+  _par[kBeta]    = 50;
+  _par[kDCFrac]  = 0.01;
+  _par[kEpsilon] = 0.01;
+  _par[kProb]    = 0.1;
+}
+
+
+void
+SiPMToyMC::SetParam( const Param i, const double val )
+{
+  _par[i] = val;
+}
+
+
+/**
+ * @brief Building the sampling tables, throws an exception for parameter
+ * values outside the domain of the model.
+ */
+SiPMToyMC::Tables
+SiPMToyMC::make_tables() const
+{
+  const double gain   = _par[kGain];
+  const double s0     = _par[kS0];
+  const double s1     = _par[kS1];
+  const double mean   = _model == kLowLight ? _par[kMean] : 0;
+  const double lambda = _par[kLambda];
+  const double alpha  = _model == kLowLight ? _par[kAlpha] : 0;
+  const double dcfrac = _model != kCrossTalk ? _par[kDCFrac] : 0;
+  const double eps    = _par[kEpsilon];
+  const double prob   = _par[kProb];
+
+  if( !( gain > 0 ) || s0 < 0 || s1 < 0 ){
+    throw std::invalid_argument( usr::fstr(
+                                   "Invalid gain or noise widths (%lf,%lf,%lf)",
+                                   gain, s0, s1 ) );
+  }
+  if( mean < 0 || lambda < 0 || lambda >= 1 ){
+    throw std::invalid_argument( usr::fstr(
+                                   "Invalid mean or lambda (%lf,%lf)",
+                                   mean, lambda ) );
+  }
+  if( alpha < 0 || alpha > 1 || ( alpha > 0 && !( _par[kBeta] > 0 ) ) ){
+    throw std::invalid_argument( usr::fstr(
+                                   "Invalid alpha or beta (%lf,%lf)",
+                                   alpha, _par[kBeta] ) );
+  }
+  if( dcfrac < 0 || dcfrac > 1
+      || ( dcfrac > 0 && !( eps > 0 && eps < gain / 2 ) ) ){
+    throw std::invalid_argument( usr::fstr(
+                                   "Invalid dark current fraction or epsilon "
+                                   "(%lf,%lf)", dcfrac, eps ) );
+  }
+  if( _model == kCrossTalk && ( prob < 0 || prob >= 1 ) ){
+    throw std::invalid_argument( usr::fstr(
+                                   "Invalid crosstalk probability %lf", prob ) );
+  }
+
+  Tables t;
+  t.ped      = _par[kPed];
+  t.beta     = _par[kBeta];
+  t.dcfrac   = dcfrac;
+  t.dcwidth  = std::sqrt( s0 * s0+s1 * s1 );
+  t.dcedge   = gain;
+  t.epsilon  = eps;
+  t.logratio = dcfrac > 0 ? std::log( ( gain-eps ) / eps ) : 0;
+
+  if( _model == kCrossTalk ){
+    // Relative weights of CrossTalkPdf::cross_prob
+    t.kcdf = { 1 / ( 1-prob ), prob, prob * prob, std::pow( prob, 3 ),
+               std::pow( prob, 4 ) };
+  } else {
+    // Same number of peaks as SiPMPdf::fill_peaks
+    const unsigned n = std::ceil( mean+10 * std::sqrt( mean )+15 );
+    t.kcdf.resize( n );
+
+    for( unsigned k = 0; k < n; ++k ){
+      t.kcdf[k] = mean > 0 ? SiPMPdf::GeneralPoissonProb( k, mean, lambda ) :
+                  k == 0;
+    }
+  }
+
+  MakeCDF( t.kcdf );
+
+  const unsigned n = t.kcdf.size();
+  t.width.resize( n );
+  t.gain.resize( n );
+
+  for( unsigned k = 0; k < n; ++k ){
+    const unsigned npix = _model == kCrossTalk ? k+1 : k;
+    t.width[k] = std::sqrt( s0 * s0+npix * s1 * s1 );
+    t.gain[k]  = k * gain;
+  }
+
+  t.guide.resize( 2 * n );
+
+  for( unsigned g = 0, k = 0; g < t.guide.size(); ++g ){
+    while( t.kcdf[k] <= (double)g / t.guide.size() ){ ++k; }
+    t.guide[g] = k;
+  }
+
+  if( alpha > 0 ){
+    t.apoffset.resize( n );
+
+    for( unsigned k = 0; k < n; ++k ){
+      // Binomial probabilities with the recurrence of the PDF evaluation
+      std::vector<double> b( k+1, 0 );
+      b[0] = std::pow( 1-alpha, k );
+
+      for( unsigned i = 0; i < k; ++i ){
+        b[i+1] = alpha < 1 ?
+                 b[i] * alpha / ( 1-alpha ) * ( k-i ) / ( i+1 ) :
+                 ( i+1 == k );
+      }
+
+      MakeCDF( b );
+      t.apoffset[k] = t.apcdf.size();
+      t.apcdf.insert( t.apcdf.end(), b.begin(), b.end() );
+    }
+  }
+
+  return t;
+}
+
+
+/**
+ * @brief Generating the n events starting at the event index first. Draw 0 is
+ * used for the number of discharges and the dark current selection, draw 1 for
+ * the Gaussian noise, draw 2 for the number of afterpulses and the dark current
+ * pulse, and the afterpulse areas use the draws from afterpulse_draw on.
+ */
+void
+SiPMToyMC::generate_block( const Tables&  t,
+                           const uint64_t first,
+                           const unsigned n,
+                           double*        out ) const
+{
+  static thread_local Workspace w;
+  const philox::Key             key = philox::MakeKey( _seed );
+  w.Resize( n );
+
+  philox::Uniform( key, first, 0, w.u0.data(), w.u1.data(), n );
+  philox::Uniform( key, first, 1, w.z.data(),  w.u2.data(), n );
+
+  // Box-Muller transform, with the uniform number in (0,1] for the logarithm
+  for( unsigned i = 0; i < n; ++i ){
+    w.z[i] = 1-w.z[i];
+  }
+
+  vecmath::Log( w.z.data(), w.z.data(), n );
+
+  for( unsigned i = 0; i < n; ++i ){
+    w.z[i] = std::sqrt( -2 * w.z[i] ) * std::cos( 2 * M_PI * w.u2[i] );
+  }
+
+  for( unsigned i = 0; i < n; ++i ){
+    const unsigned k = t.Discharges( w.u0[i] );
+    w.k[i] = k;
+    out[i] = t.ped+t.gain[k]+t.width[k] * w.z[i];
+  }
+
+  if( t.apcdf.empty() && t.dcfrac == 0 ){ return; }
+
+  philox::Uniform( key, first, 2, w.u2.data(), w.u3.data(), n );
+
+  for( unsigned i = 0; i < n; ++i ){
+    const unsigned k = w.k[i];
+
+    if( k == 0 ){
+      if( w.u1[i] >= t.dcfrac ){ continue; }
+
+      // Distance to either edge with density 1/s in [eps, gain-eps]
+      const bool   lo = w.u3[i] < 0.5;
+      const double v  = lo ? 2 * w.u3[i] : 2 * w.u3[i]-1;
+      const double s  = t.epsilon * std::exp( v * t.logratio );
+      out[i] = t.ped+( lo ? s : t.dcedge-s )+t.dcwidth * w.z[i];
+    } else if( !t.apcdf.empty() ){
+      const unsigned nap = t.Afterpulses( k, w.u2[i] );
+      if( nap == 0 ){ continue; }
+
+      // Erlang distributed sum of the afterpulse areas
+      const uint64_t index = first+i;
+      double         prod  = 1;
+
+      for( unsigned j = 0; j < nap; j += 2 ){
+        const philox::Counter c = philox::Generate(
+          philox::Counter{ (uint32_t)index, (uint32_t)( index >> 32 ),
+                           afterpulse_draw+j / 2, 0 }, key );
+        prod *= 1-philox::ToUniform( c[0], c[1] );
+        if( j+1 < nap ){
+          prod *= 1-philox::ToUniform( c[2], c[3] );
+        }
+      }
+
+      out[i] -= t.beta * std::log( prod );
+    }
+  }
+}
+
+
+/**
+ * @brief Generating the n events starting at event index first into the out
+ * array.
+ */
+void
+SiPMToyMC::Generate( const uint64_t first, const uint64_t n, double* out )
+{
+  SIPMCALIB_PROFILE( "SiPMToyMC::Generate" );
+
+  const Tables   t       = make_tables();
+  const uint64_t nblocks = ( n+block_size-1 ) / block_size;
+
+  _pool.ParallelTasks( nblocks, [&]( const size_t b, const unsigned ){
+    const uint64_t begin = b * block_size;
+    const uint64_t end   = std::min( begin+block_size, n );
+    generate_block( t, first+begin, end-begin, out+begin );
+  } );
+}
+
+
+std::vector<double>
+SiPMToyMC::Generate( const uint64_t n )
+{
+  std::vector<double> ans( n );
+  Generate( 0, n, ans.data() );
+  return ans;
+}
+
+
+/**
+ * @brief Histogram of n events in nbins uniform bins between xmin and xmax,
+ * without storing the areas. Events outside the range are dropped.
+ */
+std::vector<double>
+SiPMToyMC::Histogram( const uint64_t n,
+                      const double   xmin,
+                      const double   xmax,
+                      const unsigned nbins )
+{
+  SIPMCALIB_PROFILE( "SiPMToyMC::Histogram" );
+
+  const Tables   t       = make_tables();
+  const uint64_t nblocks = ( n+block_size-1 ) / block_size;
+  const double   bw      = ( xmax-xmin ) / nbins;
+
+  std::vector<std::vector<double> > hist( _pool.NThreads(),
+                                          std::vector<double>( nbins, 0 ) );
+  std::vector<std::vector<double> > area( _pool.NThreads(),
+                                          std::vector<double>( block_size ) );
+
+  _pool.ParallelTasks( nblocks, [&]( const size_t b, const unsigned thread ){
+    const uint64_t begin = b * block_size;
+    const unsigned size  = std::min( begin+block_size, n )-begin;
+    double*        a     = area[thread].data();
+    double*        h     = hist[thread].data();
+    generate_block( t, begin, size, a );
+
+    for( unsigned i = 0; i < size; ++i ){
+      const double bin = std::floor( ( a[i]-xmin ) / bw );
+      if( bin >= 0 && bin < nbins ){
+        h[(unsigned)bin] += 1;
+      }
+    }
+  } );
+
+  for( unsigned i = 1; i < hist.size(); ++i ){
+    for( unsigned j = 0; j < nbins; ++j ){
+      hist[0][j] += hist[i][j];
+    }
+  }
+
+  return hist[0];
+}
+
+
+// Events generated per chunk when writing to files
+static const uint64_t write_chunk = 1 << 20;
+
+/**
+ * @brief Writing n events as a StdFormat file with ncol areas per row, which
+ * can be read by the SiPMLowLightFit class as integrated data (all data columns
+ * are used).
+ */
+void
+SiPMToyMC::WriteArea( const std::string& file,
+                      const uint64_t     n,
+                      const unsigned     ncol )
+{
+  std::ofstream       fout( file );
+  std::vector<double> area( std::min( n, write_chunk ) );
+  char                buf[32];
+
+  for( uint64_t first = 0; first < n; first += write_chunk ){
+    const uint64_t size = std::min( write_chunk, n-first );
+    Generate( first, size, area.data() );
+
+    for( uint64_t i = 0; i < size; ++i ){
+      const uint64_t index = first+i;
+      if( index % ncol == 0 ){
+        fout << ( index ? "\n" : "" ) << index / ncol << " 0 0 0 0 0 0 0";
+      }
+      std::snprintf( buf, sizeof( buf ), " %.3lf", area[i] );
+      fout << buf;
+    }
+  }
+
+  fout << std::endl;
+}
+
+
+/**
+ * @brief Writing the histogram of n events as a text table of the bin lower
+ * edge, upper edge and content.
+ */
+void
+SiPMToyMC::WriteHistogram( const std::string& file,
+                           const uint64_t     n,
+                           const double       xmin,
+                           const double       xmax,
+                           const unsigned     nbins )
+{
+  const std::vector<double> hist = Histogram( n, xmin, xmax, nbins );
+  const double              bw   = ( xmax-xmin ) / nbins;
+  std::ofstream             fout( file );
+
+  for( unsigned i = 0; i < nbins; ++i ){
+    fout << usr::fstr( "%lf %lf %.0lf\n",
+                       xmin+i * bw, xmin+( i+1 ) * bw, hist[i] );
+  }
+}
+
+
+/**
+ * @brief Writing n events as a WaveFormat file. Each area is converted to a
+ * pulse of the settings' shape, scaled such that the pedestal subtracted
+ * WaveFormat::WaveformSum over the pulse reproduces the area up to the
+ * digitization and the truncation of the pulse tail. The samples before the
+ * pulse start are flat at the baseline, and can be used as the pedestal
+ * window.
+ */
+void
+SiPMToyMC::WriteWaveFormat( const std::string&  file,
+                            const uint64_t      n,
+                            const WaveSettings& s )
+{
+  std::vector<double> shape( s.nsamples, 0 );
+  double              sum = 0;
+
+  for( unsigned j = s.start; j < s.nsamples; ++j ){
+    const double t = ( j-s.start+0.5 ) * s.time;
+    shape[j] = std::exp( -t / s.decay )-std::exp( -t / s.rise );
+    sum     += shape[j];
+  }
+
+  for( auto& x : shape ){
+    x /= sum * s.adc * s.time;
+  }
+
+  std::ofstream       fout( file );
+  std::vector<double> area( std::min( n, write_chunk ) );
+  std::string         line( 4 * s.nsamples, '0' );
+  static const char   hex[] = "0123456789abcdef";
+
+  fout << s.time << " 4 " << s.adc << '\n';
+
+  for( uint64_t first = 0; first < n; first += write_chunk ){
+    const uint64_t size = std::min( write_chunk, n-first );
+    Generate( first, size, area.data() );
+
+    for( uint64_t i = 0; i < size; ++i ){
+      for( unsigned j = 0; j < s.nsamples; ++j ){
+        const long v = std::min( std::max(
+                                   std::lround( s.baseline-area[i] * shape[j] ),
+                                   0L ), 0x7FFFL );
+        line[4 * j]   = hex[( v >> 12 ) & 0xF];
+        line[4 * j+1] = hex[( v >> 8 ) & 0xF];
+        line[4 * j+2] = hex[( v >> 4 ) & 0xF];
+        line[4 * j+3] = hex[v & 0xF];
+      }
+
+      fout << line << '\n';
+    }
+  }
+}
@@ -0,0 +1,95 @@
+#include "SiPMCalib/SiPMCalc/interface/UniformSpline.hpp"
+
+/**
+ * @class UniformSpline
+ * @ingroup SiPMCalc
+ * @brief Natural cubic spline over a uniform grid.
+ *
+ * @details Equivalent to the ROOT::Math::Interpolator with the kCSPLINE type
+ * (GSL natural cubic spline), but as the grid is uniform, the interval of a
+ * point is computed directly from the grid spacing instead of a binary search.
+ * The polynomial coefficients of all intervals are precomputed in flat arrays
+ * (one array per coefficient), so the evaluation is a handful of multiply-adds
+ * that can be inlined and vectorized. The evaluation does not modify the
+ * object, so a single instance can be used from multiple threads.
+ */
+
+UniformSpline::UniformSpline() :
+  _xmin   ( 0 ),
+  _step   ( 1 ),
+  _invstep( 1 ),
+  _imax   ( 0 )
+{}
+
+
+/**
+ * @brief Setting the sample values y[i] at x = xmin+i*step. The second
+ * derivatives are obtained from the tridiagonal system of the natural spline
+ *
+ * M[i-1]+4M[i]+M[i+1] = 6( y[i+1]-2y[i]+y[i-1] )/step^2, M[0] = M[n-1] = 0
+ *
+ * solved with the Thomas algorithm. At least 2 samples and a positive grid
+ * spacing are required, otherwise an std::invalid_argument exception is
+ * thrown.
+ */
+void
+UniformSpline::SetData( const double               xmin,
+                        const double               step,
+                        const std::vector<double>& y )
+{
+  const size_t n = y.size();
+
+  if( n < 2 ){
+    throw std::invalid_argument( "UniformSpline requires at least 2 samples" );
+  }
+  if( !( step > 0 ) ){
+    throw std::invalid_argument( "UniformSpline requires a positive grid step" );
+  }
+
+  _xmin    = xmin;
+  _step    = step;
+  _invstep = 1 / step;
+
+  const size_t m = n-1;// Number of intervals
+  _a.resize( m );
+  _b.resize( m );
+  _c.resize( m );
+  _d.resize( m );
+  _imax = m-1;
+
+  // Second derivatives in units of step^2 (stored in _d as scratch), with the
+  // forward elimination factors stored in _c.
+  std::vector<double> M( n, 0.0 );
+
+  if( n > 2 ){
+    _c[0] = 0;
+    _d[0] = 0;
+
+    for( size_t i = 1; i < m; ++i ){
+      const double r   = 6 * ( y[i+1]-2 * y[i]+y[i-1] );
+      const double den = 4-_c[i-1];
+      _c[i] = 1 / den;
+      _d[i] = ( r-_d[i-1] ) / den;
+    }
+
+    for( size_t i = m-1; i >= 1; --i ){
+      M[i] = _d[i]-_c[i] * M[i+1];
+    }
+  }
+
+  for( size_t i = 0; i < m; ++i ){
+    _a[i] = y[i];
+    _b[i] = ( y[i+1]-y[i] )-( 2 * M[i]+M[i+1] ) / 6;
+    _c[i] = M[i] / 2;
+    _d[i] = ( M[i+1]-M[i] ) / 6;
+  }
+}
+
+
+void
+UniformSpline::Eval( const double* x, double* out, const size_t n ) const
+{
+  for( size_t j = 0; j < n; ++j ){
+    out[j] = Eval( x[j] );
+  }
+}
@@ -0,0 +1,380 @@
+#include "SiPMCalib/SiPMCalc/interface/VecMath.hpp"
+
+#include <cstdlib>
+#include <string>
+
+// ------------------------------------------------------------------------------
+// SIMD backends. These are compiled with function level target attributes, so
+// that the library itself does not require the -mavx2/-mavx512f flags, and the
+// backend is selected at run time according to the host CPU.
+// ------------------------------------------------------------------------------
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || defined( __i386__ ) )
+#define SIPMCALIB_VECMATH_X86
+
+#pragma GCC push_options
+#pragma GCC target( "avx2,fma" )
+#include <immintrin.h>
+
+namespace vecmath
+{
+namespace avx2
+{
+
+struct Ops
+{
+  typedef __m256d V;
+  typedef __m256d M;
+  static constexpr size_t width = 4;
+
+  static inline V
+  set1( const double x ){ return _mm256_set1_pd( x ); }
+  static inline V
+  load( const double* p ){ return _mm256_loadu_pd( p ); }
+  static inline void
+  store( double* p, const V x ){ _mm256_storeu_pd( p, x ); }
+  static inline V
+  min( const V a, const V b ){ return _mm256_min_pd( a, b ); }
+  static inline V
+  max( const V a, const V b ){ return _mm256_max_pd( a, b ); }
+  static inline V
+  abs( const V a ){ return _mm256_andnot_pd( _mm256_set1_pd( -0.0 ), a ); }
+  static inline V
+  copysign( const V a, const V s )
+  {
+    const V sign = _mm256_set1_pd( -0.0 );
+    return _mm256_or_pd( _mm256_andnot_pd( sign, a ), _mm256_and_pd( sign, s ) );
+  }
+  static inline M
+  lt( const V a, const V b ){ return _mm256_cmp_pd( a, b, _CMP_LT_OQ ); }
+  static inline M
+  gt( const V a, const V b ){ return _mm256_cmp_pd( a, b, _CMP_GT_OQ ); }
+  static inline M
+  eq( const V a, const V b ){ return _mm256_cmp_pd( a, b, _CMP_EQ_OQ ); }
+  static inline M
+  isnan( const V a ){ return _mm256_cmp_pd( a, a, _CMP_UNORD_Q ); }
+  static inline bool
+  any( const M m ){ return _mm256_movemask_pd( m ) != 0; }
+  static inline bool
+  all( const M m ){ return _mm256_movemask_pd( m ) == 0xf; }
+  static inline V
+  select( const M m, const V a, const V b ){ return _mm256_blendv_pd( b, a, m ); }
+
+  static inline V
+  pow2( const V n )
+  {
+    // Integer value of n is found in the lower bits after adding the rounding
+    // magic number 2^52+2^51.
+    const __m256i bits = _mm256_castpd_si256( n+6755399441055744.0 );
+    const __m256i ni   = _mm256_sub_epi64( bits,
+                                           _mm256_set1_epi64x( 0x4338000000000000LL ) );
+    return _mm256_castsi256_pd( _mm256_slli_epi64(
+                                  _mm256_add_epi64( ni, _mm256_set1_epi64x( 1023 ) ),
+                                  52 ) );
+  }
+
+  static inline void
+  frexp1( const V x, V& m, V& e )
+  {
+    const __m256i bits = _mm256_castpd_si256( x );
+    const __m256i eb   = _mm256_and_si256( _mm256_srli_epi64( bits, 52 ),
+                                           _mm256_set1_epi64x( 0x7ff ) );
+    // Integer to double conversion using the 2^52 magic number
+    e = _mm256_castsi256_pd( _mm256_or_si256( eb,
+                                              _mm256_set1_epi64x( 0x4330000000000000LL ) ) )
+        -( 4503599627370496.0+1023.0 );
+    m = _mm256_castsi256_pd(
+      _mm256_or_si256( _mm256_and_si256( bits,
+                                         _mm256_set1_epi64x( 0x000fffffffffffffLL ) ),
+                       _mm256_set1_epi64x( 0x3ff0000000000000LL ) ) );
+  }
+};
+
+#include "SiPMCalib/SiPMCalc/interface/VecMathImpl.icc"
+
+// Explicit instantiation, so that the kernels are generated with the target
+// options of this region.
+template void ExpArray<false>( const double*, double*, size_t );
+template void ExpArray<true>( const double*, double*, size_t );
+template void LogArray<false>( const double*, double*, size_t );
+template void LogArray<true>( const double*, double*, size_t );
+template void ErfArray<false>( const double*, double*, size_t );
+template void ErfArray<true>( const double*, double*, size_t );
+template void ErfcArray<false>( const double*, double*, size_t );
+template void ErfcArray<true>( const double*, double*, size_t );
+template void NormalPdfArray<false>( const double*, const double*, const double*,
+                                     unsigned, unsigned, double*, size_t );
+template void NormalPdfArray<true>( const double*, const double*, const double*,
+                                    unsigned, unsigned, double*, size_t );
+template void NormalCdfArray<false>( const double*, const double*, const double*,
+                                     unsigned, unsigned, double*, size_t );
+template void NormalCdfArray<true>( const double*, const double*, const double*,
+                                    unsigned, unsigned, double*, size_t );
+
+}
+}
+
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target( "avx2,fma,avx512f" )
+
+// The GCC AVX-512 intrinsics headers use self-initialized _mm512_undefined_*
+// vectors as the pass-through operand of the unmasked operations, which
+// triggers spurious -Wmaybe-uninitialized warnings once they are inlined.
+#ifndef __clang__
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace vecmath
+{
+namespace avx512
+{
+
+struct Ops
+{
+  typedef __m512d V;
+  typedef __mmask8 M;
+  static constexpr size_t width = 8;
+
+  static inline V
+  set1( const double x ){ return _mm512_set1_pd( x ); }
+  static inline V
+  load( const double* p ){ return _mm512_loadu_pd( p ); }
+  static inline void
+  store( double* p, const V x ){ _mm512_storeu_pd( p, x ); }
+  static inline V
+  min( const V a, const V b ){ return _mm512_min_pd( a, b ); }
+  static inline V
+  max( const V a, const V b ){ return _mm512_max_pd( a, b ); }
+  static inline V
+  abs( const V a ){ return _mm512_abs_pd( a ); }
+  static inline V
+  copysign( const V a, const V s )
+  {
+    const __m512i sign = _mm512_set1_epi64( 0x8000000000000000LL );
+    return _mm512_castsi512_pd(
+      _mm512_or_si512( _mm512_andnot_si512( sign, _mm512_castpd_si512( a ) ),
+                       _mm512_and_si512( sign, _mm512_castpd_si512( s ) ) ) );
+  }
+  static inline M
+  lt( const V a, const V b ){ return _mm512_cmp_pd_mask( a, b, _CMP_LT_OQ ); }
+  static inline M
+  gt( const V a, const V b ){ return _mm512_cmp_pd_mask( a, b, _CMP_GT_OQ ); }
+  static inline M
+  eq( const V a, const V b ){ return _mm512_cmp_pd_mask( a, b, _CMP_EQ_OQ ); }
+  static inline M
+  isnan( const V a ){ return _mm512_cmp_pd_mask( a, a, _CMP_UNORD_Q ); }
+  static inline bool
+  any( const M m ){ return m != 0; }
+  static inline bool
+  all( const M m ){ return m == 0xff; }
+  static inline V
+  select( const M m, const V a, const V b ){ return _mm512_mask_blend_pd( m, b, a ); }
+
+  static inline V
+  pow2( const V n )
+  {
+    const __m512i bits = _mm512_castpd_si512( n+6755399441055744.0 );
+    const __m512i ni   = _mm512_sub_epi64( bits,
+                                           _mm512_set1_epi64( 0x4338000000000000LL ) );
+    return _mm512_castsi512_pd( _mm512_slli_epi64(
+                                  _mm512_add_epi64( ni, _mm512_set1_epi64( 1023 ) ),
+                                  52 ) );
+  }
+
+  static inline void
+  frexp1( const V x, V& m, V& e )
+  {
+    const __m512i bits = _mm512_castpd_si512( x );
+    const __m512i eb   = _mm512_and_si512( _mm512_srli_epi64( bits, 52 ),
+                                           _mm512_set1_epi64( 0x7ff ) );
+    e = _mm512_castsi512_pd( _mm512_or_si512( eb,
+                                              _mm512_set1_epi64( 0x4330000000000000LL ) ) )
+        -( 4503599627370496.0+1023.0 );
+    m = _mm512_castsi512_pd(
+      _mm512_or_si512( _mm512_and_si512( bits,
+                                         _mm512_set1_epi64( 0x000fffffffffffffLL ) ),
+                       _mm512_set1_epi64( 0x3ff0000000000000LL ) ) );
+  }
+};
+
+#include "SiPMCalib/SiPMCalc/interface/VecMathImpl.icc"
+
+// Explicit instantiation, so that the kernels are generated with the target
+// options of this region.
+template void ExpArray<false>( const double*, double*, size_t );
+template void ExpArray<true>( const double*, double*, size_t );
+template void LogArray<false>( const double*, double*, size_t );
+template void LogArray<true>( const double*, double*, size_t );
+template void ErfArray<false>( const double*, double*, size_t );
+template void ErfArray<true>( const double*, double*, size_t );
+template void ErfcArray<false>( const double*, double*, size_t );
+template void ErfcArray<true>( const double*, double*, size_t );
+template void NormalPdfArray<false>( const double*, const double*, const double*,
+                                     unsigned, unsigned, double*, size_t );
+template void NormalPdfArray<true>( const double*, const double*, const double*,
+                                    unsigned, unsigned, double*, size_t );
+template void NormalCdfArray<false>( const double*, const double*, const double*,
+                                     unsigned, unsigned, double*, size_t );
+template void NormalCdfArray<true>( const double*, const double*, const double*,
+                                    unsigned, unsigned, double*, size_t );
+
+}
+}
+
+#ifndef __clang__
+#pragma GCC diagnostic pop
+#endif
+#pragma GCC pop_options
+#endif
+
+// ------------------------------------------------------------------------------
+// Run time dispatch
+// ------------------------------------------------------------------------------
+namespace vecmath
+{
+
+namespace
+{
+
+typedef void (* Func1)( const double*, double*, size_t );
+typedef void (* Func3)( const double*,
+                        const double*,
+                        const double*,
+                        unsigned,
+                        unsigned,
+                        double*,
+                        size_t );
+
+struct Backend
+{
+  const char* name;
+  Func1       exp[2];
+  Func1       log[2];
+  Func1       erf[2];
+  Func1       erfc[2];
+  Func3       pdf[2];
+  Func3       cdf[2];
+};
+
+#define SIPMCALIB_VECMATH_BACKEND( NS )                                      \
+  Backend{ #NS,                                                              \
+           { NS::ExpArray<false>, NS::ExpArray<true> },                      \
+           { NS::LogArray<false>, NS::LogArray<true> },                      \
+           { NS::ErfArray<false>, NS::ErfArray<true> },                      \
+           { NS::ErfcArray<false>, NS::ErfcArray<true> },                    \
+           { NS::NormalPdfArray<false>, NS::NormalPdfArray<true> },          \
+           { NS::NormalCdfArray<false>, NS::NormalCdfArray<true> } }
+
+Backend
+select_backend()
+{
+  const char*       env    = std::getenv( "SIPMCALIB_VECMATH_ISA" );
+  const std::string forced = env ? env : "";
+
+#ifdef SIPMCALIB_VECMATH_X86
+  __builtin_cpu_init();
+  if( ( forced == "" || forced == "avx512" )
+      && __builtin_cpu_supports( "avx512f" )
+      && __builtin_cpu_supports( "fma" ) ){
+    return SIPMCALIB_VECMATH_BACKEND( avx512 );
+  }
+  if( ( forced == "" || forced == "avx512" || forced == "avx2" )
+      && __builtin_cpu_supports( "avx2" )
+      && __builtin_cpu_supports( "fma" ) ){
+    return SIPMCALIB_VECMATH_BACKEND( avx2 );
+  }
+#endif
+  return SIPMCALIB_VECMATH_BACKEND( scalar );
+}
+
+
+const Backend&
+backend()
+{
+  static const Backend b = select_backend();
+  return b;
+}
+
+}
+
+const char*
+BackendName(){ return backend().name; }
+
+void
+Exp( const double* x, double* out, size_t n, Precision p )
+{
+  backend().exp[p]( x, out, n );
+}
+
+
+void
+Log( const double* x, double* out, size_t n, Precision p )
+{
+  backend().log[p]( x, out, n );
+}
+
+
+void
+Erf( const double* x, double* out, size_t n, Precision p )
+{
+  backend().erf[p]( x, out, n );
+}
+
+
+void
+Erfc( const double* x, double* out, size_t n, Precision p )
+{
+  backend().erfc[p]( x, out, n );
+}
+
+
+void
+NormalPdf( double        x,
+           const double* mu,
+           const double* sigma,
+           double*       out,
+           size_t        n,
+           Precision     p )
+{
+  backend().pdf[p]( &x, mu, sigma, 0, 1, out, n );
+}
+
+
+void
+NormalPdf( const double* x,
+           double        mu,
+           double        sigma,
+           double*       out,
+           size_t        n,
+           Precision     p )
+{
+  backend().pdf[p]( x, &mu, &sigma, 1, 0, out, n );
+}
+
+
+void
+NormalCdf( double        x,
+           const double* mu,
+           const double* sigma,
+           double*       out,
+           size_t        n,
+           Precision     p )
+{
+  backend().cdf[p]( &x, mu, sigma, 0, 1, out, n );
+}
+
+
+void
+NormalCdf( const double* x,
+           double        mu,
+           double        sigma,
+           double*       out,
+           size_t        n,
+           Precision     p )
+{
+  backend().cdf[p]( x, &mu, &sigma, 1, 0, out, n );
+}
+
+}
@@ -0,0 +1,460 @@
+#include "SiPMCalib/Common/interface/StdFormat.hpp"
+#include "SiPMCalib/Common/interface/WaveFormat.hpp"
+#include "SiPMCalib/InvSqCalc/interface/InvSqFunc.hpp"
+#include "SiPMCalib/SiPMCalc/interface/NonLinearModel.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMDarkFunc.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMDarkPdf.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMPdf.hpp"
+#include "SiPMCalib/SiPMCalc/interface/VecMath.hpp"
+
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include "RooRealVar.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+// Micro-benchmarks of the core kernels: file parsing, waveform sums, PDF
+// evaluation and normalization, dark current convolution tables and the
+// non-linearity and inverse square models. All inputs are synthetic and
+// generated from fixed seeds, so the same work is timed on every machine.
+//
+// Each benchmark is calibrated to run for at least the minimum time per
+// repetition, and the median and minimum time per call over 5 repetitions
+// are reported, with the time per item (sample, row, evaluation point) for
+// comparing benchmarks of different sizes. The results are written as JSON.
+//
+// Usage: SiPM_Benchmark [output.json] [name filter] [min time per rep. (s)]
+
+struct Result
+{
+  std::string name;
+  unsigned    items;
+  unsigned    iterations;
+  double      median;// [ns per call]
+  double      min;
+};
+
+static std::vector<Result> results;
+static std::string         filter  = "";
+static double              mintime = 0.1;
+static volatile double     sink    = 0;// Keeps the results of the calls alive
+
+/**
+ * @brief Timing the function f, which does `items` units of work per call.
+ */
+static void
+Bench( const std::string& name, const unsigned items,
+       const std::function<double()>& f )
+{
+  typedef std::chrono::steady_clock clock;
+  if( name.find( filter ) == std::string::npos ){ return; }
+
+  auto Run = [&f]( const unsigned n ){
+               const auto t0  = clock::now();
+               double     sum = 0;
+
+               for( unsigned i = 0; i < n; ++i ){
+                 sum += f();
+               }
+
+               sink = sink+sum;
+               return std::chrono::duration<double>( clock::now()-t0 ).count();
+             };
+
+  // Warm up (caches, lazily created tables), then doubling the number of
+  // iterations until a repetition takes the minimum time.
+  unsigned n = 1;
+  Run( 1 );
+
+  while( Run( n ) < mintime && n < ( 1u << 30 ) ){
+    n *= 2;
+  }
+
+  std::vector<double> t;
+
+  for( unsigned r = 0; r < 5; ++r ){
+    t.push_back( Run( n ) * 1e9 / n );
+  }
+
+  std::sort( t.begin(), t.end() );
+  results.push_back( Result{ name, items, n, t[2], t[0] } );
+
+  std::printf( "%-52s %10.1lf ns/call %10.3lf ns/item\n",
+               name.c_str(), t[2], t[2] / items );
+}
+
+
+// ------------------------------------------------------------------------------
+// Deterministic inputs. The std distributions are implementation defined, so
+// the numbers are derived from the raw mt19937_64 output directly.
+// ------------------------------------------------------------------------------
+static std::mt19937_64 rng( 20200601 );
+
+static double
+Uniform()
+{
+  return ( rng() >> 11 ) * 0x1.0p-53;
+}
+
+
+static double
+Gauss()
+{
+  const double u = 1-Uniform();
+  return std::sqrt( -2 * std::log( u ) ) * std::cos( 2 * M_PI * Uniform() );
+}
+
+
+/**
+ * @brief DRS4-like waveform file: 8 bit samples (2 hex digits, inverted) with
+ * a pedestal, Gaussian noise and 0-3 discharge pulses in a fixed window.
+ */
+static void
+MakeWaveFile( const std::string& file,
+              const unsigned     nwave,
+              const unsigned     nsample )
+{
+  std::ofstream fout( file );
+  fout << "0.2 2 0.5" << std::endl;
+
+  std::vector<double> w( nsample );
+
+  for( unsigned i = 0; i < nwave; ++i ){
+    const unsigned npulse = rng() % 4;
+
+    for( unsigned j = 0; j < nsample; ++j ){
+      w[j] = 100+2 * Gauss();
+    }
+
+    for( unsigned p = 0; p < npulse; ++p ){
+      for( unsigned j = nsample / 4; j < nsample; ++j ){
+        const double t = ( j-nsample / 4.0 ) / 8;
+        w[j] -= 12 * ( std::exp( -t / 4 )-std::exp( -t ) );
+      }
+    }
+
+    for( unsigned j = 0; j < nsample; ++j ){
+      const int v = std::min( std::max( (int)std::lround( w[j] ), 0 ), 127 );
+      char      buf[3];
+      std::snprintf( buf, sizeof( buf ), "%02x", v );
+      fout << buf;
+    }
+
+    fout << "\n";
+  }
+}
+
+
+/**
+ * @brief Standard format file with the 8 fixed columns and ndata data
+ * columns.
+ */
+static void
+MakeStdFile( const std::string& file,
+             const unsigned     nrow,
+             const unsigned     ndata )
+{
+  std::ofstream fout( file );
+
+  for( unsigned i = 0; i < nrow; ++i ){
+    char buf[256];
+    std::snprintf( buf, sizeof( buf ),
+                   "%.2lf %d %.1lf %.1lf %.1lf %.2lf %.2lf %.2lf",
+                   0.5 * i, 0, 100+Uniform(), 100+Uniform(),
+                   10+10 * ( i % 40 ), 1500+Uniform(), 25+Uniform(),
+                   25+Uniform() );
+    fout << buf;
+
+    for( unsigned j = 0; j < ndata; ++j ){
+      std::snprintf( buf, sizeof( buf ), " %.4lf", 1000 * Uniform() );
+      fout << buf;
+    }
+
+    fout << "\n";
+  }
+}
+
+
+static void
+BenchFiles( const std::string& dir )
+{
+  const std::string wavefile = dir+"/wave.txt";
+  const std::string stdfile  = dir+"/std.txt";
+  const unsigned    nwave    = 2000;
+  const unsigned    nsample  = 1024;
+  const unsigned    nrow     = 20000;
+
+  MakeWaveFile( wavefile, nwave, nsample );
+  MakeStdFile( stdfile, nrow, 4 );
+
+  Bench( "WaveFormat::Read", nwave * nsample, [&](){
+    return WaveFormat( wavefile ).NWaveforms();
+  } );
+
+  const WaveFormat wave( wavefile );
+  unsigned         index = 0;
+
+  Bench( "WaveFormat::WaveformSum", nsample * 3 / 4, [&](){
+    index = ( index+1 ) % nwave;
+    return wave.WaveformSum( index, nsample / 4, nsample, 0, nsample / 8 );
+  } );
+
+  Bench( "WaveFormat::SumList", nwave, [&](){
+    return wave.SumList( nsample / 4, nsample, 0, nsample / 8 ).front();
+  } );
+
+  Bench( "StdFormat::Read", nrow, [&](){
+    return StdFormat( stdfile ).DataAll().size();
+  } );
+}
+
+
+/**
+ * @brief Evaluation and normalization of the SiPMPdf over a grid of typical
+ * low light parameters, with the direct evaluation backend (every evaluation
+ * sums the discharge peaks) and the FFT whole-spectrum backend.
+ */
+static void
+BenchSiPMPdf()
+{
+  RooRealVar x( "x", "x", -100, 3000 );
+  RooRealVar ped( "ped", "ped", 0 );
+  RooRealVar gain( "gain", "gain", 120 );
+  RooRealVar s0( "s0", "s0", 8 );
+  RooRealVar s1( "s1", "s1", 3 );
+  RooRealVar mean( "mean", "mean", 4 );
+  RooRealVar lambda( "lambda", "lambda", 0.05 );
+  RooRealVar alpha( "alpha", "alpha", 0.05 );
+  RooRealVar beta( "beta", "beta", 80 );
+  RooRealVar dcfrac( "dcfrac", "dcfrac", 0.02 );
+  RooRealVar eps( "eps", "eps", 0.01 );
+
+  SiPMPdf pdf( "pdf", "pdf", x, ped, gain, s0, s1, mean, lambda,
+               alpha, beta, dcfrac, eps );
+
+  std::vector<double> pts;
+
+  for( unsigned i = 0; i < 1000; ++i ){
+    pts.push_back( -100+3100 * Uniform() );
+  }
+
+  auto Evaluate = [&](){
+                    double sum = 0;
+
+                    for( const double v : pts ){
+                      x.setVal( v );
+                      sum += pdf.Eval();
+                    }
+
+                    return sum;
+                  };
+
+  auto Integrate = [&](){
+                     double sum = 0;
+
+                     for( const double v : pts ){
+                       sum += pdf.analyticalIntegral( v );
+                     }
+
+                     return sum;
+                   };
+
+  pdf.SetEvalMode( SiPMPdf::kDirect );
+
+  for( const double m : { 1.0, 4.0, 10.0 } ){
+    for( const double a : { 0.0, 0.05 } ){
+      for( const double d : { 0.0, 0.02 } ){
+        mean   = m;
+        alpha  = a;
+        dcfrac = d;
+
+        const std::string tag = usr::fstr( "/mean=%.0lf,alpha=%.2lf,dc=%.2lf",
+                                           m, a, d );
+        Bench( "SiPMPdf::evaluate"+tag, pts.size(), Evaluate );
+        Bench( "SiPMPdf::analyticalIntegral"+tag, pts.size(), Integrate );
+      }
+    }
+  }
+
+  // Full parameter dependence: the FFT table is rebuilt for every call, then
+  // the lookups of the same table.
+  mean   = 4;
+  alpha  = 0.05;
+  dcfrac = 0.02;
+  x.setBins( 8192 );
+  pdf.SetEvalMode( SiPMPdf::kFFT );
+
+  Bench( "SiPMPdf::evaluate[fft]", pts.size(), Evaluate );
+
+  unsigned iter = 0;
+  Bench( "SiPMPdf::evaluate[fft,rebuild]", 1, [&](){
+    mean = 4+1e-6 * ( ++iter % 1000 );
+    x.setVal( pts[iter % pts.size()] );
+    return pdf.Eval();
+  } );
+  mean = 4;
+}
+
+
+/**
+ * @brief Construction and evaluation of the dark current tables. The table
+ * rebuilds use a fresh smearing width (or epsilon) for every call, so that
+ * the cached tables are never reused.
+ */
+static void
+BenchMDistro()
+{
+  std::vector<double> pts;
+
+  for( unsigned i = 0; i < 1000; ++i ){
+    pts.push_back( -30+180 * Uniform() );
+  }
+
+  for( const auto mode : { MDistro::kFFT, MDistro::kQuadrature } ){
+    const std::string tag = mode == MDistro::kFFT ? "[fft]" : "[quad]";
+    MDistro           m( std::make_shared<MDistro::Cache>(), mode );
+    unsigned          iter = 0;
+
+    Bench( "MDistro::Lookup"+tag+"/new width", 1, [&](){
+      return m.Lookup( 0, 120, 0.01, 8+1e-6 * ( ++iter ) )->width;
+    } );
+
+    Bench( "MDistro::Lookup"+tag+"/new epsilon", 1, [&](){
+      return m.Lookup( 0, 120, 0.01+1e-9 * ( ++iter ), 8 )->width;
+    } );
+
+    const auto table = m.Lookup( 0, 120, 0.01, 8 );
+    Bench( "MDistro::Evaluate"+tag, pts.size(), [&](){
+      double sum = 0;
+
+      for( const double v : pts ){
+        sum += table->Evaluate( v );
+      }
+
+      return sum;
+    } );
+    Bench( "MDistro::EvaluateAccum"+tag, pts.size(), [&](){
+      double sum = 0;
+
+      for( const double v : pts ){
+        sum += table->EvaluateAccum( v );
+      }
+
+      return sum;
+    } );
+  }
+
+  RooRealVar  x( "x", "x", -100, 300 );
+  RooRealVar  ped( "ped", "ped", 0 );
+  RooRealVar  gain( "gain", "gain", 120 );
+  RooRealVar  s0( "s0", "s0", 8 );
+  RooRealVar  s1( "s1", "s1", 3 );
+  RooRealVar  dcfrac( "dcfrac", "dcfrac", 0.02 );
+  RooRealVar  eps( "eps", "eps", 0.01 );
+  SiPMDarkPdf pdf( "dark", "dark", x, ped, gain, s0, s1, dcfrac, eps );
+
+  Bench( "SiPMDarkPdf::evaluate", pts.size(), [&](){
+    double sum = 0;
+
+    for( const double v : pts ){
+      x.setVal( v );
+      sum += pdf.getVal();
+    }
+
+    return sum;
+  } );
+}
+
+
+static void
+BenchModels()
+{
+  std::vector<double> pts;
+
+  for( unsigned i = 0; i < 1000; ++i ){
+    pts.push_back( 1e5 * Uniform() );
+  }
+
+  const double nlopar[5] = { 1.2, 14400, 0.5, 0.1, 2.0 };
+  Bench( "NLOModel", pts.size(), [&](){
+    double sum = 0;
+
+    for( const double& v : pts ){
+      sum += NLOModel( &v, nlopar );
+    }
+
+    return sum;
+  } );
+
+  const double invsqpar[5] = { 10, 0.5, 1e3, 0.2, 1e3 };
+  Bench( "InvSq_Z", pts.size(), [&](){
+    double sum = 0;
+
+    for( const double& v : pts ){
+      const double z = 20+v / 1000;
+      sum += InvSq_Z( &z, invsqpar );
+    }
+
+    return sum;
+  } );
+}
+
+
+static void
+WriteJSON( const std::string& file )
+{
+  std::ofstream fout( file );
+  fout << "{\n"
+       << "  \"vecmath_backend\": \"" << vecmath::BackendName() << "\",\n"
+       << "  \"min_time\": " << mintime << ",\n"
+       << "  \"benchmarks\": [";
+
+  for( unsigned i = 0; i < results.size(); ++i ){
+    const Result& r = results[i];
+    fout << ( i ? "," : "" ) << "\n    {"
+         << "\"name\": \"" << r.name << "\""
+         << ", \"items\": " << r.items
+         << ", \"iterations\": " << r.iterations
+         << ", \"ns_per_call\": " << r.median
+         << ", \"ns_per_call_min\": " << r.min
+         << ", \"ns_per_item\": " << r.median / r.items << "}";
+  }
+
+  fout << "\n  ]\n}\n";
+}
+
+
+int
+main( int argc, char* argv[] )
+{
+  const std::string output = argc > 1 ? argv[1] : "benchmark.json";
+  filter  = argc > 2 ? argv[2] : "";
+  mintime = argc > 3 ? std::atof( argv[3] ) : mintime;
+
+  const std::string dir = ( std::filesystem::temp_directory_path()
+                            / usr::fstr( "sipmbench_%d", (int)getpid() ) );
+  std::filesystem::create_directories( dir );
+
+  BenchFiles( dir );
+  BenchSiPMPdf();
+  BenchMDistro();
+  BenchModels();
+
+  std::filesystem::remove_all( dir );
+  WriteJSON( output );
+  std::cout << "Results written to " << output << std::endl;
+  return 0;
+}
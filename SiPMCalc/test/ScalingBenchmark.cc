@@ -0,0 +1,642 @@
+#include "SiPMCalib/InvSqCalc/interface/InvSqFunc.hpp"
+#include "SiPMCalib/SiPMCalc/interface/NonLinearModel.hpp"
+
+#include "UserUtils/Common/interface/ArgumentExtender.hpp"
+#include "UserUtils/Common/interface/STLUtils/StringUtils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// End-to-end scaling benchmark of the SiPMCalc programs. Synthetic DRS4 hex
+// waveform files and StdFormat zscan files of the requested sizes are
+// generated, and the SiPM_FitLowLight, SiPM_FitDark, SiPM_DarkTrigger and
+// SiPM_FitNonLinear programs are timed on them as separate processes, for
+// each number of events and each thread count (the programs without a thread
+// option are only run with 1 thread). With --files N, each configuration
+// processes N independent files with up to --jobs concurrent processes, as in
+// a calibration campaign.
+//
+// For each configuration the wall time, the CPU time and the peak memory of
+// the processes are recorded, with the throughput (events per second of wall
+// time) and the scaling efficiency wall(1 thread)/(n * wall(n threads)). The
+// results are printed as tables and written as JSON, and the stage profile of
+// each process (see the --profile option of the programs) is kept in the work
+// directory.
+//
+// Example:
+//   SiPM_ScalingBenchmark --events 1e3 1e4 1e5 1e6 --threads 1 2 4 8
+//       --output scaling.json
+
+namespace fs = std::filesystem;
+
+// ------------------------------------------------------------------------------
+// Synthetic inputs. The std distributions are implementation defined, so the
+// random numbers are derived from the raw mt19937_64 output directly, and the
+// files are identical on every machine for the same seed.
+// ------------------------------------------------------------------------------
+class Generator
+{
+public:
+  Generator( const unsigned seed, const unsigned index )
+  {
+    std::seed_seq seq{ seed, index };
+    _rng.seed( seq );
+  }
+
+  double
+  Uniform(){ return ( _rng() >> 11 ) * 0x1.0p-53; }
+
+  double
+  Gauss()
+  {
+    const double u = 1-Uniform();
+    return std::sqrt( -2 * std::log( u ) ) * std::cos( 2 * M_PI * Uniform() );
+  }
+
+  double
+  Exponential( const double tau ){ return -tau * std::log( 1-Uniform() ); }
+
+  unsigned
+  Poisson( const double mean )
+  {
+    const double limit = std::exp( -mean );
+    unsigned     n     = 0;
+    double       p     = Uniform();
+
+    while( p > limit ){
+      p *= Uniform();
+      ++n;
+    }
+
+    return n;
+  }
+
+private:
+  std::mt19937_64 _rng;
+};
+
+
+// Waveform settings: 1 ns samples, 8 bit samples (2 hex digits) with 1 mV per
+// count, inverted by WaveFormat. The pedestal sits at 110 counts, and a single
+// discharge peaks at ~4 counts, 4 samples after its start, with an area of
+// 48 mV-ns.
+static const unsigned wave_ped   = 110;
+static const double   wave_noise = 0.7;
+static const double   wave_amp   = 8;
+
+/**
+ * @brief Single discharge pulse shape at t samples after the discharge: a rise
+ * time of 2 samples and a decay time of 8 samples.
+ */
+static double
+Pulse( const double t )
+{
+  return t > 0 ? wave_amp * ( std::exp( -t / 8 )-std::exp( -t / 2 ) ) : 0;
+}
+
+
+static void
+WriteWave( std::ofstream& fout, const std::vector<double>& w )
+{
+  std::string line( 2 * w.size(), '0' );
+
+  for( unsigned j = 0; j < w.size(); ++j ){
+    const int  v = std::min( std::max( (int)std::lround( w[j] ), 0 ), 127 );
+    const char hex[] = "0123456789abcdef";
+    line[2 * j]   = hex[v / 16];
+    line[2 * j+1] = hex[v % 16];
+  }
+
+  fout << line << '\n';
+}
+
+
+/**
+ * @brief Waveform file with the given discharge pulses (number of discharges,
+ * start sample) added to each waveform by the `pulses` function.
+ */
+static void
+MakeWaveFile( const std::string& file, const unsigned long nevents,
+              const unsigned nsamples, Generator& gen,
+              const std::function<void( Generator&,
+                                        std::vector<std::pair<unsigned, double> >& )>& pulses )
+{
+  std::ofstream                            fout( file );
+  std::vector<double>                      w( nsamples );
+  std::vector<std::pair<unsigned, double> > list;
+  fout << "1 2 1" << '\n';
+
+  for( unsigned long i = 0; i < nevents; ++i ){
+    const double common = 0.3 * gen.Gauss();
+
+    for( unsigned j = 0; j < nsamples; ++j ){
+      w[j] = wave_ped+common+wave_noise * gen.Gauss();
+    }
+
+    list.clear();
+    pulses( gen, list );
+
+    for( const auto& p : list ){
+      for( unsigned j = 0; j < nsamples; ++j ){
+        w[j] -= p.first * Pulse( j-p.second );
+      }
+    }
+
+    WriteWave( fout, w );
+  }
+}
+
+
+/**
+ * @brief Low light spectrum: Poisson number of photons (mean 2) at sample 12,
+ * with geometric crosstalk and rare dark pulses.
+ */
+static void
+MakeLowLight( const std::string& file, const unsigned long n,
+              const unsigned nsamples, Generator& gen )
+{
+  MakeWaveFile( file, n, nsamples, gen,
+                [nsamples]( Generator& g,
+                            std::vector<std::pair<unsigned, double> >& list ){
+    unsigned npe = g.Poisson( 2.0 );
+
+    for( unsigned k = npe; k > 0; --k ){
+      while( g.Uniform() < 0.05 ){ ++npe; }
+    }
+
+    list.emplace_back( npe, 12 );
+    if( g.Uniform() < 0.02 ){
+      list.emplace_back( 1, -(double)nsamples+2 * nsamples * g.Uniform() );
+    }
+  } );
+}
+
+
+/**
+ * @brief Dark spectrum: random triggers with dark pulses at random times.
+ */
+static void
+MakeDark( const std::string& file, const unsigned long n,
+          const unsigned nsamples, Generator& gen )
+{
+  MakeWaveFile( file, n, nsamples, gen,
+                [nsamples]( Generator& g,
+                            std::vector<std::pair<unsigned, double> >& list ){
+    if( g.Uniform() < 0.1 ){
+      list.emplace_back( 1, -(double)nsamples+2 * nsamples * g.Uniform() );
+    }
+  } );
+}
+
+
+/**
+ * @brief Dark triggered waveforms: a discharge at the start of the waveform
+ * (with crosstalk), peaking in the crosstalk window of SiPM_DarkTrigger,
+ * followed by an afterpulse or a second dark discharge.
+ */
+static void
+MakeDarkTrigger( const std::string& file, const unsigned long n,
+                 const unsigned nsamples, Generator& gen )
+{
+  MakeWaveFile( file, n, nsamples, gen,
+                []( Generator& g,
+                    std::vector<std::pair<unsigned, double> >& list ){
+    unsigned npe = 1;
+
+    while( g.Uniform() < 0.1 ){ ++npe; }
+
+    list.emplace_back( npe, 0 );
+    list.emplace_back( 1, g.Uniform() < 0.2 ?
+                       g.Exponential( 15 ) :
+                       g.Exponential( 2000 ) );
+  } );
+}
+
+
+// Zscan settings: inverse square law luminosity with the NLO non-linear
+// readout of a 14400 pixel SiPM.
+static const double   zscan_invsq[5] = { -5, 0.5, 2e7, 0, 1 };
+static const double   zscan_nlo[5]   = { 1.2, 14400, 0, 0.05, 2 };
+static const unsigned zscan_nz       = 40;
+static const unsigned zscan_nbias    = 5;
+
+static double
+ZScanPhotons( const double z, const double bias )
+{
+  return InvSq_Z( &z, zscan_invsq ) * ( bias / 1000 ) * ( bias / 1000 );
+}
+
+
+/**
+ * @brief StdFormat zscan file: z positions 10-400 mm and LED biases of
+ * 1000-1200 mV, cycled over the rows, with the readout and its uncertainty as
+ * the data columns.
+ */
+static void
+MakeZScan( const std::string& file, const unsigned long n,
+           const unsigned, Generator& gen )
+{
+  std::ofstream fout( file );
+
+  for( unsigned long i = 0; i < n; ++i ){
+    const double z       = 10+390.0 * ( i % zscan_nz ) / ( zscan_nz-1 );
+    const double bias    = 1000+50 * ( ( i / zscan_nz ) % zscan_nbias );
+    const double photons = ZScanPhotons( z, bias );
+    const double readout = NLOModel( &photons, zscan_nlo );
+    const double unc     = 0.01 * readout+1;
+
+    fout << usr::fstr( "%.1lf 0 100 100 %.1lf %.1lf 25 25 %.4lf %.4lf\n",
+                       0.5 * i, z, bias, readout+unc * gen.Gauss(), unc );
+  }
+}
+
+
+// ------------------------------------------------------------------------------
+// Running the programs
+// ------------------------------------------------------------------------------
+struct Program
+{
+  std::string name;
+  bool        threaded;
+  std::function<void( const std::string&, const unsigned long,
+                      const unsigned, Generator& )> generate;
+  std::function<std::vector<std::string>( const std::string& input,
+                                          const std::string& output,
+                                          const unsigned     nthreads )> args;
+};
+
+
+static std::vector<Program>
+MakePrograms( const unsigned nsamples )
+{
+  const std::string intstop = std::to_string( std::min( nsamples, 60u ) );
+
+  return {
+    Program{ "SiPM_FitLowLight", true, MakeLowLight,
+             [intstop]( const std::string& in, const std::string& out,
+                        const unsigned n ){
+      return std::vector<std::string>{
+        "--input", in, "--waveform", "1", "--binwidth", "2",
+        "--intstart", "10", "--intstop", intstop,
+        "--pedstart", "0", "--pedstop", "8",
+        "--nthreads", std::to_string( n ),
+        "--outputdir", out, "--savetxt", "fit" };
+    } },
+    Program{ "SiPM_FitDark", true, MakeDark,
+             [intstop]( const std::string& in, const std::string& out,
+                        const unsigned n ){
+      return std::vector<std::string>{
+        "--data", in, "--output", out+"/dark", "--adcbin", "2",
+        "--start", "10", "--end", intstop,
+        "--nthreads", std::to_string( n ) };
+    } },
+    Program{ "SiPM_DarkTrigger", false, MakeDarkTrigger,
+             []( const std::string& in, const std::string& out,
+                 const unsigned ){
+      return std::vector<std::string>{ in, out+"/trigger" };
+    } },
+    Program{ "SiPM_FitNonLinear", false, MakeZScan,
+             []( const std::string& in, const std::string& out,
+                 const unsigned ){
+      return std::vector<std::string>{
+        "--zscandata", in, "--linpmin", "1000", "--linpmax", "1000",
+        "--powerz", "400",
+        "--refpoint", usr::fstr( "%.3lf", ZScanPhotons( 300, 1000 ) ),
+        "300", "1000",
+        "--gain", usr::fstr( "%.3lf", zscan_nlo[0] ), "--ped", "0",
+        "--nlplot", out+"/nl.pdf" };
+    } }
+  };
+}
+
+
+struct Result
+{
+  std::string   program;
+  unsigned long events;
+  unsigned      threads;
+  unsigned      files;
+  unsigned      failed;
+  double        wall;// [s]
+  double        cpu;// [s], user+system of all processes
+  long          maxrss;// [kB], largest of all processes
+};
+
+
+/**
+ * @brief Running the commands with up to `jobs` concurrent processes. The
+ * output of the processes is appended to the log file.
+ */
+static Result
+RunCommands( const std::vector<std::vector<std::string> >& cmds,
+             const unsigned jobs, const std::string& log )
+{
+  typedef std::chrono::steady_clock clock;
+
+  Result   ans{};
+  unsigned next    = 0;
+  unsigned running = 0;
+  const auto t0    = clock::now();
+
+  while( next < cmds.size() || running > 0 ){
+    if( next < cmds.size() && running < jobs ){
+      const std::vector<std::string>& cmd = cmds[next++];
+      const pid_t                     pid = fork();
+
+      if( pid == 0 ){
+        const int fd = open( log.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644 );
+        dup2( fd, STDOUT_FILENO );
+        dup2( fd, STDERR_FILENO );
+
+        std::vector<char*> argv;
+
+        for( const auto& a : cmd ){
+          argv.push_back( const_cast<char*>( a.c_str() ) );
+        }
+
+        argv.push_back( nullptr );
+        execvp( argv[0], argv.data() );
+        std::perror( argv[0] );
+        _exit( 127 );
+      } else if( pid < 0 ){
+        ++ans.failed;
+      } else {
+        ++running;
+      }
+
+      continue;
+    }
+
+    int    status;
+    rusage ru;
+    if( wait4( -1, &status, 0, &ru ) < 0 ){ break; }
+    --running;
+
+    ans.cpu += ru.ru_utime.tv_sec+1e-6 * ru.ru_utime.tv_usec
+               +ru.ru_stime.tv_sec+1e-6 * ru.ru_stime.tv_usec;
+    ans.maxrss = std::max( ans.maxrss, ru.ru_maxrss );
+    if( !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 ){
+      ++ans.failed;
+    }
+  }
+
+  ans.wall = std::chrono::duration<double>( clock::now()-t0 ).count();
+  return ans;
+}
+
+
+static double
+Efficiency( const std::vector<Result>& results, const Result& r )
+{
+  for( const auto& base : results ){
+    if( base.program == r.program && base.events == r.events
+        && base.threads == 1 && base.failed == 0 ){
+      return base.wall / ( r.threads * r.wall );
+    }
+  }
+
+  return std::nan( "" );
+}
+
+
+static void
+PrintTables( const std::vector<Result>& results, std::ostream& out )
+{
+  std::string last = "";
+
+  for( const auto& r : results ){
+    if( r.program != last ){
+      out << "\n" << r.program << "\n"
+          << usr::fstr( "%12s %8s %10s %10s %10s %14s %10s %7s\n",
+                        "events", "threads", "wall[s]", "cpu[s]",
+                        "rss[MB]", "events/s", "efficiency", "failed" );
+      last = r.program;
+    }
+
+    out << usr::fstr( "%12lu %8u %10.3lf %10.3lf %10.1lf %14.1lf %10.3lf %7u\n",
+                      r.events, r.threads, r.wall, r.cpu, r.maxrss / 1024.,
+                      r.events * r.files / r.wall, Efficiency( results, r ),
+                      r.failed );
+  }
+}
+
+
+static void
+WriteJSON( const std::vector<Result>& results,
+           const unsigned             nsamples,
+           const unsigned             jobs,
+           const std::string&         file )
+{
+  std::ofstream fout( file );
+  fout << "{\n"
+       << "  \"samples_per_waveform\": " << nsamples << ",\n"
+       << "  \"jobs\": " << jobs << ",\n"
+       << "  \"hardware_threads\": " << std::thread::hardware_concurrency()
+       << ",\n  \"results\": [";
+
+  for( unsigned i = 0; i < results.size(); ++i ){
+    const Result& r   = results[i];
+    const double  eff = Efficiency( results, r );
+    fout << ( i ? "," : "" ) << "\n    {"
+         << "\"program\": \"" << r.program << "\""
+         << ", \"events\": " << r.events
+         << ", \"threads\": " << r.threads
+         << ", \"files\": " << r.files
+         << ", \"failed\": " << r.failed
+         << ", \"wall_time\": " << r.wall
+         << ", \"cpu_time\": " << r.cpu
+         << ", \"max_rss_kb\": " << r.maxrss
+         << ", \"events_per_second\": " << r.events * r.files / r.wall
+         << ", \"efficiency\": ";
+    if( std::isfinite( eff ) ){
+      fout << eff;
+    } else {
+      fout << "null";
+    }
+    fout << "}";
+  }
+
+  fout << "\n  ]\n}\n";
+}
+
+
+int
+main( int argc, char* argv[] )
+{
+  usr::po::options_description desc(
+    "End-to-end scaling benchmark of the SiPMCalc programs" );
+  desc.add_options()
+    ( "events",
+    usr::po::multivalue<double>(),
+    "Number of events (waveforms, or zscan rows) per file, default 1e3 to 1e7" )
+    ( "threads",
+    usr::po::multivalue<unsigned>(),
+    "Thread counts of the threaded programs, default 1 to all cores in "
+    "factors of 2" )
+    ( "programs",
+    usr::po::multivalue<std::string>(),
+    "Programs to run, default all of SiPM_FitLowLight, SiPM_FitDark, "
+    "SiPM_DarkTrigger and SiPM_FitNonLinear" )
+    ( "files",
+    usr::po::defvalue<unsigned>( 1 ),
+    "Number of independent input files per configuration" )
+    ( "jobs",
+    usr::po::defvalue<unsigned>( 1 ),
+    "Number of files processed concurrently" )
+    ( "samples",
+    usr::po::defvalue<unsigned>( 64 ),
+    "Number of samples per waveform" )
+    ( "seed", usr::po::defvalue<unsigned>( 1 ), "Random seed of the inputs" )
+    ( "bindir",
+    usr::po::value<std::string>(),
+    "Directory of the programs, default is the directory of this program, or "
+    "the PATH if called without a directory" )
+    ( "workdir",
+    usr::po::value<std::string>(),
+    "Directory of the input files, logs and outputs, default is a new "
+    "temporary directory" )
+    ( "keep", "Keep the generated input files" )
+    ( "output",
+    usr::po::defvalue<std::string>( "scaling.json" ),
+    "Output JSON file" )
+  ;
+
+  usr::ArgumentExtender args;
+  args.AddOptions( desc );
+  args.ParseOptions( argc, argv );
+
+  std::vector<double> events = { 1e3, 1e4, 1e5, 1e6, 1e7 };
+  if( args.CheckArg( "events" ) ){ events = args.ArgList<double>( "events" ); }
+
+  std::vector<unsigned> threads;
+  if( args.CheckArg( "threads" ) ){
+    threads = args.ArgList<unsigned>( "threads" );
+  } else {
+    for( unsigned n = 1; n < std::thread::hardware_concurrency(); n *= 2 ){
+      threads.push_back( n );
+    }
+
+    threads.push_back( std::max( std::thread::hardware_concurrency(), 1u ) );
+  }
+
+  const unsigned nfiles   = std::max( args.Arg<unsigned>( "files" ), 1u );
+  const unsigned jobs     = std::max( args.Arg<unsigned>( "jobs" ), 1u );
+  const unsigned nsamples = std::max( args.Arg<unsigned>( "samples" ), 16u );
+  const unsigned seed     = args.Arg<unsigned>( "seed" );
+
+  std::string bindir = fs::path( argv[0] ).parent_path();
+  bindir = args.ArgOpt<std::string>( "bindir", bindir );
+
+  const fs::path work = args.CheckArg( "workdir" ) ?
+                        fs::path( args.Arg<std::string>( "workdir" ) ) :
+                        fs::temp_directory_path()
+                        / usr::fstr( "sipmscaling_%d", (int)getpid() );
+  fs::create_directories( work );
+  const std::string log = work / "programs.log";
+
+  std::vector<Program> programs = MakePrograms( nsamples );
+  if( args.CheckArg( "programs" ) ){
+    const auto names = args.ArgList<std::string>( "programs" );
+    programs.erase( std::remove_if( programs.begin(), programs.end(),
+                                    [&names]( const Program& p ){
+      return std::find( names.begin(), names.end(), p.name ) == names.end();
+    } ), programs.end() );
+  }
+
+  // The input files of a single size are kept at the same time, unless the
+  // keep option is set, the waveform files are the largest.
+  double disk = 0;
+
+  for( const double nev : events ){
+    const double size = nev * nfiles * ( 2 * nsamples+1 );
+    disk = args.CheckArg( "keep" ) ? disk+programs.size() * size :
+           std::max( disk, size );
+  }
+
+  std::cout << usr::fstr( "Input files will use up to %.1lf MB in %s",
+                          disk / 1e6, work.string() ) << std::endl;
+
+  std::vector<Result> results;
+
+  for( const auto& prog : programs ){
+    const std::string exe = bindir.empty() ? prog.name :
+                            ( fs::path( bindir ) / prog.name ).string();
+
+    for( const double nev : events ){
+      const unsigned long n = std::llround( nev );
+
+      // Generating the input files, identical for all thread counts
+      std::vector<std::string> inputs;
+
+      for( unsigned f = 0; f < nfiles; ++f ){
+        inputs.push_back( work / usr::fstr( "%s_%lu_%u.txt",
+                                            prog.name, n, f ) );
+        Generator gen( seed, f );
+        prog.generate( inputs.back(), n, nsamples, gen );
+      }
+
+      for( const unsigned nthread : threads ){
+        if( !prog.threaded && nthread != 1 ){ continue; }
+
+        std::vector<std::vector<std::string> > cmds;
+
+        for( unsigned f = 0; f < nfiles; ++f ){
+          const std::string tag = usr::fstr( "%s_%lu_%u_%u",
+                                             prog.name, n, nthread, f );
+          const std::string out = work / tag;
+          fs::create_directories( out );
+
+          std::vector<std::string> cmd = { exe };
+          const auto               a   = prog.args( inputs[f], out, nthread );
+          cmd.insert( cmd.end(), a.begin(), a.end() );
+          cmd.insert( cmd.end(), { "--profile", out+"/profile.json" } );
+          cmds.push_back( cmd );
+        }
+
+        std::cout << usr::fstr( "Running %s with %lu events, %u threads, "
+                                "%u files...", prog.name, n, nthread, nfiles )
+                  << std::flush;
+
+        Result r = RunCommands( cmds, jobs, log );
+        r.program = prog.name;
+        r.events  = n;
+        r.threads = nthread;
+        r.files   = nfiles;
+        results.push_back( r );
+
+        std::cout << usr::fstr( " %.3lf s%s", r.wall,
+                                r.failed ? " (failed, see the log)" : "" )
+                  << std::endl;
+      }
+
+      if( !args.CheckArg( "keep" ) ){
+        for( const auto& in : inputs ){
+          fs::remove( in );
+        }
+      }
+    }
+  }
+
+  PrintTables( results, std::cout );
+  WriteJSON( results, nsamples, jobs, args.Arg<std::string>( "output" ) );
+  std::cout << "\nResults written to " << args.Arg<std::string>( "output" )
+            << ", program logs and profiles in " << work.string()
+            << std::endl;
+  return 0;
+}
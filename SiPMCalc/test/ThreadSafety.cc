@@ -0,0 +1,133 @@
+#include "SiPMCalib/SiPMCalc/interface/SiPMDarkFunc.hpp"
+#include "SiPMCalib/SiPMCalc/interface/SiPMPdf.hpp"
+
+#include "RooRealVar.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+// Stress test of the concurrent const evaluation of the SiPMPdf (direct and
+// FFT backends) and of a shared MDistro instance. All threads must reproduce
+// the single threaded results exactly. To check for data races, compile this
+// file together with the SiPMCalc sources with -fsanitize=thread -g -O1 and
+// run the resulting binary, ThreadSanitizer should report no warnings.
+//
+// Usage: SiPM_ThreadSafety [nthreads] [iterations]
+
+struct Reference
+{
+  double              eval;
+  double              norm;
+  std::vector<double> integral;
+  std::vector<double> cdf;
+};
+
+static Reference
+MakeReference( const SiPMPdf& pdf, const std::vector<double>& pts )
+{
+  Reference ans;
+  ans.eval = pdf.Eval();
+  ans.norm = pdf.analyticalIntegral( 1 );
+
+  for( const double x : pts ){
+    ans.integral.push_back( pdf.analyticalIntegral( x ) );
+  }
+
+  pdf.EdgeCDF( pts, ans.cdf );
+  return ans;
+}
+
+
+int
+main( int argc, char* argv[] )
+{
+  const unsigned nthreads = argc > 1 ? std::atoi( argv[1] ) :
+                            std::max( std::thread::hardware_concurrency(), 2u );
+  const unsigned niter = argc > 2 ? std::atoi( argv[2] ) : 50;
+
+  RooRealVar x( "x", "x", -100, 3000 );
+  RooRealVar ped( "ped", "ped", 0 );
+  RooRealVar gain( "gain", "gain", 120 );
+  RooRealVar s0( "s0", "s0", 8 );
+  RooRealVar s1( "s1", "s1", 3 );
+  RooRealVar mean( "mean", "mean", 4 );
+  RooRealVar lambda( "lambda", "lambda", 0.05 );
+  RooRealVar alpha( "alpha", "alpha", 0.05 );
+  RooRealVar beta( "beta", "beta", 80 );
+  RooRealVar dcfrac( "dcfrac", "dcfrac", 0.02 );
+  RooRealVar eps( "eps", "eps", 0.01 );
+  x.setVal( 250 );
+  x.setBins( 8192 );
+
+  SiPMPdf direct( "direct", "direct", x, ped, gain, s0, s1, mean, lambda,
+                  alpha, beta, dcfrac, eps );
+  SiPMPdf fft( direct, "fft" );
+  direct.SetEvalMode( SiPMPdf::kDirect );
+  fft.SetEvalMode( SiPMPdf::kFFT );
+
+  std::vector<double> pts;
+
+  for( double v = -80; v < 2000; v += 23.7 ){
+    pts.push_back( v );
+  }
+
+  // MDistro shared by all threads, with the threads cycling through several
+  // smearing widths so that the table of the instance is constantly swapped.
+  MDistro             mdistro;
+  std::vector<double> widths = { 4, 6, 9, 13 };
+  std::vector<double> mref;
+
+  for( const double w : widths ){
+    for( const double v : pts ){
+      mref.push_back( mdistro.Lookup( 0, 120, 0.01, w )->Evaluate( v ) );
+    }
+  }
+
+  mdistro.GetCache()->SetCapacity( 2 );// Forcing recalculations
+
+  const Reference dref = MakeReference( direct, pts );
+  const Reference fref = MakeReference( fft, pts );
+
+  std::atomic<unsigned> nfail( 0 );
+
+  auto Compare = [&nfail]( const Reference& a, const Reference& b ){
+                   if( a.eval != b.eval || a.norm != b.norm
+                       || a.integral != b.integral || a.cdf != b.cdf ){
+                     ++nfail;
+                   }
+                 };
+
+  auto Run = [&]( const unsigned t ){
+               for( unsigned i = 0; i < niter; ++i ){
+                 Compare( MakeReference( direct, pts ), dref );
+                 Compare( MakeReference( fft, pts ), fref );
+
+                 const unsigned wi = ( t+i ) % widths.size();
+                 const auto     tb = mdistro.Lookup( 0, 120, 0.01, widths[wi] );
+
+                 for( unsigned j = 0; j < pts.size(); ++j ){
+                   if( tb->Evaluate( pts[j] ) != mref[wi * pts.size()+j] ){
+                     ++nfail;
+                   }
+                 }
+               }
+             };
+
+  std::vector<std::thread> threads;
+
+  for( unsigned t = 0; t < nthreads; ++t ){
+    threads.emplace_back( Run, t );
+  }
+
+  for( auto& t : threads ){
+    t.join();
+  }
+
+  std::cout << "Threads: " << nthreads << ", iterations: " << niter
+            << ", mismatches: " << nfail << std::endl;
+  std::cout << ( nfail == 0 ? "PASSED" : "FAILED" ) << std::endl;
+  return nfail == 0 ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+#include "SiPMCalib/SiPMCalc/interface/VecMath.hpp"
+
+#include "TMath.h"
+#include "TRandom3.h"
+
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+// Comparing the vecmath kernels to the TMath functions used previously in the
+// PDF evaluations. Set SIPMCALIB_VECMATH_ISA to validate a specific backend.
+static const unsigned N = 1000003;
+
+double
+MaxRelDiff( const std::vector<double>& x,
+            const std::vector<double>& ans,
+            std::function<double(double)> ref )
+{
+  double max = 0;
+
+  for( unsigned i = 0; i < x.size(); ++i ){
+    const double r = ref( x[i] );
+    if( std::fabs( r ) < 1e-300 ){ continue; }
+    max = std::max( max, std::fabs( ( ans[i]-r ) / r ) );
+  }
+
+  return max;
+}
+
+
+int
+main( int argc, char* argv[] )
+{
+  TRandom3            rand( 1234 );
+  std::vector<double> x( N );
+  std::vector<double> ans( N );
+  bool                pass = true;
+
+  std::cout << "Backend: " << vecmath::BackendName() << std::endl;
+
+  auto Check = [&pass]( const char* name, const int mode, const double diff ){
+                 const double tol = mode == vecmath::kAccurate ? 1e-12 : 1e-8;
+                 std::cout << name << ( mode == vecmath::kAccurate ? " [accurate]" : " [fast]" )
+                           << " max relative difference: " << diff << std::endl;
+                 pass = pass && diff < tol;
+               };
+
+  for( int mode : { vecmath::kAccurate, vecmath::kFast } ){
+    const vecmath::Precision p = (vecmath::Precision)mode;
+
+    for( auto& v : x ){ v = rand.Uniform( -700, 700 ); }
+    vecmath::Exp( x.data(), ans.data(), N, p );
+    Check( "Exp", mode, MaxRelDiff( x, ans, []( double v ){
+      return TMath::Exp( v );
+    } ) );
+
+    for( auto& v : x ){ v = std::exp2( rand.Uniform( -1000, 1000 ) ); }
+    vecmath::Log( x.data(), ans.data(), N, p );
+    Check( "Log", mode, MaxRelDiff( x, ans, []( double v ){
+      return TMath::Log( v );
+    } ) );
+
+    for( auto& v : x ){ v = rand.Uniform( -6, 6 ); }
+    vecmath::Erf( x.data(), ans.data(), N, p );
+    Check( "Erf", mode, MaxRelDiff( x, ans, []( double v ){
+      return TMath::Erf( v );
+    } ) );
+
+    vecmath::Erfc( x.data(), ans.data(), N, p );
+    Check( "Erfc", mode, MaxRelDiff( x, ans, []( double v ){
+      return TMath::Erfc( v );
+    } ) );
+
+    // Ranges typical of the SiPM readout values: the Gaussian tails used in
+    // the fit rarely go beyond 10 sigma.
+    for( auto& v : x ){ v = rand.Uniform( -200, 1800 ); }
+    vecmath::NormalPdf( x.data(), 300, 120, ans.data(), N, p );
+    Check( "NormalPdf", mode, MaxRelDiff( x, ans, []( double v ){
+      return TMath::Gaus( v, 300, 120, kTRUE );
+    } ) );
+
+    // Using the Erfc form for the reference, as 0.5*(1+Erf) loses relative
+    // precision in the lower tail.
+    vecmath::NormalCdf( x.data(), 300, 120, ans.data(), N, p );
+    Check( "NormalCdf", mode, MaxRelDiff( x, ans, []( double v ){
+      return 0.5 * TMath::Erfc( ( 300-v ) / ( TMath::Sqrt( 2 ) * 120 ) );
+    } ) );
+  }
+
+  std::cout << ( pass ? "PASSED" : "FAILED" ) << std::endl;
+  return pass ? 0 : 1;
+}